@@ -2,7 +2,12 @@
 
 uniform vec4 illumination_color;
 
+#ifdef PALETTE_INDEXED
+uniform usampler2DArray diffuseTex;
+uniform sampler2D paletteTex;
+#else
 uniform sampler2DArray diffuseTex;
+#endif
 
 in vec3 pos_viewspace;
 in vec3 n_viewspace;
@@ -18,7 +23,12 @@ out vec4 IlluminationData;
 
 void main()
 {
+#ifdef PALETTE_INDEXED
+    uint index = texture(diffuseTex, TexCoords.xyz).r;
+    vec4 color = vec4(texelFetch(paletteTex, ivec2(index, 0), 0).rgb, 0.0);
+#else
     vec4 color = vec4(texture(diffuseTex, TexCoords.xyz).rgb, 0.0);
+#endif
     vec4 nn = vec4(0.5, 0.5, 1.0, 1.0);
 
     mat3 nmat = mat3(normalize(t_viewspace),
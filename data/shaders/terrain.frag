@@ -2,7 +2,12 @@
 
 uniform vec4 illumination_color;
 
+#ifdef PALETTE_INDEXED
+uniform usampler2DArray diffuseTex;
+uniform sampler2D paletteTex;
+#else
 uniform sampler2DArray diffuseTex;
+#endif
 
 in vec3 pos_viewspace;
 in vec3 n_viewspace;
@@ -19,7 +24,12 @@ out vec4 IlluminationData;
 void main()
 {
     vec3 coord = vec3(TexCoords.xy, float(TexIndex));
+#ifdef PALETTE_INDEXED
+    uint index = texture(diffuseTex, coord).r;
+    vec4 color = vec4(texelFetch(paletteTex, ivec2(index, 0), 0).rgb, 0.0);
+#else
     vec4 color = vec4(texture(diffuseTex, coord).rgb, 0.0);
+#endif
     vec4 nn = vec4(0.5, 0.5, 1.0, 1.0);
 
     mat3 nmat = mat3(normalize(t_viewspace),
@@ -23,8 +23,20 @@ void main()
     vec4 pos = osg_Vertex + vec4(x*256, 0, y*-256, 0);
 
     gl_Position = osg_ModelViewProjectionMatrix * pos;
-    TexCoords = osg_MultiTexCoord0;
-    TexIndex = texelFetch(tilemapTex, ivec2(x, y), 0).r;
+
+    // The upper six bits select the tile, and the lower two how many times
+    // to rotate it by 90 degrees.
+    uint tile = texelFetch(tilemapTex, ivec2(x, y), 0).r;
+    uint rotation = tile & 3u;
+    vec2 uv = osg_MultiTexCoord0.xy;
+    if(rotation == 1u)
+        uv = vec2(1.0-uv.y, uv.x);
+    else if(rotation == 2u)
+        uv = vec2(1.0-uv.x, 1.0-uv.y);
+    else if(rotation == 3u)
+        uv = vec2(uv.y, 1.0-uv.x);
+    TexCoords = vec4(uv, osg_MultiTexCoord0.zw);
+    TexIndex = tile >> 2u;
 
     pos_viewspace = (osg_ModelViewMatrix * pos).xyz;
 
@@ -1,15 +1,33 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include <stdexcept>
 #include <sstream>
 #include <fstream>
 #include <iomanip>
 #include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
 #include <array>
+#include <chrono>
+#include <vector>
+#include <set>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <algorithm>
 
 #include "components/archives/bsaarchive.hpp"
+#include "misc/flathashmap.hpp"
+#include "misc/threadpool.hpp"
 
 #ifdef _WIN32
 #include <direct.h>
@@ -18,135 +36,718 @@
 #endif
 
 
-int main(int argc, char *argv[])
+namespace
 {
-    if(argc < 2)
+
+/* Compares the cost of looking up every key in a table of the given size,
+ * using the old sorted set + std::distance approach and the flat hash map the
+ * archives now use.
+ */
+void runLookupBench()
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    static const size_t sizes[] = { 64, 256, 1024, 4096, 16384 };
+
+    std::cout<< std::setw(8)<<"entries"<<std::setw(20)<<"set (ns/lookup)"
+             <<std::setw(20)<<"hash (ns/lookup)" <<std::endl;
+    for(size_t count : sizes)
     {
-        std::cerr<< "Usage: "<<argv[0]<<" [option]" <<std::endl
-                 << "  Available options:" <<std::endl
-                 << "    -e <archive.bsa>  - Extract files from BSA" <<std::endl
-                 <<std::endl;
-        return 1;
+        std::vector<std::string> names;
+        names.reserve(count);
+        for(size_t i = 0;i < count;++i)
+        {
+            std::stringstream sstr;
+            sstr<< std::setfill('0')<<std::setw(8)<<(i*7919 % 100000000)<<".RMB";
+            names.push_back(sstr.str());
+        }
+
+        std::set<std::string> lookupset(names.begin(), names.end());
+        Misc::FlatHashMap<std::string,size_t> lookuphash;
+        lookuphash.reserve(count);
+        for(size_t i = 0;i < count;++i)
+            lookuphash.insert(names[i], i);
+
+        // Repeat enough times to get a measurable total for small tables.
+        size_t reps = std::max<size_t>(1, 262144/count);
+        size_t check = 0;
+
+        auto start = Clock::now();
+        for(size_t r = 0;r < reps;++r)
+        {
+            for(const std::string &name : names)
+                check += std::distance(lookupset.begin(), lookupset.find(name.c_str()));
+        }
+        auto settime = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-start);
+
+        start = Clock::now();
+        for(size_t r = 0;r < reps;++r)
+        {
+            for(const std::string &name : names)
+                check += *lookuphash.find(name.c_str());
+        }
+        auto hashtime = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-start);
+
+        double lookups = double(reps) * count;
+        std::cout<< std::setw(8)<<count<<std::fixed<<std::setprecision(1)
+                 <<std::setw(20)<<(settime.count()/lookups)
+                 <<std::setw(20)<<(hashtime.count()/lookups)
+                 <<std::setw(0)<<"   (check "<<check<<")" <<std::endl;
     }
+}
 
-    const char *archname = nullptr;
-    for(int i = 1;i < argc;++i)
+
+/* Tries to drop the file's pages from the OS cache, so the next read comes
+ * from disk. Returns false if that's not possible.
+ */
+bool dropFileCache(const char *fname)
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0) return false;
+    fdatasync(fd);
+    bool ret = (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+    close(fd);
+    return ret;
+#else
+    (void)fname;
+    return false;
+#endif
+}
+
+/* Reads every entry in the archive, one stream at a time (useIoUring < 0) or
+ * as a batch, and returns the total number of bytes read.
+ */
+size_t readAllEntries(const char *archname, int useIoUring)
+{
+    Archives::BsaArchive archive;
+    archive.load(archname, false);
+
+    std::vector<size_t> ids(archive.getIds().begin(), archive.getIds().end());
+    std::vector<std::string> names(archive.list().begin(), archive.list().end());
+
+    size_t total = 0;
+    if(useIoUring < 0)
     {
-        if(strcmp(argv[i], "-e") == 0)
+        std::vector<char> buf;
+        auto readStream = [&buf, &total](Archives::IStreamPtr stream)
         {
-            if(argc-1 <= i)
-                throw std::runtime_error("Missing archive filename");
-            archname = argv[++i];
-            break;
+            if(!stream) return;
+            std::array<char,4096> tmp;
+            buf.clear();
+            while(stream->read(tmp.data(), tmp.size()) || stream->gcount() > 0)
+                buf.insert(buf.end(), tmp.data(), tmp.data()+stream->gcount());
+            total += buf.size();
+        };
+        for(size_t id : ids)
+            readStream(archive.open(id));
+        for(const std::string &name : names)
+            readStream(archive.open(name.c_str()));
+    }
+    else
+    {
+        archive.setUseIoUring(useIoUring != 0);
+        for(const std::vector<char> &data : archive.readBatch(ids))
+            total += data.size();
+        for(const std::vector<char> &data : archive.readBatch(names))
+            total += data.size();
+    }
+    return total;
+}
+
+/* Compares reading every entry of an archive through individual streams
+ * against batched pread and io_uring reads, with a cold and warm cache.
+ */
+void runReadBench(const char *archname)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    static const struct {
+        const char *name;
+        int useIoUring;
+    } methods[] = {
+        { "stream", -1 },
+        { "pread", 0 },
+        { "io_uring", 1 },
+    };
+
+    bool can_drop = dropFileCache(archname);
+    if(!can_drop)
+        std::cerr<< "Unable to drop the file cache; cold results will be warm" <<std::endl;
+
+    std::cout<< std::setw(10)<<"method"<<std::setw(14)<<"cold (ms)"<<std::setw(14)<<"cold (MB/s)"
+             <<std::setw(14)<<"warm (ms)"<<std::setw(14)<<"warm (MB/s)" <<std::endl;
+    for(const auto &method : methods)
+    {
+        std::cout<< std::setw(10)<<method.name<<std::fixed<<std::setprecision(2);
+        for(int warm = 0;warm < 2;++warm)
+        {
+            if(!warm) dropFileCache(archname);
+            else readAllEntries(archname, method.useIoUring);
+
+            auto start = Clock::now();
+            size_t total = readAllEntries(archname, method.useIoUring);
+            double secs = std::chrono::duration<double>(Clock::now()-start).count();
+
+            std::cout<< std::setw(14)<<(secs*1000.0)<<std::setw(14)<<(total/1048576.0/secs);
         }
-        else
-            throw std::runtime_error(std::string("Invalid option: ")+argv[i]);
+        std::cout<<std::endl;
     }
+}
 
-    if(!archname)
-        throw std::runtime_error("No input specified");
 
-    Archives::BsaArchive archive;
-    archive.load(archname);
+enum CopyMethod {
+    Copy_Buffered, // Read each entry whole, and write it in one go
+    Copy_FileRange // Copy in the kernel with copy_file_range
+};
+
+struct ExtractJob {
+    std::string mName; // Empty for indexed archives
+    size_t mId;
+    std::string mOutName;
+};
 
+struct ExtractResult {
+    size_t mEntries;
+    uint64_t mBytes;
+    size_t mFailed;
+};
+
+/* Gets the archive's file name without the directory. */
+std::string getBaseName(const char *archname)
+{
     const char *fname = strrchr(archname, '/');
     if(fname) archname = fname+1;
     fname = strrchr(archname, '\\');
     if(!fname) fname = archname;
     else ++fname;
+    return fname;
+}
 
-    std::string dirname(fname);
+/* Gets the output directory name for an archive, e.g. ARCH3D_BSA. */
+std::string getOutputDir(const char *archname)
+{
+    std::string dirname = getBaseName(archname);
     size_t pos = dirname.rfind('.');
     if(pos != std::string::npos)
         dirname[pos] = '_';
     else
         dirname += '_';
+    return dirname;
+}
 
-    if(mkdir(dirname.c_str(), S_IRWXU) != 0 && errno != EEXIST)
-        throw std::runtime_error("Failed to create output dir "+dirname);
+/* Writes one entry to its output file, returning the number of bytes written,
+ * or -1 on failure.
+ */
+int64_t writeEntry(Archives::BsaArchive &archive, const ExtractJob &job, CopyMethod method, int infd)
+{
+    uint64_t offset, size;
+    bool found = job.mName.empty() ? archive.getRange(job.mId, &offset, &size) :
+                                     archive.getRange(job.mName.c_str(), &offset, &size);
+    if(!found) return -1;
 
-    std::set<size_t> ids = archive.getIds();
-    for(size_t id : ids)
+#ifdef HAVE_COPY_FILE_RANGE
+    if(method == Copy_FileRange && infd >= 0)
     {
-        Archives::IStreamPtr instream = archive.open(id);
-        if(!instream)
+        int outfd = open(job.mOutName.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if(outfd < 0) return -1;
+
+        loff_t inoff = offset;
+        uint64_t left = size;
+        while(left > 0)
         {
-            std::cerr<< "Failed to open ID "<<id<<" in archive" <<std::endl;
-            continue;
+            ssize_t got = copy_file_range(infd, &inoff, outfd, nullptr, left, 0);
+            if(got <= 0) break;
+            left -= got;
         }
+        close(outfd);
+        if(left == 0) return size;
+        // Not supported between these file systems. Copy it normally.
+    }
+#else
+    (void)method;
+    (void)infd;
+#endif
 
+    Archives::EntryData data = job.mName.empty() ? archive.readAll(job.mId) :
+                                                   archive.readAll(job.mName.c_str());
+    if(!data) return -1;
+
+    std::ofstream outstream(job.mOutName.c_str(), std::ios_base::binary);
+    if(!outstream.is_open() || !outstream.write(data.data(), data.size()))
+        return -1;
+    return data.size();
+}
+
+/* Extracts every entry of the archive into the output directory, spreading the
+ * entries over the given number of threads.
+ */
+ExtractResult extractArchive(const char *archname, const std::string &dirname, size_t threads,
+                             CopyMethod method, bool verbose)
+{
+    Archives::BsaArchive archive;
+    archive.load(archname);
+
+    if(mkdir(dirname.c_str(), S_IRWXU) != 0 && errno != EEXIST)
+        throw std::runtime_error("Failed to create output dir "+dirname);
+
+    std::vector<ExtractJob> jobs;
+    jobs.reserve(archive.getIds().size() + archive.list().size());
+    for(size_t id : archive.getIds())
+    {
         std::stringstream sstr;
         sstr<< dirname<<"/"<<std::setfill('0')<<std::setw(5)<<id;
-        std::string ofname = sstr.str();
-        std::cout<< "Writing "<<ofname<<"... ";
-        std::cout.flush();
+        jobs.push_back(ExtractJob{std::string(), id, sstr.str()});
+    }
+    for(const std::string &name : archive.list())
+        jobs.push_back(ExtractJob{name, 0, dirname+"/"+name});
+
+    int infd = -1;
+#ifdef HAVE_COPY_FILE_RANGE
+    if(method == Copy_FileRange)
+        infd = open(archname, O_RDONLY);
+#endif
 
-        std::ofstream outstream(ofname.c_str(), std::ios_base::binary);
-        if(!outstream.is_open())
+    std::atomic<size_t> next(0);
+    std::atomic<uint64_t> total(0);
+    std::atomic<size_t> failed(0);
+    std::mutex outmutex;
+    {
+        Misc::ThreadPool pool(threads);
+        std::vector<std::future<void>> workers;
+        for(size_t t = 0;t < pool.size();++t)
         {
-            std::cerr<< "Failed to open for writing" <<std::endl;
-            continue;
+            workers.push_back(pool.enqueue([&]()
+            {
+                size_t i;
+                while((i=next++) < jobs.size())
+                {
+                    int64_t got = writeEntry(archive, jobs[i], method, infd);
+                    if(got < 0)
+                    {
+                        ++failed;
+                        std::lock_guard<std::mutex> lock(outmutex);
+                        std::cerr<< "Failed to write "<<jobs[i].mOutName <<std::endl;
+                        continue;
+                    }
+                    total += got;
+                    if(verbose)
+                    {
+                        std::lock_guard<std::mutex> lock(outmutex);
+                        std::cout<< "Wrote "<<jobs[i].mOutName<<", "<<got<<" bytes" <<std::endl;
+                    }
+                }
+            }));
         }
+        for(std::future<void> &worker : workers)
+            worker.get();
+    }
+
+#ifdef HAVE_COPY_FILE_RANGE
+    if(infd >= 0)
+        close(infd);
+#endif
+
+    return ExtractResult{jobs.size()-failed, total, failed};
+}
+
+/* Extracts the archive with each copy method, using one thread and the given
+ * number of threads, and reports the throughput of each.
+ */
+void runExtractBench(const char *archname, size_t threads)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    static const struct {
+        const char *name;
+        CopyMethod method;
+    } methods[] = {
+        { "buffered", Copy_Buffered },
+#ifdef HAVE_COPY_FILE_RANGE
+        { "file_range", Copy_FileRange },
+#endif
+    };
 
-        size_t total = 0;
-        while(!instream->eof())
+    bool can_drop = dropFileCache(archname);
+    if(!can_drop)
+        std::cerr<< "Unable to drop the file cache; results will be warm" <<std::endl;
+
+    std::string dirname = getOutputDir(archname);
+    std::cout<< std::setw(12)<<"method"<<std::setw(9)<<"threads"<<std::setw(12)<<"time (ms)"
+             <<std::setw(14)<<"entries/s"<<std::setw(10)<<"MB/s" <<std::endl;
+    for(const auto &method : methods)
+    {
+        size_t counts[2] = { 1, threads };
+        for(size_t count : counts)
         {
-            std::array<char,4096> buf;
-            instream->read(buf.data(), buf.size());
-            size_t got = instream->gcount();
+            dropFileCache(archname);
 
-            if(got > 0)
-            {
-                if(!outstream.write(buf.data(), got))
-                    break;
-                total += got;
-            }
+            auto start = Clock::now();
+            ExtractResult res = extractArchive(archname, dirname, count, method.method, false);
+            double secs = std::chrono::duration<double>(Clock::now()-start).count();
+
+            std::cout<< std::setw(12)<<method.name<<std::setw(9)<<count<<std::fixed<<std::setprecision(2)
+                     <<std::setw(12)<<(secs*1000.0)<<std::setw(14)<<(res.mEntries/secs)
+                     <<std::setw(10)<<(res.mBytes/1048576.0/secs) <<std::endl;
+            if(count == threads) break;
         }
-        if(!outstream.good())
-            std::cerr<< "failed after writing "<<outstream.tellp()<<" bytes" <<std::endl;
-        else
-            std::cout<< "wrote "<<total<<" bytes" <<std::endl;
     }
+}
+
+
+struct RepackEntry {
+    std::string mName; // Empty for indexed archives
+    size_t mId;
+    uint64_t mOffset;
+    uint64_t mSize;
+
+    // Offset in the repacked archive
+    uint64_t mNewOffset;
+};
+
+struct TraceAccess {
+    std::string mName;
+    bool mCached;
+};
 
-    std::set<std::string> files = archive.list();
-    for(const std::string &name : files)
+/* Reads the accesses to the given archive from a trace. This can be a VFS
+ * trace (see the vfsstats console command), whose lines have the archive name
+ * in the second column, or a plain list of entry names or IDs, one per line.
+ */
+std::vector<TraceAccess> readTrace(const char *tracename, const std::string &archbase)
+{
+    std::ifstream trace(tracename);
+    if(!trace.is_open())
+        throw std::runtime_error(std::string("Failed to open ")+tracename);
+
+    std::vector<TraceAccess> accesses;
+    std::string line;
+    while(std::getline(trace, line))
     {
-        Archives::IStreamPtr instream = archive.open(name.c_str());
-        if(!instream)
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        if(line.find('\t') == std::string::npos)
         {
-            std::cerr<< "Failed to open "<<name<<" in archive" <<std::endl;
+            accesses.push_back(TraceAccess{line, false});
+            continue;
+        }
+
+        // time, archive, name, bytes, source, duration
+        std::vector<std::string> fields;
+        std::stringstream sstr(line);
+        std::string field;
+        while(std::getline(sstr, field, '\t'))
+            fields.push_back(field);
+        if(fields.size() < 5)
             continue;
+        for(char &c : fields[1])
+            c = std::toupper(static_cast<unsigned char>(c));
+        if(fields[1] != archbase || fields[4] == "missing")
+            continue;
+        accesses.push_back(TraceAccess{fields[2], fields[4] == "cache"});
+    }
+    return accesses;
+}
+
+/* Sums the distance the read position moves between each entry read from
+ * disk, for the given layout. Returns the number of reads that don't start
+ * where the last one ended.
+ */
+size_t measureSeeks(const std::vector<TraceAccess> &accesses,
+                    const std::map<std::string,size_t> &lookup,
+                    const std::vector<RepackEntry> &entries, bool repacked,
+                    uint64_t *distance)
+{
+    size_t seeks = 0;
+    uint64_t pos = 0;
+    *distance = 0;
+    for(const TraceAccess &access : accesses)
+    {
+        auto iter = lookup.find(access.mName);
+        if(iter == lookup.end() || access.mCached)
+            continue;
+
+        const RepackEntry &entry = entries[iter->second];
+        uint64_t start = repacked ? entry.mNewOffset : entry.mOffset;
+        if(start != pos)
+        {
+            ++seeks;
+            *distance += (start > pos) ? (start-pos) : (pos-start);
         }
+        pos = start + entry.mSize;
+    }
+    return seeks;
+}
 
-        std::string ofname = dirname+"/"+name;
-        std::cout<< "Writing "<<ofname<<"... ";
-        std::cout.flush();
+template<typename T>
+void writeLE(std::ostream &stream, T val)
+{
+    char buf[sizeof(T)];
+    for(size_t i = 0;i < sizeof(T);++i)
+        buf[i] = static_cast<char>((val >> (i*8)) & 0xff);
+    stream.write(buf, sizeof(buf));
+}
 
-        std::ofstream outstream(ofname.c_str(), std::ios_base::binary);
-        if(!outstream.is_open())
+/* Rewrites an archive with the entries in the order they're first read in
+ * the trace, followed by the ones that weren't read in their original order.
+ * The archive format is unchanged, only the order of the entries and their
+ * footer records.
+ */
+void repackArchive(const char *archname, const char *tracename, const char *outname)
+{
+    Archives::BsaArchive archive;
+    archive.load(archname);
+
+    bool indexed = !archive.getIds().empty();
+    std::vector<RepackEntry> entries;
+    if(indexed)
+    {
+        for(size_t id : archive.getIds())
         {
-            std::cerr<< "Failed to open for writing" <<std::endl;
-            continue;
+            RepackEntry entry{std::string(), id, 0, 0, 0};
+            archive.getRange(id, &entry.mOffset, &entry.mSize);
+            entries.push_back(entry);
+        }
+    }
+    else
+    {
+        for(const std::string &name : archive.list())
+        {
+            RepackEntry entry{name, 0, 0, 0, 0};
+            archive.getRange(name.c_str(), &entry.mOffset, &entry.mSize);
+            entries.push_back(entry);
         }
+    }
+    std::sort(entries.begin(), entries.end(),
+        [](const RepackEntry &lhs, const RepackEntry &rhs) -> bool
+        { return lhs.mOffset < rhs.mOffset; }
+    );
+    if(entries.size() > 0xffff)
+        throw std::runtime_error("Too many entries for a BSA");
 
-        size_t total = 0;
-        while(!instream->eof())
+    std::map<std::string,size_t> lookup;
+    for(size_t i = 0;i < entries.size();++i)
+    {
+        if(indexed)
+            lookup[std::to_string(entries[i].mId)] = i;
+        else
         {
-            std::array<char,4096> buf;
-            instream->read(buf.data(), buf.size());
-            size_t got = instream->gcount();
+            std::string name = entries[i].mName;
+            for(char &c : name) c = std::toupper(static_cast<unsigned char>(c));
+            lookup[name] = i;
+        }
+    }
 
-            if(got > 0)
-            {
-                if(!outstream.write(buf.data(), got))
-                    break;
-                total += got;
-            }
+    std::string archbase = getBaseName(archname);
+    for(char &c : archbase)
+        c = std::toupper(static_cast<unsigned char>(c));
+    std::vector<TraceAccess> accesses = readTrace(tracename, archbase);
+    if(!indexed)
+    {
+        for(TraceAccess &access : accesses)
+        {
+            for(char &c : access.mName)
+                c = std::toupper(static_cast<unsigned char>(c));
+        }
+    }
+
+    // Build the new order, and the entries' offsets in it.
+    std::vector<size_t> order;
+    std::vector<bool> placed(entries.size(), false);
+    size_t unknown = 0;
+    for(const TraceAccess &access : accesses)
+    {
+        auto iter = lookup.find(access.mName);
+        if(iter == lookup.end())
+            ++unknown;
+        else if(!placed[iter->second])
+        {
+            placed[iter->second] = true;
+            order.push_back(iter->second);
         }
-        if(!outstream.good())
-            std::cerr<< "failed after writing "<<outstream.tellp()<<" bytes" <<std::endl;
+    }
+    size_t traced = order.size();
+    for(size_t i = 0;i < entries.size();++i)
+    {
+        if(!placed[i]) order.push_back(i);
+    }
+
+    uint64_t offset = 4;
+    for(size_t idx : order)
+    {
+        entries[idx].mNewOffset = offset;
+        offset += entries[idx].mSize;
+    }
+
+    std::ofstream out(outname, std::ios_base::binary);
+    if(!out.is_open())
+        throw std::runtime_error(std::string("Failed to create ")+outname);
+    writeLE<uint16_t>(out, entries.size());
+    writeLE<uint16_t>(out, indexed ? 0x0200 : 0x0100);
+    for(size_t idx : order)
+    {
+        const RepackEntry &entry = entries[idx];
+        Archives::EntryData data = indexed ? archive.readAll(entry.mId) :
+                                             archive.readAll(entry.mName.c_str());
+        if(!data || data.size() != entry.mSize)
+            throw std::runtime_error("Failed to read entry from "+std::string(archname));
+        out.write(data.data(), data.size());
+    }
+    for(size_t idx : order)
+    {
+        const RepackEntry &entry = entries[idx];
+        if(indexed)
+            writeLE<uint32_t>(out, entry.mId);
         else
-            std::cout<< "wrote "<<total<<" bytes" <<std::endl;
+        {
+            std::array<char,12> name{};
+            memcpy(name.data(), entry.mName.data(), std::min(entry.mName.size(), name.size()));
+            out.write(name.data(), name.size());
+            writeLE<uint16_t>(out, 0);
+        }
+        writeLE<uint32_t>(out, entry.mSize);
+    }
+    out.close();
+    if(out.fail())
+        throw std::runtime_error(std::string("Failed to write ")+outname);
+
+    // Make sure the new archive loads and has the same contents.
+    Archives::BsaArchive repacked;
+    repacked.load(outname);
+    for(const RepackEntry &entry : entries)
+    {
+        Archives::EntryData olddata = indexed ? archive.readAll(entry.mId) :
+                                                archive.readAll(entry.mName.c_str());
+        Archives::EntryData newdata = indexed ? repacked.readAll(entry.mId) :
+                                                repacked.readAll(entry.mName.c_str());
+        if(!newdata || newdata.size() != olddata.size() ||
+           memcmp(newdata.data(), olddata.data(), olddata.size()) != 0)
+            throw std::runtime_error(std::string("Verifying ")+outname+" failed");
+    }
+
+    uint64_t before, after;
+    size_t seeks_before = measureSeeks(accesses, lookup, entries, false, &before);
+    size_t seeks_after = measureSeeks(accesses, lookup, entries, true, &after);
+
+    std::cout<< "Wrote "<<outname<<": "<<entries.size()<<" entries, "<<traced<<" in trace order" <<std::endl;
+    if(unknown > 0)
+        std::cout<< "  "<<unknown<<" traced reads were not in the archive" <<std::endl;
+    std::cout<< std::setw(10)<<""<<std::setw(10)<<"seeks"<<std::setw(18)<<"distance (KiB)" <<std::endl
+             << std::setw(10)<<"before"<<std::setw(10)<<seeks_before<<std::setw(18)<<(before/1024) <<std::endl
+             << std::setw(10)<<"after"<<std::setw(10)<<seeks_after<<std::setw(18)<<(after/1024) <<std::endl;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr<< "Usage: "<<argv[0]<<" [option]" <<std::endl
+                 << "  Available options:" <<std::endl
+                 << "    -e <archive.bsa>  - Extract files from BSA" <<std::endl
+                 << "    -j <threads>      - Number of threads to extract with (default: all CPUs)" <<std::endl
+#ifdef HAVE_COPY_FILE_RANGE
+                 << "    -copy <buffered|file_range>  - How to copy extracted entries (default: file_range)" <<std::endl
+#endif
+                 << "    -v                - Show each extracted file" <<std::endl
+                 << "    -bench <archive.bsa>  - Benchmark extraction throughput (extracts the archive)" <<std::endl
+                 << "    -repack <archive.bsa> <trace> <out.bsa>  - Reorder entries by first access in trace" <<std::endl
+                 << "    -lookupbench      - Benchmark entry lookup cost versus archive size" <<std::endl
+                 << "    -readbench <archive.bsa>  - Benchmark stream versus batched entry reads" <<std::endl
+                 <<std::endl;
+        return 1;
+    }
+
+    const char *archname = nullptr;
+    const char *benchname = nullptr;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+#ifdef HAVE_COPY_FILE_RANGE
+    CopyMethod method = Copy_FileRange;
+#else
+    CopyMethod method = Copy_Buffered;
+#endif
+    bool verbose = false;
+    for(int i = 1;i < argc;++i)
+    {
+        if(strcmp(argv[i], "-e") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing archive filename");
+            archname = argv[++i];
+        }
+        else if(strcmp(argv[i], "-j") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing thread count");
+            threads = std::max(1, atoi(argv[++i]));
+        }
+        else if(strcmp(argv[i], "-copy") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing copy method");
+            ++i;
+            if(strcmp(argv[i], "buffered") == 0)
+                method = Copy_Buffered;
+#ifdef HAVE_COPY_FILE_RANGE
+            else if(strcmp(argv[i], "file_range") == 0)
+                method = Copy_FileRange;
+#endif
+            else
+                throw std::runtime_error(std::string("Invalid copy method: ")+argv[i]);
+        }
+        else if(strcmp(argv[i], "-v") == 0)
+            verbose = true;
+        else if(strcmp(argv[i], "-bench") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing archive filename");
+            benchname = argv[++i];
+        }
+        else if(strcmp(argv[i], "-repack") == 0)
+        {
+            if(argc-3 <= i)
+                throw std::runtime_error("Missing repack archive, trace, or output filename");
+            repackArchive(argv[i+1], argv[i+2], argv[i+3]);
+            return 0;
+        }
+        else if(strcmp(argv[i], "-readbench") == 0)
+        {
+            if(argc-1 <= i)
+                throw std::runtime_error("Missing archive filename");
+            runReadBench(argv[++i]);
+            return 0;
+        }
+        else if(strcmp(argv[i], "-lookupbench") == 0)
+        {
+            runLookupBench();
+            return 0;
+        }
+        else
+            throw std::runtime_error(std::string("Invalid option: ")+argv[i]);
+    }
+
+    if(benchname)
+    {
+        runExtractBench(benchname, threads);
+        return 0;
+    }
+
+    if(!archname)
+        throw std::runtime_error("No input specified");
+
+    typedef std::chrono::high_resolution_clock Clock;
+    auto start = Clock::now();
+    ExtractResult res = extractArchive(archname, getOutputDir(archname), threads, method, verbose);
+    double secs = std::chrono::duration<double>(Clock::now()-start).count();
+
+    std::cout<< "Extracted "<<res.mEntries<<" entries ("<<res.mBytes<<" bytes) in "
+             <<std::fixed<<std::setprecision(2)<<(secs*1000.0)<<"ms" <<std::endl;
+    if(res.mFailed > 0)
+    {
+        std::cerr<< res.mFailed<<" entries failed" <<std::endl;
+        return 1;
     }
 
     return 0;
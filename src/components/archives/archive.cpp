@@ -1,6 +1,15 @@
 
 #include "archive.hpp"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 namespace Archives
 {
@@ -79,4 +88,192 @@ ConstrainedFileStreamBuf::pos_type ConstrainedFileStreamBuf::seekpos(pos_type po
 }
 
 
+MemoryStreamBuf::MemoryStreamBuf(const char *data, size_t size)
+{
+    char *ptr = const_cast<char*>(data);
+    setg(ptr, ptr, ptr+size);
+}
+
+MemoryStreamBuf::int_type MemoryStreamBuf::underflow()
+{
+    if(gptr() == egptr())
+        return traits_type::eof();
+    return traits_type::to_int_type(*gptr());
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode)
+{
+    if((mode&std::ios_base::out) || !(mode&std::ios_base::in))
+        return traits_type::eof();
+
+    off_type newPos;
+    switch(whence)
+    {
+        case std::ios_base::beg:
+            newPos = offset;
+            break;
+        case std::ios_base::cur:
+            newPos = offset + (gptr()-eback());
+            break;
+        case std::ios_base::end:
+            newPos = offset + (egptr()-eback());
+            break;
+        default:
+            return traits_type::eof();
+    }
+
+    if(newPos < 0 || newPos > (egptr()-eback()))
+        return traits_type::eof();
+
+    setg(eback(), eback()+newPos, egptr());
+    return newPos;
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos(pos_type pos, std::ios_base::openmode mode)
+{
+    if((mode&std::ios_base::out) || !(mode&std::ios_base::in))
+        return traits_type::eof();
+
+    if(pos < 0 || pos > (egptr()-eback()))
+        return traits_type::eof();
+
+    setg(eback(), eback()+pos, egptr());
+    return pos;
+}
+
+
+std::vector<std::vector<char>> Archive::readBatch(const std::vector<std::string> &names)
+{
+    std::vector<std::vector<char>> ret(names.size());
+    for(size_t i = 0;i < names.size();++i)
+    {
+        IStreamPtr stream = open(names[i].c_str());
+        if(!stream) continue;
+
+        std::array<char,4096> buf;
+        while(stream->read(buf.data(), buf.size()) || stream->gcount() > 0)
+            ret[i].insert(ret[i].end(), buf.data(), buf.data()+stream->gcount());
+    }
+    return ret;
+}
+
+EntryData Archive::readAll(const char *name)
+{
+    IStreamPtr stream = open(name);
+    if(!stream) return EntryData();
+
+    std::shared_ptr<std::vector<char>> data(new std::vector<char>());
+    std::array<char,4096> buf;
+    while(stream->read(buf.data(), buf.size()) || stream->gcount() > 0)
+        data->insert(data->end(), buf.data(), buf.data()+stream->gcount());
+    return EntryData(std::move(data));
+}
+
+
+#ifdef _WIN32
+MappedFile::MappedFile()
+  : mData(nullptr), mSize(0), mFile(INVALID_HANDLE_VALUE), mMapping(nullptr)
+{
+}
+#else
+MappedFile::MappedFile()
+  : mData(nullptr), mSize(0), mFd(-1)
+{
+}
+#endif
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+#ifdef _WIN32
+bool MappedFile::map(const std::string &fname)
+{
+    unmap();
+
+    mFile = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(mFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fsize;
+    if(!GetFileSizeEx(mFile, &fsize) || fsize.QuadPart <= 0)
+    {
+        unmap();
+        return false;
+    }
+
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!mMapping)
+    {
+        unmap();
+        return false;
+    }
+
+    void *ptr = MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+    if(!ptr)
+    {
+        unmap();
+        return false;
+    }
+
+    mData = static_cast<const char*>(ptr);
+    mSize = static_cast<size_t>(fsize.QuadPart);
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    if(mData)
+        UnmapViewOfFile(mData);
+    mData = nullptr;
+    mSize = 0;
+    if(mMapping)
+        CloseHandle(mMapping);
+    mMapping = nullptr;
+    if(mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+    mFile = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::map(const std::string &fname)
+{
+    unmap();
+
+    mFd = ::open(fname.c_str(), O_RDONLY);
+    if(mFd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(mFd, &st) != 0 || st.st_size <= 0)
+    {
+        unmap();
+        return false;
+    }
+
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, mFd, 0);
+    if(ptr == MAP_FAILED)
+    {
+        unmap();
+        return false;
+    }
+
+    mData = static_cast<const char*>(ptr);
+    mSize = st.st_size;
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    if(mData)
+        munmap(const_cast<char*>(mData), mSize);
+    mData = nullptr;
+    mSize = 0;
+    if(mFd >= 0)
+        close(mFd);
+    mFd = -1;
+}
+#endif
+
 } // namespace Archives
@@ -5,6 +5,7 @@
 #include <string>
 #include <memory>
 #include <array>
+#include <vector>
 #include <set>
 
 
@@ -62,12 +63,151 @@ public:
 };
 
 
+/* A read-only, memory-backed stream buffer. Used to give legacy stream-based
+ * readers access to data that's already in memory (e.g. an mmap'd archive
+ * entry), without copying it.
+ */
+class MemoryStreamBuf : public std::streambuf {
+public:
+    MemoryStreamBuf(const char *data, size_t size);
+
+    virtual int_type underflow();
+
+    virtual pos_type seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode);
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode mode);
+};
+
+class MemoryStream : public std::istream {
+    MemoryStreamBuf mBuffer;
+
+public:
+    MemoryStream(const char *data, size_t size)
+        : std::istream(nullptr), mBuffer(data, size)
+    {
+        rdbuf(&mBuffer);
+    }
+};
+
+
+/* A view of an archive entry's data. The data remains valid for as long as
+ * the archive it came from is loaded.
+ */
+struct EntryView {
+    const char *mData;
+    size_t mSize;
+
+    EntryView() : mData(nullptr), mSize(0) { }
+    EntryView(const char *data, size_t size) : mData(data), mSize(size) { }
+
+    const char *data() const { return mData; }
+    size_t size() const { return mSize; }
+
+    explicit operator bool() const { return mData != nullptr; }
+};
+
+
+/* The whole contiguous contents of an archive entry or file. This either
+ * references a mapped archive (which must stay loaded while it's used), or
+ * holds a reference to its own buffer, so copies are cheap.
+ */
+class EntryData {
+    std::shared_ptr<const std::vector<char>> mStorage;
+    const char *mData;
+    size_t mSize;
+    bool mValid;
+
+public:
+    EntryData() : mData(nullptr), mSize(0), mValid(false) { }
+    EntryData(const EntryView &view)
+      : mData(view.data()), mSize(view.size()), mValid(!!view)
+    { }
+    EntryData(std::shared_ptr<const std::vector<char>> storage)
+      : mStorage(std::move(storage)), mData(nullptr), mSize(0), mValid(!!mStorage)
+    {
+        if(mStorage)
+        {
+            mData = mStorage->data();
+            mSize = mStorage->size();
+        }
+    }
+
+    const char *data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    const char *begin() const { return mData; }
+    const char *end() const { return mData+mSize; }
+
+    /* The owned buffer, if the data isn't a view of a mapping. */
+    const std::shared_ptr<const std::vector<char>> &getStorage() const { return mStorage; }
+
+    explicit operator bool() const { return mValid; }
+};
+
+/* A stream over an EntryData, which keeps the data referenced for as long as
+ * the stream exists.
+ */
+class EntryDataStream : public MemoryStream {
+    EntryData mEntryData;
+
+public:
+    EntryDataStream(const EntryData &data)
+      : MemoryStream(data.data(), data.size()), mEntryData(data)
+    { }
+};
+
+
+/* A read-only memory mapping of a whole file. */
+class MappedFile {
+    const char *mData;
+    size_t mSize;
+#ifdef _WIN32
+    void *mFile;
+    void *mMapping;
+#else
+    int mFd;
+#endif
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    /* Maps the given file. Returns false if the file could not be mapped, in
+     * which case the caller should fall back to regular file I/O.
+     */
+    bool map(const std::string &fname);
+    void unmap();
+
+    const char *data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool isMapped() const { return mData != nullptr; }
+};
+
+
 class Archive {
 public:
     virtual ~Archive() { }
     virtual IStreamPtr open(const char *name) = 0;
     virtual bool exists(const char *name) const = 0;
     virtual const std::set<std::string> &list() const = 0;
+
+    /* Returns true if entries are read directly from memory, so there's no
+     * benefit to caching their contents.
+     */
+    virtual bool isMapped() const { return false; }
+
+    /* Reads the whole contents of each named entry. Entries that don't exist
+     * or fail to read are returned empty.
+     */
+    virtual std::vector<std::vector<char>> readBatch(const std::vector<std::string> &names);
+
+    /* Returns the whole contents of the named entry, or an invalid EntryData
+     * if it doesn't exist.
+     */
+    virtual EntryData readAll(const char *name);
 };
 
 } // namespace Archives
@@ -0,0 +1,293 @@
+
+#include "batchreader.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+
+namespace Archives
+{
+
+#ifdef HAVE_IO_URING
+/* A minimal io_uring wrapper using the raw syscalls, so we don't need to
+ * depend on liburing for the few operations we use.
+ */
+struct BatchReader::IoUring {
+    int mFd;
+
+    void *mSqPtr;
+    size_t mSqSize;
+    void *mCqPtr;
+    size_t mCqSize;
+    io_uring_sqe *mSqes;
+    size_t mSqesSize;
+
+    unsigned *mSqHead, *mSqTail, *mSqMask, *mSqArray;
+    unsigned mSqEntries;
+    unsigned *mCqHead, *mCqTail, *mCqMask;
+    io_uring_cqe *mCqes;
+
+    IoUring() : mFd(-1), mSqPtr(MAP_FAILED), mSqSize(0), mCqPtr(MAP_FAILED), mCqSize(0)
+              , mSqes(static_cast<io_uring_sqe*>(MAP_FAILED)), mSqesSize(0)
+    { }
+    ~IoUring()
+    {
+        if(mSqes != MAP_FAILED)
+            munmap(mSqes, mSqesSize);
+        if(mCqPtr != MAP_FAILED && mCqPtr != mSqPtr)
+            munmap(mCqPtr, mCqSize);
+        if(mSqPtr != MAP_FAILED)
+            munmap(mSqPtr, mSqSize);
+        if(mFd >= 0)
+            ::close(mFd);
+    }
+
+    bool init(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        mFd = syscall(__NR_io_uring_setup, entries, &params);
+        if(mFd < 0) return false;
+
+        mSqSize = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+        mCqSize = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+        if((params.features&IORING_FEAT_SINGLE_MMAP))
+            mSqSize = mCqSize = std::max(mSqSize, mCqSize);
+
+        mSqPtr = mmap(nullptr, mSqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                      mFd, IORING_OFF_SQ_RING);
+        if(mSqPtr == MAP_FAILED) return false;
+        if((params.features&IORING_FEAT_SINGLE_MMAP))
+            mCqPtr = mSqPtr;
+        else
+        {
+            mCqPtr = mmap(nullptr, mCqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                          mFd, IORING_OFF_CQ_RING);
+            if(mCqPtr == MAP_FAILED) return false;
+        }
+
+        mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        mSqes = static_cast<io_uring_sqe*>(mmap(nullptr, mSqesSize, PROT_READ|PROT_WRITE,
+                                                MAP_SHARED|MAP_POPULATE, mFd, IORING_OFF_SQES));
+        if(mSqes == MAP_FAILED) return false;
+
+        char *sq = static_cast<char*>(mSqPtr);
+        mSqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        mSqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        mSqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        mSqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        mSqEntries = params.sq_entries;
+
+        char *cq = static_cast<char*>(mCqPtr);
+        mCqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        mCqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        mCqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        mCqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    /* Submits up to mSqEntries reads and waits for all of them to complete.
+     * Returns false if the ring failed, in which case it shouldn't be used
+     * again.
+     */
+    bool readv(int fd, std::vector<iovec> &iovs, ReadRequest *reqs, size_t count)
+    {
+        unsigned tail = *mSqTail;
+        for(size_t i = 0;i < count;++i)
+        {
+            unsigned idx = tail & *mSqMask;
+            io_uring_sqe *sqe = &mSqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+
+            iovs[i].iov_base = reqs[i].mDest;
+            iovs[i].iov_len = reqs[i].mLength;
+
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = fd;
+            sqe->off = reqs[i].mOffset;
+            sqe->addr = reinterpret_cast<uintptr_t>(&iovs[i]);
+            sqe->len = 1;
+            sqe->user_data = i;
+
+            mSqArray[idx] = idx;
+            ++tail;
+        }
+        __atomic_store_n(mSqTail, tail, __ATOMIC_RELEASE);
+
+        size_t completed = 0;
+        unsigned to_submit = count;
+        while(completed < count)
+        {
+            int ret = syscall(__NR_io_uring_enter, mFd, to_submit, 1, IORING_ENTER_GETEVENTS,
+                              nullptr, 0);
+            if(ret < 0)
+            {
+                if(errno == EINTR) continue;
+                if(completed == 0 && to_submit == count)
+                {
+                    // Nothing was submitted; unwind the queued entries.
+                    __atomic_store_n(mSqTail, tail-count, __ATOMIC_RELEASE);
+                }
+                return false;
+            }
+            to_submit -= std::min<unsigned>(to_submit, ret);
+
+            unsigned head = *mCqHead;
+            unsigned cqtail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+            for(;head != cqtail;++head)
+            {
+                const io_uring_cqe &cqe = mCqes[head & *mCqMask];
+                reqs[cqe.user_data].mResult = (cqe.res < 0) ? -1 : cqe.res;
+                ++completed;
+            }
+            __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+};
+#else
+struct BatchReader::IoUring { };
+#endif
+
+
+BatchReader::BatchReader()
+#ifndef _WIN32
+  : mFd(-1)
+#endif
+{
+}
+
+BatchReader::~BatchReader()
+{
+    close();
+}
+
+
+void BatchReader::open(const std::string &fname, bool use_uring)
+{
+    close();
+
+    mFilename = fname;
+#ifdef _WIN32
+    mFile.open(mFilename.c_str(), std::ios_base::binary);
+    if(!mFile.is_open())
+        throw std::runtime_error("Failed to open "+mFilename);
+    (void)use_uring;
+#else
+    mFd = ::open(mFilename.c_str(), O_RDONLY);
+    if(mFd < 0)
+        throw std::runtime_error("Failed to open "+mFilename);
+
+#ifdef HAVE_IO_URING
+    if(use_uring)
+    {
+        mRing.reset(new IoUring());
+        if(!mRing->init(64))
+            mRing.reset();
+    }
+#else
+    (void)use_uring;
+#endif
+#endif
+}
+
+void BatchReader::close()
+{
+    mRing.reset();
+#ifdef _WIN32
+    if(mFile.is_open())
+        mFile.close();
+#else
+    if(mFd >= 0)
+        ::close(mFd);
+    mFd = -1;
+#endif
+}
+
+
+void BatchReader::readFallback(ReadRequest &req)
+{
+#ifdef _WIN32
+    mFile.clear();
+    if(!mFile.seekg(req.mOffset) || !mFile.read(req.mDest, req.mLength))
+        req.mResult = mFile.gcount() ? mFile.gcount() : -1;
+    else
+        req.mResult = req.mLength;
+#else
+    size_t total = 0;
+    while(total < req.mLength)
+    {
+        ssize_t got = pread(mFd, req.mDest+total, req.mLength-total, req.mOffset+total);
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got <= 0)
+            break;
+        total += got;
+    }
+    req.mResult = (total == 0 && req.mLength > 0) ? -1 : int64_t(total);
+#endif
+}
+
+void BatchReader::read(std::vector<ReadRequest> &requests)
+{
+    for(ReadRequest &req : requests)
+        req.mResult = -1;
+
+#ifdef HAVE_IO_URING
+    if(mRing)
+    {
+        std::vector<iovec> iovs(mRing->mSqEntries);
+        size_t done = 0;
+        while(done < requests.size())
+        {
+            size_t count = std::min<size_t>(requests.size()-done, mRing->mSqEntries);
+            if(!mRing->readv(mFd, iovs, &requests[done], count))
+            {
+                // io_uring isn't usable after all, so stop trying it.
+                mRing.reset();
+                break;
+            }
+            done += count;
+        }
+    }
+#endif
+
+    /* Anything that failed or came up short gets finished with regular
+     * reads.
+     */
+    for(ReadRequest &req : requests)
+    {
+        if(req.mResult >= 0 && size_t(req.mResult) == req.mLength)
+            continue;
+        if(req.mResult > 0)
+        {
+            ReadRequest rest = req;
+            rest.mOffset += req.mResult;
+            rest.mDest += req.mResult;
+            rest.mLength -= req.mResult;
+            readFallback(rest);
+            if(rest.mResult > 0)
+                req.mResult += rest.mResult;
+        }
+        else
+            readFallback(req);
+    }
+}
+
+} // namespace Archives
@@ -0,0 +1,61 @@
+#ifndef COMPONENTS_ARCHIVES_BATCHREADER_HPP
+#define COMPONENTS_ARCHIVES_BATCHREADER_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <memory>
+#include <cstdint>
+
+
+namespace Archives
+{
+
+struct ReadRequest {
+    uint64_t mOffset;
+    size_t mLength;
+    char *mDest;
+
+    // Set by the reader to the number of bytes read, or -1 on error.
+    int64_t mResult;
+};
+
+/* Reads many pieces of a file in one go. On Linux this submits the whole
+ * batch through io_uring (when built with it and the kernel allows it) and
+ * reaps the completions, otherwise each request is read with pread.
+ */
+class BatchReader {
+    struct IoUring;
+
+    std::string mFilename;
+#ifdef _WIN32
+    std::ifstream mFile;
+#else
+    int mFd;
+#endif
+
+    std::unique_ptr<IoUring> mRing;
+
+    BatchReader(const BatchReader&) = delete;
+    BatchReader& operator=(const BatchReader&) = delete;
+
+    void readFallback(ReadRequest &req);
+
+public:
+    BatchReader();
+    ~BatchReader();
+
+    /* Opens the file to read from. If use_uring is false, io_uring won't be
+     * used even if it's available.
+     */
+    void open(const std::string &fname, bool use_uring=true);
+    void close();
+
+    void read(std::vector<ReadRequest> &requests);
+
+    bool isUsingIoUring() const { return !!mRing; }
+};
+
+} // namespace Archives
+
+#endif /* COMPONENTS_ARCHIVES_BATCHREADER_HPP */
@@ -3,6 +3,10 @@
 
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+
+#include "batchreader.hpp"
 
 
 namespace Archives
@@ -27,18 +31,23 @@ void BsaArchive::loadIndexed(size_t count, std::istream &stream)
     if(!stream.good())
         throw std::runtime_error("Failed reading archive footer");
 
-    for(size_t id : idxs)
+    /* Later entries with a duplicate ID replace earlier ones. */
+    mIdIndex.reserve(count);
+    for(size_t i = 0;i < count;++i)
     {
-        if(!mLookupId.insert(id).second)
+        if(mLookupId.insert(idxs[i]).second)
+        {
+            mIdIndex.insert(idxs[i], mEntries.size());
+            mEntries.push_back(entries[i]);
+        }
+        else
         {
 #if 0
-            std::cerr<< "Duplicate entry ID "<<std::to_string(id)<<" in "+mFilename <<std::endl;
+            std::cerr<< "Duplicate entry ID "<<std::to_string(idxs[i])<<" in "+mFilename <<std::endl;
 #endif
+            mEntries[*mIdIndex.find(idxs[i])] = entries[i];
         }
     }
-    mEntries.resize(mLookupId.size());
-    for(size_t i = 0;i < count;++i)
-        mEntries[std::distance(mLookupId.begin(), mLookupId.find(idxs[i]))] = entries[i];
 }
 
 void BsaArchive::loadNamed(size_t count, std::istream& stream)
@@ -68,23 +77,40 @@ void BsaArchive::loadNamed(size_t count, std::istream& stream)
     if(!stream.good())
         throw std::runtime_error("Failed reading archive footer");
 
-    for(const std::string &name : names)
+    mNameIndex.reserve(count);
+    for(size_t i = 0;i < count;++i)
     {
-        if(!mLookupName.insert(name).second)
-            throw std::runtime_error("Duplicate entry name \""+name+"\" in "+mFilename);
+        if(!mLookupName.insert(names[i]).second)
+            throw std::runtime_error("Duplicate entry name \""+names[i]+"\" in "+mFilename);
+        mNameIndex.insert(names[i], mEntries.size());
+        mEntries.push_back(entries[i]);
     }
-    mEntries.resize(mLookupName.size());
-    for(size_t i = 0;i < count;++i)
-        mEntries[std::distance(mLookupName.begin(), mLookupName.find(names[i]))] = entries[i];
 }
 
-void BsaArchive::load(const std::string &fname)
+void BsaArchive::load(const std::string &fname, bool use_mmap)
 {
     mFilename = fname;
 
-    std::ifstream stream(mFilename.c_str(), std::ios::binary);
-    if(!stream.is_open())
-        throw std::runtime_error("Failed to open "+mFilename);
+    mLookupName.clear();
+    mLookupId.clear();
+    mNameIndex.clear();
+    mIdIndex.clear();
+    mEntries.clear();
+
+    mMapping.unmap();
+    if(use_mmap)
+        mMapping.map(mFilename);
+
+    std::unique_ptr<std::istream> file;
+    if(mMapping.isMapped())
+        file.reset(new MemoryStream(mMapping.data(), mMapping.size()));
+    else
+    {
+        file.reset(new std::ifstream(mFilename.c_str(), std::ios::binary));
+        if(!static_cast<std::ifstream*>(file.get())->is_open())
+            throw std::runtime_error("Failed to open "+mFilename);
+    }
+    std::istream &stream = *file;
 
     size_t count = read_le16(stream);
     int type = read_le16(stream);
@@ -100,10 +126,30 @@ void BsaArchive::load(const std::string &fname)
         sstr<< "Unhandled BSA type: 0x"<<std::hex<<type;
         throw std::runtime_error(sstr.str());
     }
+
+    if(mMapping.isMapped())
+    {
+        for(const Entry &entry : mEntries)
+        {
+            if(entry.mStart < 0 || entry.mEnd < entry.mStart ||
+               static_cast<size_t>(entry.mEnd) > mMapping.size())
+                throw std::runtime_error("Entry extends past the end of "+mFilename);
+        }
+    }
+}
+
+EntryView BsaArchive::getView(const Entry &entry) const
+{
+    if(!mMapping.isMapped())
+        return EntryView();
+    return EntryView(mMapping.data() + entry.mStart, entry.mEnd - entry.mStart);
 }
 
 IStreamPtr BsaArchive::open(const Entry &entry)
 {
+    if(mMapping.isMapped())
+        return IStreamPtr(new EntryDataStream(getView(entry)));
+
     std::unique_ptr<std::istream> stream(new std::ifstream(mFilename.c_str(), std::ios::binary));
     if(!stream->seekg(entry.mStart))
         return IStreamPtr(nullptr);
@@ -112,23 +158,153 @@ IStreamPtr BsaArchive::open(const Entry &entry)
 
 IStreamPtr BsaArchive::open(const char *name)
 {
-    auto iter = mLookupName.find(name);
-    if(iter == mLookupName.end())
-        return IStreamPtr(nullptr);
-    return open(mEntries[std::distance(mLookupName.begin(), iter)]);
+    const size_t *idx = mNameIndex.find(name);
+    if(!idx) return IStreamPtr(nullptr);
+    return open(mEntries[*idx]);
 }
 
 IStreamPtr BsaArchive::open(size_t id)
 {
-    auto iter = mLookupId.find(id);
-    if(iter == mLookupId.end())
-        return IStreamPtr(nullptr);
-    return open(mEntries[std::distance(mLookupId.begin(), iter)]);
+    const size_t *idx = mIdIndex.find(id);
+    if(!idx) return IStreamPtr(nullptr);
+    return open(mEntries[*idx]);
+}
+
+EntryView BsaArchive::getView(const char *name) const
+{
+    const size_t *idx = mNameIndex.find(name);
+    if(!idx) return EntryView();
+    return getView(mEntries[*idx]);
+}
+
+EntryView BsaArchive::getView(size_t id) const
+{
+    const size_t *idx = mIdIndex.find(id);
+    if(!idx) return EntryView();
+    return getView(mEntries[*idx]);
+}
+
+bool BsaArchive::getRange(const char *name, uint64_t *offset, uint64_t *size) const
+{
+    const size_t *idx = mNameIndex.find(name);
+    if(!idx) return false;
+    *offset = mEntries[*idx].mStart;
+    *size = mEntries[*idx].mEnd - mEntries[*idx].mStart;
+    return true;
+}
+
+bool BsaArchive::getRange(size_t id, uint64_t *offset, uint64_t *size) const
+{
+    const size_t *idx = mIdIndex.find(id);
+    if(!idx) return false;
+    *offset = mEntries[*idx].mStart;
+    *size = mEntries[*idx].mEnd - mEntries[*idx].mStart;
+    return true;
+}
+
+std::vector<std::vector<char>> BsaArchive::readEntries(const std::vector<const Entry*> &entries)
+{
+    std::vector<std::vector<char>> ret(entries.size());
+    if(mMapping.isMapped())
+    {
+        for(size_t i = 0;i < entries.size();++i)
+        {
+            if(!entries[i]) continue;
+            EntryView view = getView(*entries[i]);
+            ret[i].assign(view.data(), view.data()+view.size());
+        }
+        return ret;
+    }
+
+    // Read in file order, to keep the disk access as sequential as possible.
+    std::vector<size_t> order;
+    order.reserve(entries.size());
+    for(size_t i = 0;i < entries.size();++i)
+    {
+        if(entries[i]) order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(),
+        [&entries](size_t lhs, size_t rhs) -> bool
+        { return entries[lhs]->mStart < entries[rhs]->mStart; }
+    );
+
+    std::vector<ReadRequest> requests(order.size());
+    for(size_t i = 0;i < order.size();++i)
+    {
+        const Entry &entry = *entries[order[i]];
+        ret[order[i]].resize(entry.mEnd - entry.mStart);
+
+        requests[i].mOffset = entry.mStart;
+        requests[i].mLength = ret[order[i]].size();
+        requests[i].mDest = ret[order[i]].data();
+        requests[i].mResult = 0;
+    }
+
+    BatchReader reader;
+    reader.open(mFilename, mUseIoUring);
+    reader.read(requests);
+
+    for(size_t i = 0;i < order.size();++i)
+    {
+        if(requests[i].mResult != int64_t(requests[i].mLength))
+            ret[order[i]].clear();
+    }
+
+    return ret;
+}
+
+EntryData BsaArchive::readAll(const Entry &entry)
+{
+    if(mMapping.isMapped())
+        return EntryData(getView(entry));
+
+    std::vector<std::vector<char>> data = readEntries(std::vector<const Entry*>(1, &entry));
+    if(data[0].size() != size_t(entry.mEnd - entry.mStart))
+        return EntryData();
+    return EntryData(std::make_shared<std::vector<char>>(std::move(data[0])));
+}
+
+EntryData BsaArchive::readAll(const char *name)
+{
+    const size_t *idx = mNameIndex.find(name);
+    if(!idx) return EntryData();
+    return readAll(mEntries[*idx]);
+}
+
+EntryData BsaArchive::readAll(size_t id)
+{
+    const size_t *idx = mIdIndex.find(id);
+    if(!idx) return EntryData();
+    return readAll(mEntries[*idx]);
+}
+
+std::vector<std::vector<char>> BsaArchive::readBatch(const std::vector<std::string> &names)
+{
+    std::vector<const Entry*> entries;
+    entries.reserve(names.size());
+    for(const std::string &name : names)
+    {
+        const size_t *idx = mNameIndex.find(name);
+        entries.push_back(idx ? &mEntries[*idx] : nullptr);
+    }
+    return readEntries(entries);
+}
+
+std::vector<std::vector<char>> BsaArchive::readBatch(const std::vector<size_t> &ids)
+{
+    std::vector<const Entry*> entries;
+    entries.reserve(ids.size());
+    for(size_t id : ids)
+    {
+        const size_t *idx = mIdIndex.find(id);
+        entries.push_back(idx ? &mEntries[*idx] : nullptr);
+    }
+    return readEntries(entries);
 }
 
 bool BsaArchive::exists(const char *name) const
 {
-    return (mLookupName.find(name) != mLookupName.end());
+    return mNameIndex.exists(name);
 }
 
 } // namespace Archives
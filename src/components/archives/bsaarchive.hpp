@@ -6,6 +6,8 @@
 #include <vector>
 #include <set>
 
+#include "misc/flathashmap.hpp"
+
 #include "archive.hpp"
 
 
@@ -13,9 +15,14 @@ namespace Archives
 {
 
 class BsaArchive : public Archive {
+    // Sorted lists of the entry names and IDs, for listing.
     std::set<std::string> mLookupName;
     std::set<size_t> mLookupId;
 
+    // Hashed lookups from an entry name or ID to its index in mEntries.
+    Misc::FlatHashMap<std::string,size_t> mNameIndex;
+    Misc::FlatHashMap<size_t,size_t> mIdIndex;
+
     struct Entry {
         std::streamsize mStart;
         std::streamsize mEnd;
@@ -24,17 +31,67 @@ class BsaArchive : public Archive {
 
     std::string mFilename;
 
+    /* When the archive could be mapped, entries are opened as views into the
+     * mapping instead of through a new file handle each.
+     */
+    MappedFile mMapping;
+
+    bool mUseIoUring;
+
     void loadIndexed(size_t count, std::istream &stream);
     void loadNamed(size_t count, std::istream &stream);
 
     IStreamPtr open(const Entry &entry);
+    EntryView getView(const Entry &entry) const;
+
+    std::vector<std::vector<char>> readEntries(const std::vector<const Entry*> &entries);
+    EntryData readAll(const Entry &entry);
 
 public:
-    void load(const std::string &fname);
+    BsaArchive() : mUseIoUring(true) { }
+
+    /* Loads the archive's entry table. If use_mmap is true, the whole file is
+     * mapped into memory and entries are read directly from the mapping,
+     * falling back to regular file streams if it can't be mapped.
+     */
+    void load(const std::string &fname, bool use_mmap=true);
 
     virtual IStreamPtr open(const char *name);
     IStreamPtr open(size_t id);
 
+    /* Returns the entry's whole contents. For a mapped archive, this is a view
+     * of the mapping and doesn't copy anything.
+     */
+    virtual EntryData readAll(const char *name) final;
+    EntryData readAll(size_t id);
+
+    /* Returns a view of the entry's data in the mapped archive. The view is
+     * empty if the entry doesn't exist or the archive isn't mapped.
+     */
+    EntryView getView(const char *name) const;
+    EntryView getView(size_t id) const;
+
+    /* Gets where the entry's data is in the archive file. Returns false if the
+     * entry doesn't exist.
+     */
+    bool getRange(const char *name, uint64_t *offset, uint64_t *size) const;
+    bool getRange(size_t id, uint64_t *offset, uint64_t *size) const;
+
+    const std::string &getFilename() const { return mFilename; }
+
+    virtual bool isMapped() const final { return mMapping.isMapped(); }
+
+    /* Reads many entries at once. When the archive isn't mapped, all the
+     * reads are submitted together (through io_uring, where available).
+     */
+    virtual std::vector<std::vector<char>> readBatch(const std::vector<std::string> &names) final;
+    std::vector<std::vector<char>> readBatch(const std::vector<size_t> &ids);
+
+    /* Allows or disallows io_uring for batched reads, e.g. for comparing
+     * against plain pread.
+     */
+    void setUseIoUring(bool enable) { mUseIoUring = enable; }
+
     virtual bool exists(const char *name) const;
 
     virtual const std::set<std::string> &list() const final { return mLookupName; };
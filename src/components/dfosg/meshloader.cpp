@@ -1,7 +1,12 @@
 
 #include "meshloader.hpp"
 
+#include <condition_variable>
 #include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <mutex>
 
 #include <osg/Geode>
 #include <osg/Billboard>
@@ -12,6 +17,8 @@
 #include "components/vfs/manager.hpp"
 #include "components/resource/texturemanager.hpp"
 
+#include "misc/threadpool.hpp"
+
 
 namespace
 {
@@ -20,55 +27,21 @@ const uint32_t VER_2_5 = ('v' | ('2'<<8) | ('.'<<16) | ('5'<<24));
 //const uint32_t VER_2_6 = ('v' | ('2'<<8) | ('.'<<16) | ('6'<<24));
 //const uint32_t VER_2_7 = ('v' | ('2'<<8) | ('.'<<16) | ('7'<<24));
 
-}
-
-
-namespace DFOSG
-{
-
-void MdlHeader::load(std::istream& stream)
-{
-    mVersion = VFS::read_le32(stream);
-
-    mPointCount = VFS::read_le32(stream);
-    mPlaneCount = VFS::read_le32(stream);
-    mRadius = VFS::read_le32(stream);
-
-    mNullValue1[0] = VFS::read_le32(stream);
-    mNullValue1[1] = VFS::read_le32(stream);
-
-    mPlaneDataOffset = VFS::read_le32(stream);
-    mObjectDataOffset = VFS::read_le32(stream);
-    mObjectDataCount = VFS::read_le32(stream);
-
-    mUnknown1 = VFS::read_le32(stream);
-
-    mNullValue2[0] = VFS::read_le32(stream);
-    mNullValue2[1] = VFS::read_le32(stream);
-
-    mPointListOffset = VFS::read_le32(stream);
-    mNormalListOffset = VFS::read_le32(stream);
+/* This is only stored temporarily, and converted into a MdlPlaneList. */
+struct MdlPlanePoint {
+    uint32_t mOffset;
+    int16_t mU;
+    int16_t mV;
 
-    mUnknown2 = VFS::read_le32(stream);
+    typedef Misc::Record<
+        RECORD_FIELD(MdlPlanePoint, mOffset),
+        RECORD_FIELD(MdlPlanePoint, mU),
+        RECORD_FIELD(MdlPlanePoint, mV)
+    > Schema;
+};
 
-    mPlaneListOffset = VFS::read_le32(stream);
-}
-
-
-void MdlPoint::load(std::istream& stream)
-{
-    mX = VFS::read_le32(stream);
-    mY = VFS::read_le32(stream);
-    mZ = VFS::read_le32(stream);
-}
-
-
-void MdlPlanePoint::load(std::istream& stream, uint32_t offset_scale)
+float fixTexCoord(int c)
 {
-    uint32_t offset = VFS::read_le32(stream);
-    int u = (int16_t)VFS::read_le16(stream);
-    int v = (int16_t)VFS::read_le16(stream);
-
     /* WTF is this. Using the read values as they are works for most meshes,
      * but a few go wrong. UESP's note about only using the lower 12 bits (and
      * sign-extending bit 11) breaks many meshes. Using sign-extended 14 bits
@@ -81,45 +54,50 @@ void MdlPlanePoint::load(std::istream& stream, uint32_t offset_scale)
      * under the MIT license (http://www.opensource.org/licenses/mit-license.php).
      */
     int threshold = 0x3fff;
-    while(u > threshold)
-        u = 0x4000 - u;
-    while(u < -threshold)
-        u = 0x4000 + u;
-    while(v > threshold)
-        v = 0x4000 - v;
-    while(v < -threshold)
-        v = 0x4000 + v;
-
-    mIndex = offset / offset_scale;
-    mU = u / 16.0f;
-    mV = v / 16.0f;
+    while(c > threshold)
+        c = 0x4000 - c;
+    while(c < -threshold)
+        c = 0x4000 + c;
+    return c / 16.0f;
 }
 
-
-void MdlPlane::load(std::istream& stream, uint32_t offset_scale)
+Misc::ThreadPool &getLoadPool()
 {
-    mPointCount = stream.get();
-    mUnknown1 = stream.get();
-    mTextureId = VFS::read_le16(stream);
-    mUnknown2 = VFS::read_le32(stream);
-
-    mPoints.resize(mPointCount);
-    for(MdlPlanePoint &pt : mPoints)
-        pt.load(stream, offset_scale);
+    static Misc::ThreadPool pool;
+    return pool;
 }
 
-void MdlPlane::loadNormal(std::istream& stream)
-{
-    mNormal.load(stream);
 }
 
-void MdlPlane::fixUVs(const std::vector<MdlPoint> &points)
+
+namespace DFOSG
+{
+
+static_assert(MdlHeader::Schema::size() == 64, "Unexpected MdlHeader size");
+static_assert(MdlPoint::Schema::size() == 12, "Unexpected MdlPoint size");
+static_assert(MdlPlaneHeader::Schema::size() == 8, "Unexpected MdlPlaneHeader size");
+static_assert(MdlPlanePoint::Schema::size() == 8, "Unexpected MdlPlanePoint size");
+
+
+void Mesh::fixUVs(size_t plane)
 {
+    const size_t first = mPlanes.mFirstPoint[plane];
+    const size_t count = mPlanes.getPointCount(plane);
+    const uint32_t *indices = &mPlanes.mPointIndices[first];
+    float *us = &mPlanes.mU[first];
+    float *vs = &mPlanes.mV[first];
+
     /* Convert delta coords to absolute. */
-    for(size_t i = 1;i < mPoints.size() && i < 3;++i)
+    for(size_t i = 1;i < count && i < 3;++i)
     {
-        mPoints[i].u() += mPoints[i-1].u();
-        mPoints[i].v() += mPoints[i-1].v();
+        us[i] += us[i-1];
+        vs[i] += vs[i-1];
+    }
+    if(count < 3)
+    {
+        // Not a proper polygon, so there's nothing to work out.
+        mPlanes.mBinormals[plane].set(0, 0, 0);
+        return;
     }
 
     /* Daggerfall does not use the provided UV coords for the 4th point and
@@ -139,12 +117,12 @@ void MdlPlane::fixUVs(const std::vector<MdlPoint> &points)
      * which can then be used to work out UV coordinates for any point on the
      * plane.
      */
-    osg::Vec3 p0(points[mPoints[0].getIndex()].x(), points[mPoints[0].getIndex()].y(), points[mPoints[0].getIndex()].z());
-    osg::Vec3 p1(points[mPoints[1].getIndex()].x(), points[mPoints[1].getIndex()].y(), points[mPoints[1].getIndex()].z());
-    osg::Vec3 p2(points[mPoints[2].getIndex()].x(), points[mPoints[2].getIndex()].y(), points[mPoints[2].getIndex()].z());
-    osg::Vec2 uv0(mPoints[0].u(), mPoints[0].v());
-    osg::Vec2 uv1(mPoints[1].u(), mPoints[1].v());
-    osg::Vec2 uv2(mPoints[2].u(), mPoints[2].v());
+    osg::Vec3 p0(mPoints[indices[0]].x(), mPoints[indices[0]].y(), mPoints[indices[0]].z());
+    osg::Vec3 p1(mPoints[indices[1]].x(), mPoints[indices[1]].y(), mPoints[indices[1]].z());
+    osg::Vec3 p2(mPoints[indices[2]].x(), mPoints[indices[2]].y(), mPoints[indices[2]].z());
+    osg::Vec2 uv0(us[0], vs[0]);
+    osg::Vec2 uv1(us[1], vs[1]);
+    osg::Vec2 uv2(us[2], vs[2]);
 
     /* Let P = Edge 1 */
     osg::Vec3 P = p1 - p0;
@@ -180,14 +158,15 @@ void MdlPlane::fixUVs(const std::vector<MdlPoint> &points)
      * recalculate the shorter of the two vectors (this also ensures T and B
      * create a right angle).
      */
-    osg::Vec3 normal(mNormal.x(), mNormal.y(), mNormal.z());
+    const MdlPoint &nrm = mPlanes.mNormals[plane];
+    osg::Vec3 normal(nrm.x(), nrm.y(), nrm.z());
     normal.normalize();
     if(tangent.normalize() > binormal.normalize())
         binormal = normal ^ tangent;
     else
         tangent = normal ^ binormal;
 
-    if(mPoints.size() > 3)
+    if(count > 3)
     {
         /* Find the U and V scales. Without this, we would assume 1 world unit = 1 UV unit. */
         float tdp = tangent * P, tdq = tangent * Q;
@@ -196,61 +175,157 @@ void MdlPlane::fixUVs(const std::vector<MdlPoint> &points)
         float vscale = (bdq == 0.0f || (t1 > 0.0f && fabs(bdp) > fabs(bdq))) ? (t1/bdp) : (t2/bdq);
 
         /* Now with the T and B vectors and UV scales, we can get the missing UV coordinates. */
-        for(size_t i = 3;i < mPoints.size();++i)
+        for(size_t i = 3;i < count;++i)
         {
-            osg::Vec3 p(points[mPoints[i].getIndex()].x() - p0.x(),
-                        points[mPoints[i].getIndex()].y() - p0.y(),
-                        points[mPoints[i].getIndex()].z() - p0.z());
-            mPoints[i].u() = (tangent*p)*uscale + uv0.x();
-            mPoints[i].v() = (binormal*p)*vscale + uv0.y();
+            osg::Vec3 p(mPoints[indices[i]].x() - p0.x(),
+                        mPoints[indices[i]].y() - p0.y(),
+                        mPoints[indices[i]].z() - p0.z());
+            us[i] = (tangent*p)*uscale + uv0.x();
+            vs[i] = (binormal*p)*vscale + uv0.y();
         }
     }
 
-    mBinormal.set(int(binormal.x() * 256.0f), int(binormal.y() * 256.0f), int(binormal.z() * 256.0f));
+    mPlanes.mBinormals[plane].set(int(binormal.x() * 256.0f), int(binormal.y() * 256.0f),
+                                  int(binormal.z() * 256.0f));
 }
 
 
-void Mesh::load(std::istream &stream)
+void Mesh::load(Misc::ByteReader &reader)
 {
-    mHeader.load(stream);
-
-    mPoints.resize(mHeader.getPointCount());
-    mPlanes.resize(mHeader.getPlaneCount());
+    reader.read(mHeader);
 
     // points
-    if(!stream.seekg(mHeader.getPointListOffset()))
-        throw std::runtime_error("Failed to seek to point list");
-
-    for(MdlPoint &pt : mPoints)
-        pt.load(stream);
-
-    // planes
-    if(!stream.seekg(mHeader.getPlaneListOffset()))
-        throw std::runtime_error("Failed to seek to plane list");
+    mPoints.resize(mHeader.getPointCount());
+    reader.seek(mHeader.getPointListOffset());
+    reader.readArray(mPoints.data(), mPoints.size());
+
+    // Plane records vary in size, so first find where each one is, and its
+    // texture. They're then decoded sorted by texture (for more efficient
+    // geometry).
+    const size_t count = mHeader.getPlaneCount();
+    std::vector<std::pair<uint16_t,uint32_t>> order(count);
+    std::vector<size_t> offsets(count);
+    size_t totalpoints = 0;
+
+    reader.seek(mHeader.getPlaneListOffset());
+    for(size_t i = 0;i < count;++i)
+    {
+        MdlPlaneHeader plane;
+        offsets[i] = reader.tell();
+        reader.read(plane);
+        reader.skip(plane.getPointCount() * MdlPlanePoint::Schema::size());
+        order[i] = std::make_pair(plane.getTextureId(), uint32_t(i));
+        totalpoints += plane.getPointCount();
+    }
+    // Ties keep their file order.
+    std::sort(order.begin(), order.end());
+
+    // normals, in file order
+    std::vector<MdlPoint> normals(count);
+    reader.seek(mHeader.getNormalListOffset());
+    reader.readArray(normals.data(), normals.size());
+
+    mPlanes.mTextureIds.resize(count);
+    mPlanes.mNormals.resize(count);
+    mPlanes.mBinormals.resize(count);
+    mPlanes.mFirstPoint.resize(count+1);
+    mPlanes.mPointIndices.resize(totalpoints);
+    mPlanes.mU.resize(totalpoints);
+    mPlanes.mV.resize(totalpoints);
 
     uint32_t offset_scale = (mHeader.getVersion() != VER_2_5) ? (4*3) : 4;
-    for(MdlPlane &plane : mPlanes)
-        plane.load(stream, offset_scale);
+    MdlPlanePoint pts[256];
+    size_t next = 0;
+    for(size_t i = 0;i < count;++i)
+    {
+        const uint32_t src = order[i].second;
 
-    // normals
-    if(!stream.seekg(mHeader.getNormalListOffset()))
-        throw std::runtime_error("Failed to seek to normal list");
+        MdlPlaneHeader plane;
+        reader.seek(offsets[src]);
+        reader.read(plane);
+        reader.readArray(pts, plane.getPointCount());
 
-    for(MdlPlane &plane : mPlanes)
-        plane.loadNormal(stream);
+        mPlanes.mTextureIds[i] = plane.getTextureId();
+        mPlanes.mNormals[i] = normals[src];
+        mPlanes.mFirstPoint[i] = next;
+        for(size_t j = 0;j < plane.getPointCount();++j,++next)
+        {
+            uint32_t index = pts[j].mOffset / offset_scale;
+            if(index >= mPoints.size())
+                throw std::runtime_error("Invalid plane point index "+std::to_string(index)+" (of "+
+                                         std::to_string(mPoints.size())+")");
+            mPlanes.mPointIndices[next] = index;
+            mPlanes.mU[next] = fixTexCoord(pts[j].mU);
+            mPlanes.mV[next] = fixTexCoord(pts[j].mV);
+        }
+    }
+    mPlanes.mFirstPoint[count] = next;
 
     // Fix UV coords, converting from delta to absolute values and generate the
     // missing coords. Also calculates the binormals.
-    for(MdlPlane &plane : mPlanes)
-        plane.fixUVs(mPoints);
+    for(size_t i = 0;i < count;++i)
+        fixUVs(i);
+}
+
 
-    // Sort planes to combine textures (for more efficient geometry)
-    std::sort(mPlanes.begin(), mPlanes.end(),
-        [](const MdlPlane &lhs, const MdlPlane &rhs)
+void buildMeshGroups(const Mesh &mesh, std::vector<MeshGroup> &groups)
+{
+    groups.clear();
+
+    const std::vector<MdlPoint> &points = mesh.getPoints();
+    const MdlPlaneList &planes = mesh.getPlanes();
+    for(size_t p = 0;p < planes.size();)
+    {
+        groups.emplace_back();
+        MeshGroup &group = groups.back();
+        group.mTextureId = planes.mTextureIds[p];
+
+        size_t end = p+1;
+        while(end < planes.size() && planes.mTextureIds[end] == group.mTextureId)
+            ++end;
+
+        size_t numverts = planes.mFirstPoint[end] - planes.mFirstPoint[p];
+        group.mPositions.reserve(numverts*3);
+        group.mNormals.reserve(numverts*3);
+        group.mBinormals.reserve(numverts*3);
+        group.mTexCoords.reserve(numverts*2);
+        group.mIndices.reserve((numverts - std::min(numverts, (end-p)*2)) * 3);
+
+        for(;p < end;++p)
         {
-            return lhs.getTextureId() < rhs.getTextureId();
+            const MdlPoint &normal = planes.mNormals[p];
+            const MdlPoint &binormal = planes.mBinormals[p];
+            size_t first = group.getVertexCount();
+
+            for(size_t j = planes.mFirstPoint[p];j < planes.mFirstPoint[p+1];++j)
+            {
+                // Point indices are checked when loading.
+                const MdlPoint &pos = points[planes.mPointIndices[j]];
+                group.mPositions.push_back(pos.x() / 256.0f);
+                group.mPositions.push_back(pos.y() / 256.0f);
+                group.mPositions.push_back(pos.z() / 256.0f);
+
+                group.mNormals.push_back(normal.x() / 256.0f);
+                group.mNormals.push_back(normal.y() / 256.0f);
+                group.mNormals.push_back(normal.z() / 256.0f);
+
+                group.mBinormals.push_back(binormal.x() / 256.0f);
+                group.mBinormals.push_back(binormal.y() / 256.0f);
+                group.mBinormals.push_back(binormal.z() / 256.0f);
+
+                group.mTexCoords.push_back(planes.mU[j]);
+                group.mTexCoords.push_back(planes.mV[j]);
+            }
+
+            // Planes are convex polygons, so triangulate them as a fan.
+            for(size_t j = 2;j < planes.getPointCount(p);++j)
+            {
+                group.mIndices.push_back(first);
+                group.mIndices.push_back(first + j-1);
+                group.mIndices.push_back(first + j);
+            }
         }
-    );
+    }
 }
 
 
@@ -263,13 +338,65 @@ MeshLoader::MeshLoader()
 
 Mesh *MeshLoader::load(size_t id)
 {
-    VFS::IStreamPtr stream = VFS::Manager::get().openArchId(id);
-    if(!stream) throw std::runtime_error("Failed to open ARCH3D ID "+std::to_string(id));
+    VFS::EntryData data = VFS::Manager::get().readArchId(id);
+    if(!data) throw std::runtime_error("Failed to open ARCH3D ID "+std::to_string(id));
 
+    Misc::ByteReader reader(data.data(), data.size());
     std::unique_ptr<Mesh> mesh(new Mesh());
-    mesh->load(*stream);
+    mesh->load(reader);
 
     return mesh.release();
 }
 
+std::vector<std::unique_ptr<Mesh>> MeshLoader::loadBatch(const std::vector<size_t> &ids)
+{
+    std::vector<std::unique_ptr<Mesh>> meshes(ids.size());
+    if(ids.empty())
+        return meshes;
+
+    // As with TexLoader's frame decoding, the calling thread loads meshes
+    // along with the pool, and only waits for ones that were started.
+    struct Job {
+        std::atomic<size_t> mNext;
+        size_t mDone;
+        std::mutex mMutex;
+        std::condition_variable mCondVar;
+
+        Job() : mNext(0), mDone(0) { }
+    };
+    auto job = std::make_shared<Job>();
+
+    const size_t count = ids.size();
+    auto work = [this, job, count, &ids, &meshes]()
+    {
+        size_t i;
+        while((i=job->mNext.fetch_add(1)) < count)
+        {
+            try {
+                meshes[i].reset(load(ids[i]));
+            }
+            catch(std::exception &e) {
+                std::stringstream sstr;
+                sstr<< "Failed to load ARCH3D ID "<<ids[i]<<": "<<e.what() <<"\n";
+                std::cerr<< sstr.str() <<std::flush;
+            }
+
+            std::lock_guard<std::mutex> lock(job->mMutex);
+            if(++job->mDone == count)
+                job->mCondVar.notify_all();
+        }
+    };
+
+    Misc::ThreadPool &pool = getLoadPool();
+    size_t helpers = std::min(pool.size(), count-1);
+    for(size_t i = 0;i < helpers;++i)
+        pool.enqueue(work);
+    work();
+
+    std::unique_lock<std::mutex> lock(job->mMutex);
+    while(job->mDone < count)
+        job->mCondVar.wait(lock);
+    return meshes;
+}
+
 } // namespace DFOSG
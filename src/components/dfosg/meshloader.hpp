@@ -2,9 +2,12 @@
 #define COMPONENTS_DFOSG_MESHLOADER_HPP
 
 #include <vector>
+#include <memory>
 #include <map>
 #include <cstdint>
 
+#include "misc/record.hpp"
+
 
 namespace osg
 {
@@ -40,7 +43,22 @@ class MdlHeader {
     uint32_t mPlaneListOffset;
 
 public:
-    void load(std::istream &stream);
+    typedef Misc::Record<
+        RECORD_FIELD(MdlHeader, mVersion),
+        RECORD_FIELD(MdlHeader, mPointCount),
+        RECORD_FIELD(MdlHeader, mPlaneCount),
+        RECORD_FIELD(MdlHeader, mRadius),
+        RECORD_FIELD(MdlHeader, mNullValue1),
+        RECORD_FIELD(MdlHeader, mPlaneDataOffset),
+        RECORD_FIELD(MdlHeader, mObjectDataOffset),
+        RECORD_FIELD(MdlHeader, mObjectDataCount),
+        RECORD_FIELD(MdlHeader, mUnknown1),
+        RECORD_FIELD(MdlHeader, mNullValue2),
+        RECORD_FIELD(MdlHeader, mPointListOffset),
+        RECORD_FIELD(MdlHeader, mNormalListOffset),
+        RECORD_FIELD(MdlHeader, mUnknown2),
+        RECORD_FIELD(MdlHeader, mPlaneListOffset)
+    > Schema;
 
     uint32_t getVersion() const { return mVersion; }
 
@@ -56,7 +74,12 @@ class MdlPoint {
     int32_t mX, mY, mZ;
 
 public:
-    void load(std::istream &stream);
+    typedef Misc::Record<
+        RECORD_FIELD(MdlPoint, mX),
+        RECORD_FIELD(MdlPoint, mY),
+        RECORD_FIELD(MdlPoint, mZ)
+    > Schema;
+
     void set(int32_t x, int32_t y, int32_t z)
     {
         mX = x;
@@ -69,60 +92,81 @@ public:
     int32_t z() const { return mZ; }
 };
 
-class MdlPlanePoint {
-    uint32_t mIndex;
-    float mU;
-    float mV;
-
-public:
-    void load(std::istream &stream, uint32_t offset_scale);
-
-    int32_t getIndex() const { return mIndex; }
-    float& u() { return mU; }
-    const float& u() const { return mU; }
-    float& v() { return mV; }
-    const float& v() const { return mV; }
-};
-
-class MdlPlane {
+class MdlPlaneHeader {
     uint8_t mPointCount;
     uint8_t mUnknown1;
     uint16_t mTextureId;
     uint32_t mUnknown2;
 
-    std::vector<MdlPlanePoint> mPoints;
-    MdlPoint mNormal;
-
-    // Calculated on load
-    MdlPoint mBinormal;
-
 public:
-    void load(std::istream &stream, uint32_t offset_scale);
-
-    void loadNormal(std::istream &stream);
-
-    void fixUVs(const std::vector<MdlPoint> &points);
-
-    const std::vector<MdlPlanePoint> &getPoints() const { return mPoints; }
+    typedef Misc::Record<
+        RECORD_FIELD(MdlPlaneHeader, mPointCount),
+        RECORD_FIELD(MdlPlaneHeader, mUnknown1),
+        RECORD_FIELD(MdlPlaneHeader, mTextureId),
+        RECORD_FIELD(MdlPlaneHeader, mUnknown2)
+    > Schema;
+
+    uint8_t getPointCount() const { return mPointCount; }
     uint16_t getTextureId() const { return mTextureId; }
-    const MdlPoint &getNormal() const { return mNormal; }
-    const MdlPoint &getBinormal() const { return mBinormal; }
+};
+
+/* A mesh's planes as parallel arrays, sorted by texture. The points of plane
+ * i are the entries mFirstPoint[i] up to mFirstPoint[i+1] of the point arrays,
+ * which hold an index into the mesh's points and a texture coordinate (in
+ * texels).
+ */
+struct MdlPlaneList {
+    std::vector<uint16_t> mTextureIds;
+    std::vector<MdlPoint> mNormals;
+    std::vector<MdlPoint> mBinormals; // Calculated on load
+    std::vector<uint32_t> mFirstPoint;
+
+    std::vector<uint32_t> mPointIndices;
+    std::vector<float> mU;
+    std::vector<float> mV;
+
+    size_t size() const { return mTextureIds.size(); }
+    size_t getPointCount(size_t plane) const { return mFirstPoint[plane+1] - mFirstPoint[plane]; }
 };
 
 class Mesh {
     MdlHeader mHeader;
     std::vector<MdlPoint> mPoints;
-    std::vector<MdlPlane> mPlanes;
+    MdlPlaneList mPlanes;
+
+    void fixUVs(size_t plane);
 
 public:
-    void load(std::istream &stream);
+    void load(Misc::ByteReader &reader);
 
     const MdlHeader &getHeader() const { return mHeader; }
     const std::vector<MdlPoint> &getPoints() const { return mPoints; }
-    const std::vector<MdlPlane> &getPlanes() const { return mPlanes; }
+    const MdlPlaneList &getPlanes() const { return mPlanes; }
 };
 
 
+/* A mesh's triangles that use one texture, as flat vertex and index arrays
+ * ready for upload. Texture coordinates are in texels, since they depend on
+ * the size of the texture they're used with.
+ */
+struct MeshGroup {
+    uint16_t mTextureId;
+
+    std::vector<float> mPositions; // x, y, z
+    std::vector<float> mNormals;   // x, y, z
+    std::vector<float> mBinormals; // x, y, z
+    std::vector<float> mTexCoords; // u, v
+    std::vector<uint32_t> mIndices;
+
+    size_t getVertexCount() const { return mPositions.size() / 3; }
+};
+
+/* Triangulates the mesh's planes, grouping them by texture (planes are sorted
+ * by texture on load, so each group is a contiguous run).
+ */
+void buildMeshGroups(const Mesh &mesh, std::vector<MeshGroup> &groups);
+
+
 class MeshLoader {
     static MeshLoader sLoader;
 
@@ -136,6 +180,11 @@ public:
      * node for the object. */
     Mesh *load(size_t id);
 
+    /* Loads a list of meshes in parallel, returned in the same order as the
+     * IDs. Meshes that fail to load are left null, with the error printed.
+     */
+    std::vector<std::unique_ptr<Mesh>> loadBatch(const std::vector<size_t> &ids);
+
     static MeshLoader &get()
     {
         return sLoader;
@@ -0,0 +1,355 @@
+
+#include "meshopt.hpp"
+
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+
+namespace
+{
+
+using DFOSG::MeshGroup;
+
+/* Every attribute of a vertex, compared bit for bit. */
+struct VertexKey {
+    uint32_t mBits[11];
+
+    bool operator==(const VertexKey &rhs) const
+    { return memcmp(mBits, rhs.mBits, sizeof(mBits)) == 0; }
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey &key) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for(uint32_t bits : key.mBits)
+            hash = (hash^bits) * 1099511628211ull;
+        return static_cast<size_t>(hash ^ (hash>>32));
+    }
+};
+
+void copyVertex(MeshGroup &group, size_t dst, size_t src)
+{
+    std::copy_n(&group.mPositions[src*3], 3, &group.mPositions[dst*3]);
+    std::copy_n(&group.mNormals[src*3], 3, &group.mNormals[dst*3]);
+    std::copy_n(&group.mBinormals[src*3], 3, &group.mBinormals[dst*3]);
+    std::copy_n(&group.mTexCoords[src*2], 2, &group.mTexCoords[dst*2]);
+}
+
+void resizeVertices(MeshGroup &group, size_t count)
+{
+    group.mPositions.resize(count*3);
+    group.mNormals.resize(count*3);
+    group.mBinormals.resize(count*3);
+    group.mTexCoords.resize(count*2);
+}
+
+
+/* Merges identical vertices, keeping the first of each in place. */
+void weldVertices(MeshGroup &group)
+{
+    const size_t count = group.getVertexCount();
+    std::unordered_map<VertexKey,uint32_t,VertexKeyHash> lookup;
+    lookup.reserve(count);
+
+    std::vector<uint32_t> remap(count);
+    size_t unique = 0;
+    for(size_t i = 0;i < count;++i)
+    {
+        VertexKey key;
+        memcpy(&key.mBits[0], &group.mPositions[i*3], sizeof(float)*3);
+        memcpy(&key.mBits[3], &group.mNormals[i*3], sizeof(float)*3);
+        memcpy(&key.mBits[6], &group.mBinormals[i*3], sizeof(float)*3);
+        memcpy(&key.mBits[9], &group.mTexCoords[i*2], sizeof(float)*2);
+
+        auto ret = lookup.insert(std::make_pair(key, uint32_t(unique)));
+        if(ret.second)
+        {
+            // unique <= i, so this only overwrites vertices already looked at.
+            if(unique != i)
+                copyVertex(group, unique, i);
+            ++unique;
+        }
+        remap[i] = ret.first->second;
+    }
+    resizeVertices(group, unique);
+
+    for(uint32_t &idx : group.mIndices)
+        idx = remap[idx];
+}
+
+/* Removes triangles that use the same vertex twice or have no area, such as
+ * from collinear plane points.
+ */
+void removeDegenerates(MeshGroup &group)
+{
+    std::vector<uint32_t> &indices = group.mIndices;
+    const float *pos = group.mPositions.data();
+
+    size_t out = 0;
+    for(size_t i = 0;i+2 < indices.size();i += 3)
+    {
+        uint32_t a = indices[i], b = indices[i+1], c = indices[i+2];
+        if(a == b || b == c || a == c)
+            continue;
+
+        float e1[3], e2[3];
+        for(size_t j = 0;j < 3;++j)
+        {
+            e1[j] = pos[b*3 + j] - pos[a*3 + j];
+            e2[j] = pos[c*3 + j] - pos[a*3 + j];
+        }
+        float cx = e1[1]*e2[2] - e1[2]*e2[1];
+        float cy = e1[2]*e2[0] - e1[0]*e2[2];
+        float cz = e1[0]*e2[1] - e1[1]*e2[0];
+        if(cx == 0.0f && cy == 0.0f && cz == 0.0f)
+            continue;
+
+        indices[out++] = a;
+        indices[out++] = b;
+        indices[out++] = c;
+    }
+    indices.resize(out);
+}
+
+
+/* Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". Each vertex is
+ * scored by how recently it was used and how few triangles it has left, and
+ * the triangle with the highest total is emitted next.
+ */
+const int CacheSize = 32;
+
+float getVertexScore(int cachepos, uint32_t remaining)
+{
+    if(remaining == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if(cachepos >= 0)
+    {
+        // The last triangle's vertices get a fixed score, so the next one
+        // isn't just picked for reusing them.
+        if(cachepos < 3)
+            score = 0.75f;
+        else
+            score = std::pow(1.0f - float(cachepos-3)/float(CacheSize-3), 1.5f);
+    }
+    // Boost vertices with few triangles left, to finish them off.
+    return score + 2.0f/std::sqrt(float(remaining));
+}
+
+std::vector<uint32_t> reorderTriangles(const std::vector<uint32_t> &indices, size_t vertexcount)
+{
+    const size_t tricount = indices.size() / 3;
+
+    // The triangles using each vertex. The first remaining[v] entries from
+    // first[v] are the ones not yet emitted.
+    std::vector<uint32_t> first(vertexcount+1, 0);
+    for(uint32_t idx : indices)
+        ++first[idx+1];
+    for(size_t v = 0;v < vertexcount;++v)
+        first[v+1] += first[v];
+    std::vector<uint32_t> remaining(vertexcount, 0);
+    std::vector<uint32_t> vtxtris(indices.size());
+    for(size_t t = 0;t < tricount;++t)
+    {
+        for(size_t j = 0;j < 3;++j)
+        {
+            uint32_t v = indices[t*3 + j];
+            vtxtris[first[v] + remaining[v]++] = t;
+        }
+    }
+
+    std::vector<int> cachepos(vertexcount, -1);
+    std::vector<float> vtxscore(vertexcount);
+    for(size_t v = 0;v < vertexcount;++v)
+        vtxscore[v] = getVertexScore(-1, remaining[v]);
+    std::vector<float> triscore(tricount);
+    for(size_t t = 0;t < tricount;++t)
+        triscore[t] = vtxscore[indices[t*3]] + vtxscore[indices[t*3+1]] + vtxscore[indices[t*3+2]];
+    std::vector<bool> emitted(tricount, false);
+
+    std::vector<uint32_t> cache, newcache;
+    cache.reserve(CacheSize+3);
+    newcache.reserve(CacheSize+3);
+
+    std::vector<uint32_t> out;
+    out.reserve(indices.size());
+    size_t best = tricount;
+    while(out.size() < indices.size())
+    {
+        if(best == tricount)
+        {
+            // Nothing in the cache has triangles left, so start over from the
+            // best remaining one.
+            float bestscore = -1.0f;
+            for(size_t t = 0;t < tricount;++t)
+            {
+                if(!emitted[t] && triscore[t] > bestscore)
+                {
+                    bestscore = triscore[t];
+                    best = t;
+                }
+            }
+        }
+
+        const uint32_t *tri = &indices[best*3];
+        out.insert(out.end(), tri, tri+3);
+        emitted[best] = true;
+
+        newcache.assign(tri, tri+3);
+        for(size_t j = 0;j < 3;++j)
+        {
+            uint32_t v = tri[j];
+            uint32_t *tris = &vtxtris[first[v]];
+            std::swap(*std::find(tris, tris+remaining[v], best), tris[remaining[v]-1]);
+            --remaining[v];
+        }
+        for(uint32_t v : cache)
+        {
+            if(v != tri[0] && v != tri[1] && v != tri[2])
+                newcache.push_back(v);
+        }
+
+        // Rescore the cached vertices (and any that just fell out), then the
+        // triangles using them, and take the best of those next.
+        for(size_t i = 0;i < newcache.size();++i)
+        {
+            uint32_t v = newcache[i];
+            cachepos[v] = (i < size_t(CacheSize)) ? int(i) : -1;
+            vtxscore[v] = getVertexScore(cachepos[v], remaining[v]);
+        }
+        best = tricount;
+        float bestscore = -1.0f;
+        for(uint32_t v : newcache)
+        {
+            for(size_t k = 0;k < remaining[v];++k)
+            {
+                uint32_t t = vtxtris[first[v] + k];
+                triscore[t] = vtxscore[indices[t*3]] + vtxscore[indices[t*3+1]] + vtxscore[indices[t*3+2]];
+                if(triscore[t] > bestscore)
+                {
+                    bestscore = triscore[t];
+                    best = t;
+                }
+            }
+        }
+
+        if(newcache.size() > size_t(CacheSize))
+            newcache.resize(CacheSize);
+        cache.swap(newcache);
+    }
+
+    return out;
+}
+
+/* Renumbers the vertices in the order the indices first use them, dropping
+ * any that aren't used.
+ */
+void reorderVertices(MeshGroup &group)
+{
+    const size_t count = group.getVertexCount();
+    std::vector<uint32_t> remap(count, ~0u);
+    uint32_t next = 0;
+    for(uint32_t &idx : group.mIndices)
+    {
+        if(remap[idx] == ~0u)
+            remap[idx] = next++;
+        idx = remap[idx];
+    }
+
+    MeshGroup old;
+    old.mPositions.swap(group.mPositions);
+    old.mNormals.swap(group.mNormals);
+    old.mBinormals.swap(group.mBinormals);
+    old.mTexCoords.swap(group.mTexCoords);
+    resizeVertices(group, next);
+    for(size_t i = 0;i < count;++i)
+    {
+        if(remap[i] == ~0u) continue;
+        std::copy_n(&old.mPositions[i*3], 3, &group.mPositions[remap[i]*3]);
+        std::copy_n(&old.mNormals[i*3], 3, &group.mNormals[remap[i]*3]);
+        std::copy_n(&old.mBinormals[i*3], 3, &group.mBinormals[remap[i]*3]);
+        std::copy_n(&old.mTexCoords[i*2], 2, &group.mTexCoords[remap[i]*2]);
+    }
+}
+
+} // namespace
+
+
+namespace DFOSG
+{
+
+void optimizeMeshGroup(MeshGroup &group)
+{
+    weldVertices(group);
+    removeDegenerates(group);
+    group.mIndices = reorderTriangles(group.mIndices, group.getVertexCount());
+    reorderVertices(group);
+}
+
+void optimizeMeshGroups(std::vector<MeshGroup> &groups, MeshOptStats *stats)
+{
+    if(stats)
+        *stats = MeshOptStats{0, 0, 0, 0, 0.0f, 0.0f};
+
+    float misses = 0.0f, optmisses = 0.0f;
+    size_t tris = 0, opttris = 0;
+    for(MeshGroup &group : groups)
+    {
+        if(stats)
+        {
+            stats->mVertices += group.getVertexCount();
+            stats->mIndices += group.mIndices.size();
+            misses += getACMR(group.mIndices, group.getVertexCount()) * (group.mIndices.size()/3);
+            tris += group.mIndices.size()/3;
+        }
+
+        optimizeMeshGroup(group);
+
+        if(stats)
+        {
+            stats->mOptVertices += group.getVertexCount();
+            stats->mOptIndices += group.mIndices.size();
+            optmisses += getACMR(group.mIndices, group.getVertexCount()) * (group.mIndices.size()/3);
+            opttris += group.mIndices.size()/3;
+        }
+    }
+
+    if(stats)
+    {
+        stats->mACMR = tris ? misses/tris : 0.0f;
+        stats->mOptACMR = opttris ? optmisses/opttris : 0.0f;
+    }
+}
+
+
+float getACMR(const std::vector<uint32_t> &indices, size_t vertexcount, size_t cachesize)
+{
+    if(indices.size() < 3)
+        return 0.0f;
+
+    // A vertex is in the FIFO if it was added within the last cachesize
+    // misses.
+    std::vector<size_t> added(vertexcount, 0);
+    size_t misses = 0;
+    for(uint32_t idx : indices)
+    {
+        if(added[idx] == 0 || misses+1 - added[idx] > cachesize)
+            added[idx] = ++misses;
+    }
+    return float(misses) / float(indices.size()/3);
+}
+
+size_t getIndexSize(size_t vertexcount)
+{
+    if(vertexcount <= 0x100)
+        return 1;
+    if(vertexcount <= 0x10000)
+        return 2;
+    return 4;
+}
+
+} // namespace DFOSG
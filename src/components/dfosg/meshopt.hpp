@@ -0,0 +1,45 @@
+#ifndef COMPONENTS_DFOSG_MESHOPT_HPP
+#define COMPONENTS_DFOSG_MESHOPT_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "meshloader.hpp"
+
+
+namespace DFOSG
+{
+
+/* Vertex and index counts of a mesh before and after optimizing, along with
+ * the average number of vertices transformed per triangle (ACMR) with a
+ * simulated post-transform cache.
+ */
+struct MeshOptStats {
+    size_t mVertices, mIndices;
+    size_t mOptVertices, mOptIndices;
+    float mACMR, mOptACMR;
+};
+
+/* Welds vertices that are identical in every attribute (so points shared by
+ * neighboring planes with the same texture, normal and UVs are only stored
+ * once), drops triangles with no area, and reorders the triangles for the
+ * post-transform vertex cache (using Tom Forsyth's algorithm) and the vertices
+ * by first use.
+ */
+void optimizeMeshGroup(MeshGroup &group);
+void optimizeMeshGroups(std::vector<MeshGroup> &groups, MeshOptStats *stats=nullptr);
+
+/* Returns the average number of vertices transformed per triangle with a FIFO
+ * cache of the given size. 0.5 is the best possible, and 3 the worst.
+ */
+float getACMR(const std::vector<uint32_t> &indices, size_t vertexcount, size_t cachesize=16);
+
+/* Returns the smallest index size, in bytes (1, 2 or 4), that can address the
+ * given number of vertices.
+ */
+size_t getIndexSize(size_t vertexcount);
+
+} // namespace DFOSG
+
+#endif /* COMPONENTS_DFOSG_MESHOPT_HPP */
@@ -0,0 +1,170 @@
+
+#include "palexpand.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+namespace
+{
+
+using DFOSG::PaletteLUT;
+
+void expandScalar(const uint8_t *src, size_t count, const PaletteLUT &lut, unsigned char *dst)
+{
+    for(size_t i = 0;i < count;++i)
+    {
+        uint32_t color = lut[src[i]];
+        memcpy(dst, &color, 4);
+        dst += 4;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+/* There's no gather before AVX2, so this still looks up each index on its
+ * own, but it loads 16 indices at once and writes out 4 pixels per store.
+ */
+__attribute__((target("sse4.1")))
+void expandSSE4(const uint8_t *src, size_t count, const PaletteLUT &lut, unsigned char *dst)
+{
+    const uint32_t *table = lut.data();
+    size_t i = 0;
+    for(;count-i >= 16;i += 16)
+    {
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+        __m128i px0 = _mm_setr_epi32(
+            table[_mm_extract_epi8(idx, 0)], table[_mm_extract_epi8(idx, 1)],
+            table[_mm_extract_epi8(idx, 2)], table[_mm_extract_epi8(idx, 3)]
+        );
+        __m128i px1 = _mm_setr_epi32(
+            table[_mm_extract_epi8(idx, 4)], table[_mm_extract_epi8(idx, 5)],
+            table[_mm_extract_epi8(idx, 6)], table[_mm_extract_epi8(idx, 7)]
+        );
+        __m128i px2 = _mm_setr_epi32(
+            table[_mm_extract_epi8(idx, 8)], table[_mm_extract_epi8(idx, 9)],
+            table[_mm_extract_epi8(idx, 10)], table[_mm_extract_epi8(idx, 11)]
+        );
+        __m128i px3 = _mm_setr_epi32(
+            table[_mm_extract_epi8(idx, 12)], table[_mm_extract_epi8(idx, 13)],
+            table[_mm_extract_epi8(idx, 14)], table[_mm_extract_epi8(idx, 15)]
+        );
+        __m128i *out = reinterpret_cast<__m128i*>(dst + i*4);
+        _mm_storeu_si128(out+0, px0);
+        _mm_storeu_si128(out+1, px1);
+        _mm_storeu_si128(out+2, px2);
+        _mm_storeu_si128(out+3, px3);
+    }
+    expandScalar(src+i, count-i, lut, dst + i*4);
+}
+
+__attribute__((target("avx2")))
+void expandAVX2(const uint8_t *src, size_t count, const PaletteLUT &lut, unsigned char *dst)
+{
+    const int *table = reinterpret_cast<const int*>(lut.data());
+    size_t i = 0;
+    for(;count-i >= 16;i += 16)
+    {
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+        __m256i idx0 = _mm256_cvtepu8_epi32(idx);
+        __m256i idx1 = _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8));
+        __m256i px0 = _mm256_i32gather_epi32(table, idx0, 4);
+        __m256i px1 = _mm256_i32gather_epi32(table, idx1, 4);
+        __m256i *out = reinterpret_cast<__m256i*>(dst + i*4);
+        _mm256_storeu_si256(out+0, px0);
+        _mm256_storeu_si256(out+1, px1);
+    }
+    expandScalar(src+i, count-i, lut, dst + i*4);
+}
+#endif
+
+typedef void (*ExpandFunc)(const uint8_t*, size_t, const PaletteLUT&, unsigned char*);
+
+ExpandFunc getExpandFunc(DFOSG::PaletteKernel kernel)
+{
+    switch(kernel)
+    {
+#ifdef HAVE_X86_KERNELS
+        case DFOSG::Kernel_SSE4: return expandSSE4;
+        case DFOSG::Kernel_AVX2: return expandAVX2;
+#endif
+        default: break;
+    }
+    return expandScalar;
+}
+
+} // namespace
+
+
+namespace DFOSG
+{
+
+void buildPaletteLUT(const Resource::Palette &palette, PaletteLUT &lut)
+{
+    for(size_t i = 0;i < palette.size();++i)
+    {
+        const unsigned char color[4] = {
+            palette[i].r, palette[i].g, palette[i].b,
+            static_cast<unsigned char>((i==0) ? 0 : 255)
+        };
+        memcpy(&lut[i], color, 4);
+    }
+}
+
+
+bool isPaletteKernelSupported(PaletteKernel kernel)
+{
+    switch(kernel)
+    {
+        case Kernel_Scalar: return true;
+#ifdef HAVE_X86_KERNELS
+        case Kernel_SSE4: return __builtin_cpu_supports("sse4.1");
+        case Kernel_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: break;
+    }
+    return false;
+}
+
+PaletteKernel getPaletteKernel()
+{
+    static const PaletteKernel kernel = []() -> PaletteKernel
+    {
+        if(isPaletteKernelSupported(Kernel_AVX2))
+            return Kernel_AVX2;
+        if(isPaletteKernelSupported(Kernel_SSE4))
+            return Kernel_SSE4;
+        return Kernel_Scalar;
+    }();
+    return kernel;
+}
+
+const char *getPaletteKernelName(PaletteKernel kernel)
+{
+    switch(kernel)
+    {
+        case Kernel_Scalar: return "scalar";
+        case Kernel_SSE4: return "sse4.1";
+        case Kernel_AVX2: return "avx2";
+        case Kernel_Count: break;
+    }
+    return "unknown";
+}
+
+
+void expandPalette(const uint8_t *src, size_t count, const PaletteLUT &lut, unsigned char *dst)
+{
+    static const ExpandFunc func = getExpandFunc(getPaletteKernel());
+    func(src, count, lut, dst);
+}
+
+void expandPalette(PaletteKernel kernel, const uint8_t *src, size_t count, const PaletteLUT &lut,
+                   unsigned char *dst)
+{
+    getExpandFunc(kernel)(src, count, lut, dst);
+}
+
+} // namespace DFOSG
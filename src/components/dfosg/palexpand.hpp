@@ -0,0 +1,43 @@
+#ifndef COMPONENTS_DFOSG_PALEXPAND_HPP
+#define COMPONENTS_DFOSG_PALEXPAND_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#include "components/resource/texturemanager.hpp"
+
+
+namespace DFOSG
+{
+
+/* A palette packed as 32-bit RGBA values, laid out in memory as R, G, B, A
+ * regardless of endianness. Index 0 is transparent, and the rest are opaque.
+ */
+typedef std::array<uint32_t,256> PaletteLUT;
+
+void buildPaletteLUT(const Resource::Palette &palette, PaletteLUT &lut);
+
+
+enum PaletteKernel {
+    Kernel_Scalar,
+    Kernel_SSE4,
+    Kernel_AVX2,
+
+    Kernel_Count
+};
+
+/* Returns the fastest kernel the CPU supports, as picked on first use. */
+PaletteKernel getPaletteKernel();
+bool isPaletteKernelSupported(PaletteKernel kernel);
+const char *getPaletteKernelName(PaletteKernel kernel);
+
+/* Expands count palette indices from src to RGBA8 pixels in dst. */
+void expandPalette(const uint8_t *src, size_t count, const PaletteLUT &lut, unsigned char *dst);
+/* Same, but with the given kernel, which must be supported. */
+void expandPalette(PaletteKernel kernel, const uint8_t *src, size_t count, const PaletteLUT &lut,
+                   unsigned char *dst);
+
+} // namespace DFOSG
+
+#endif /* COMPONENTS_DFOSG_PALEXPAND_HPP */
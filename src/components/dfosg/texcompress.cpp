@@ -0,0 +1,388 @@
+
+#include "texcompress.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+
+namespace
+{
+
+struct Color {
+    int r, g, b;
+};
+
+uint16_t packColor(float r, float g, float b)
+{
+    int ir = std::max(0, std::min(31, int(r*31.0f/255.0f + 0.5f)));
+    int ig = std::max(0, std::min(63, int(g*63.0f/255.0f + 0.5f)));
+    int ib = std::max(0, std::min(31, int(b*31.0f/255.0f + 0.5f)));
+    return uint16_t((ir<<11) | (ig<<5) | ib);
+}
+
+Color unpackColor(uint16_t c)
+{
+    int r = (c>>11) & 31;
+    int g = (c>>5) & 63;
+    int b = c & 31;
+    return Color{(r<<3) | (r>>2), (g<<2) | (g>>4), (b<<3) | (b>>2)};
+}
+
+int colorDistance(const Color &lhs, const unsigned char *rhs)
+{
+    int dr = lhs.r - rhs[0];
+    int dg = lhs.g - rhs[1];
+    int db = lhs.b - rhs[2];
+    return dr*dr + dg*dg + db*db;
+}
+
+void putLE16(unsigned char *dst, uint16_t val)
+{
+    dst[0] = val & 0xff;
+    dst[1] = val >> 8;
+}
+
+
+/* Fits endpoints to the used texels of a block along their principal axis,
+ * and writes the 8-byte color block. If transparent is set, texels that
+ * aren't used are given the transparent index (BC1's 3-color mode).
+ */
+void encodeColorBlock(const unsigned char (&texels)[16][4], const bool (&used)[16], bool transparent,
+                      unsigned char *dst)
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    size_t count = 0;
+    for(size_t i = 0;i < 16;++i)
+    {
+        if(!used[i]) continue;
+        for(size_t c = 0;c < 3;++c)
+            mean[c] += texels[i][c];
+        ++count;
+    }
+    if(count == 0)
+    {
+        // Fully transparent (or nothing to fit). Both endpoints black, and in
+        // 3-color mode every texel uses the transparent index.
+        memset(dst, 0, 4);
+        memset(dst+4, transparent ? 0xff : 0x00, 4);
+        return;
+    }
+    for(size_t c = 0;c < 3;++c)
+        mean[c] /= count;
+
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for(size_t i = 0;i < 16;++i)
+    {
+        if(!used[i]) continue;
+        float r = texels[i][0] - mean[0];
+        float g = texels[i][1] - mean[1];
+        float b = texels[i][2] - mean[2];
+        cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+        cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+    }
+
+    // A few rounds of power iteration is plenty for a 3x3 matrix. Starting
+    // from the channel that varies most means the first round can't come out
+    // zero, as a fixed start can (e.g. from grey for a red/green checker).
+    float axis[3] = { 0.0f, 0.0f, 0.0f };
+    if(cov[0] >= cov[3] && cov[0] >= cov[5])
+        axis[0] = 1.0f;
+    else if(cov[3] >= cov[5])
+        axis[1] = 1.0f;
+    else
+        axis[2] = 1.0f;
+    for(int iter = 0;iter < 8;++iter)
+    {
+        float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+        float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+        float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+        float len = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+        if(len <= 0.0f)
+        {
+            // No variance, so every used texel is the same color. Fit the
+            // per-channel range instead, which is just that color.
+            axis[0] = axis[1] = axis[2] = 0.0f;
+            break;
+        }
+        axis[0] = x/len; axis[1] = y/len; axis[2] = z/len;
+    }
+
+    float minproj = 0.0f, maxproj = 0.0f;
+    bool first = true;
+    for(size_t i = 0;i < 16;++i)
+    {
+        if(!used[i]) continue;
+        float proj = (texels[i][0]-mean[0])*axis[0] + (texels[i][1]-mean[1])*axis[1] +
+                     (texels[i][2]-mean[2])*axis[2];
+        if(first || proj < minproj) minproj = proj;
+        if(first || proj > maxproj) maxproj = proj;
+        first = false;
+    }
+    float len2 = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+    if(len2 > 0.0f)
+    {
+        minproj /= len2;
+        maxproj /= len2;
+    }
+
+    uint16_t c0, c1;
+    if(len2 > 0.0f)
+    {
+        c0 = packColor(mean[0] + axis[0]*maxproj, mean[1] + axis[1]*maxproj,
+                       mean[2] + axis[2]*maxproj);
+        c1 = packColor(mean[0] + axis[0]*minproj, mean[1] + axis[1]*minproj,
+                       mean[2] + axis[2]*minproj);
+    }
+    else
+    {
+        int minc[3] = { 255, 255, 255 }, maxc[3] = { 0, 0, 0 };
+        for(size_t i = 0;i < 16;++i)
+        {
+            if(!used[i]) continue;
+            for(size_t c = 0;c < 3;++c)
+            {
+                minc[c] = std::min<int>(minc[c], texels[i][c]);
+                maxc[c] = std::max<int>(maxc[c], texels[i][c]);
+            }
+        }
+        c0 = packColor(maxc[0], maxc[1], maxc[2]);
+        c1 = packColor(minc[0], minc[1], minc[2]);
+    }
+    // 4-color mode needs c0 > c1, and 3-color mode needs c0 <= c1.
+    if(transparent ? (c0 > c1) : (c0 < c1))
+        std::swap(c0, c1);
+
+    Color palette[4];
+    palette[0] = unpackColor(c0);
+    palette[1] = unpackColor(c1);
+    size_t numcolors;
+    if(transparent)
+    {
+        palette[2] = Color{(palette[0].r+palette[1].r)/2, (palette[0].g+palette[1].g)/2,
+                           (palette[0].b+palette[1].b)/2};
+        numcolors = 3;
+    }
+    else
+    {
+        palette[2] = Color{(2*palette[0].r+palette[1].r)/3, (2*palette[0].g+palette[1].g)/3,
+                           (2*palette[0].b+palette[1].b)/3};
+        palette[3] = Color{(palette[0].r+2*palette[1].r)/3, (palette[0].g+2*palette[1].g)/3,
+                           (palette[0].b+2*palette[1].b)/3};
+        // With equal endpoints, every color is the same.
+        numcolors = (c0 == c1) ? 1 : 4;
+    }
+
+    uint32_t indices = 0;
+    for(size_t i = 0;i < 16;++i)
+    {
+        uint32_t best = 0;
+        if(!used[i])
+            best = transparent ? 3 : 0;
+        else
+        {
+            int bestdist = colorDistance(palette[0], texels[i]);
+            for(size_t j = 1;j < numcolors;++j)
+            {
+                int dist = colorDistance(palette[j], texels[i]);
+                if(dist < bestdist)
+                {
+                    bestdist = dist;
+                    best = j;
+                }
+            }
+        }
+        indices |= best << (i*2);
+    }
+
+    putLE16(dst, c0);
+    putLE16(dst+2, c1);
+    dst[4] = indices & 0xff;
+    dst[5] = (indices>>8) & 0xff;
+    dst[6] = (indices>>16) & 0xff;
+    dst[7] = (indices>>24) & 0xff;
+}
+
+/* Writes the 8-byte BC3 alpha block, using the 8-value mode between the
+ * block's smallest and largest alpha.
+ */
+void encodeAlphaBlock(const unsigned char (&texels)[16][4], unsigned char *dst)
+{
+    int a0 = 0, a1 = 255;
+    for(size_t i = 0;i < 16;++i)
+    {
+        a0 = std::max<int>(a0, texels[i][3]);
+        a1 = std::min<int>(a1, texels[i][3]);
+    }
+
+    int values[8] = { a0, a1 };
+    for(int i = 1;i < 7;++i)
+        values[i+1] = ((7-i)*a0 + i*a1) / 7;
+
+    uint64_t indices = 0;
+    if(a0 > a1)
+    {
+        for(size_t i = 0;i < 16;++i)
+        {
+            uint64_t best = 0;
+            int bestdist = std::abs(values[0] - texels[i][3]);
+            for(size_t j = 1;j < 8;++j)
+            {
+                int dist = std::abs(values[j] - texels[i][3]);
+                if(dist < bestdist)
+                {
+                    bestdist = dist;
+                    best = j;
+                }
+            }
+            indices |= best << (i*3);
+        }
+    }
+
+    dst[0] = a0;
+    dst[1] = a1;
+    for(size_t i = 0;i < 6;++i)
+        dst[2+i] = (indices >> (i*8)) & 0xff;
+}
+
+} // namespace
+
+
+namespace DFOSG
+{
+
+size_t getBlockSize(BlockFormat format)
+{
+    return (format == Block_BC1) ? 8 : 16;
+}
+
+size_t getCompressedSize(BlockFormat format, size_t width, size_t height)
+{
+    return ((width+3)/4) * ((height+3)/4) * getBlockSize(format);
+}
+
+size_t getMipCount(size_t width, size_t height)
+{
+    size_t count = 1;
+    while(width > 1 || height > 1)
+    {
+        width = std::max<size_t>(width/2, 1);
+        height = std::max<size_t>(height/2, 1);
+        ++count;
+    }
+    return count;
+}
+
+
+void downsampleImage(const unsigned char *src, size_t width, size_t height, std::vector<unsigned char> &dst)
+{
+    size_t dstwidth = std::max<size_t>(width/2, 1);
+    size_t dstheight = std::max<size_t>(height/2, 1);
+    dst.resize(dstwidth*dstheight*4);
+
+    for(size_t y = 0;y < dstheight;++y)
+    {
+        size_t y0 = std::min(y*2, height-1);
+        size_t y1 = std::min(y*2 + 1, height-1);
+        for(size_t x = 0;x < dstwidth;++x)
+        {
+            size_t x0 = std::min(x*2, width-1);
+            size_t x1 = std::min(x*2 + 1, width-1);
+            const unsigned char *texels[4] = {
+                src + (y0*width + x0)*4, src + (y0*width + x1)*4,
+                src + (y1*width + x0)*4, src + (y1*width + x1)*4
+            };
+
+            unsigned int alpha = 0;
+            unsigned int color[3] = { 0, 0, 0 };
+            unsigned int plain[3] = { 0, 0, 0 };
+            for(const unsigned char *texel : texels)
+            {
+                alpha += texel[3];
+                for(size_t c = 0;c < 3;++c)
+                {
+                    color[c] += texel[c] * texel[3];
+                    plain[c] += texel[c];
+                }
+            }
+
+            unsigned char *out = &dst[(y*dstwidth + x)*4];
+            for(size_t c = 0;c < 3;++c)
+                out[c] = alpha ? (color[c] + alpha/2) / alpha : (plain[c] + 2) / 4;
+            out[3] = (alpha + 2) / 4;
+        }
+    }
+}
+
+
+void compressImage(BlockFormat format, const unsigned char *src, size_t width, size_t height,
+                   unsigned char *dst)
+{
+    for(size_t by = 0;by < height;by += 4)
+    {
+        for(size_t bx = 0;bx < width;bx += 4)
+        {
+            // Blocks that hang off the edge repeat the last row or column.
+            unsigned char texels[16][4];
+            bool used[16];
+            bool transparent = false;
+            for(size_t i = 0;i < 16;++i)
+            {
+                size_t x = std::min(bx + (i&3), width-1);
+                size_t y = std::min(by + (i>>2), height-1);
+                memcpy(texels[i], src + (y*width + x)*4, 4);
+                if(format == Block_BC1)
+                {
+                    used[i] = (texels[i][3] >= 128);
+                    transparent |= !used[i];
+                }
+                else
+                    used[i] = (texels[i][3] > 0);
+            }
+
+            if(format == Block_BC3)
+            {
+                encodeAlphaBlock(texels, dst);
+                dst += 8;
+            }
+            encodeColorBlock(texels, used, transparent, dst);
+            dst += 8;
+        }
+    }
+}
+
+void compressImageMips(BlockFormat format, const unsigned char *src, size_t width, size_t height,
+                       CompressedImage &out)
+{
+    size_t levels = getMipCount(width, height);
+
+    out.mFormat = format;
+    out.mWidth = width;
+    out.mHeight = height;
+    out.mMipOffsets.resize(levels);
+
+    size_t total = 0;
+    for(size_t i = 0, w = width, h = height;i < levels;++i)
+    {
+        out.mMipOffsets[i] = total;
+        total += getCompressedSize(format, w, h);
+        w = std::max<size_t>(w/2, 1);
+        h = std::max<size_t>(h/2, 1);
+    }
+    out.mData.resize(total);
+
+    std::vector<unsigned char> level, next;
+    for(size_t i = 0;i < levels;++i)
+    {
+        compressImage(format, src, width, height, out.mData.data() + out.mMipOffsets[i]);
+        if(i+1 == levels) break;
+
+        downsampleImage(src, width, height, next);
+        level.swap(next);
+        src = level.data();
+        width = std::max<size_t>(width/2, 1);
+        height = std::max<size_t>(height/2, 1);
+    }
+}
+
+} // namespace DFOSG
@@ -0,0 +1,51 @@
+#ifndef COMPONENTS_DFOSG_TEXCOMPRESS_HPP
+#define COMPONENTS_DFOSG_TEXCOMPRESS_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace DFOSG
+{
+
+enum BlockFormat {
+    Block_BC1 = 1, // DXT1, with 1-bit alpha
+    Block_BC3 = 2  // DXT5, with 8-bit interpolated alpha
+};
+
+/* An image compressed to 4x4 blocks, with its full mipmap chain. Each level's
+ * blocks follow the previous one's, starting at the given offset.
+ */
+struct CompressedImage {
+    BlockFormat mFormat;
+    size_t mWidth, mHeight;
+    std::vector<size_t> mMipOffsets;
+    std::vector<unsigned char> mData;
+};
+
+size_t getBlockSize(BlockFormat format);
+/* Returns the compressed size of a single level of the given dimensions. */
+size_t getCompressedSize(BlockFormat format, size_t width, size_t height);
+/* Returns the number of levels in a full mipmap chain, down to 1x1. */
+size_t getMipCount(size_t width, size_t height);
+
+/* Halves an RGBA8 image in each dimension (to no less than 1). Colors are
+ * weighted by alpha, so transparent texels don't bleed their color into the
+ * smaller levels.
+ */
+void downsampleImage(const unsigned char *src, size_t width, size_t height, std::vector<unsigned char> &dst);
+
+/* Compresses a single level of an RGBA8 image. Texels with alpha below 128
+ * become transparent in BC1. dst must hold getCompressedSize bytes.
+ */
+void compressImage(BlockFormat format, const unsigned char *src, size_t width, size_t height,
+                   unsigned char *dst);
+
+/* Builds the mipmap chain for an RGBA8 image and compresses every level. */
+void compressImageMips(BlockFormat format, const unsigned char *src, size_t width, size_t height,
+                       CompressedImage &out);
+
+} // namespace DFOSG
+
+#endif /* COMPONENTS_DFOSG_TEXCOMPRESS_HPP */
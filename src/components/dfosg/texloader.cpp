@@ -1,13 +1,23 @@
 
 #include "texloader.hpp"
 
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
 #include <vector>
 #include <sstream>
 #include <iomanip>
+#include <memory>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <cstring>
 
 #include <osg/Image>
 
 #include "components/vfs/manager.hpp"
+#include "misc/record.hpp"
+#include "misc/threadpool.hpp"
 
 
 namespace
@@ -19,19 +29,17 @@ class TexEntryHeader {
     uint32_t mOffset;
     uint16_t mUnknown2;
     uint32_t mUnknown3;
-    uint16_t mNullValue[2];
+    uint32_t mNullValue[2];
 
 public:
-    void load(std::istream &stream)
-    {
-        mUnknown1 = stream.get();
-        mColor = stream.get();
-        mOffset = VFS::read_le32(stream);
-        mUnknown2 = VFS::read_le16(stream);
-        mUnknown3 = VFS::read_le32(stream);
-        mNullValue[0] = VFS::read_le32(stream);
-        mNullValue[1] = VFS::read_le32(stream);
-    }
+    typedef Misc::Record<
+        RECORD_FIELD(TexEntryHeader, mUnknown1),
+        RECORD_FIELD(TexEntryHeader, mColor),
+        RECORD_FIELD(TexEntryHeader, mOffset),
+        RECORD_FIELD(TexEntryHeader, mUnknown2),
+        RECORD_FIELD(TexEntryHeader, mUnknown3),
+        RECORD_FIELD(TexEntryHeader, mNullValue)
+    > Schema;
 
     uint8_t getColor() const { return mColor; }
     uint32_t getOffset() const { return mOffset; }
@@ -44,14 +52,17 @@ class TexFileHeader {
     std::vector<TexEntryHeader> mHeaders;
 
 public:
-    void load(std::istream &stream)
+    typedef Misc::Record<
+        RECORD_FIELD(TexFileHeader, mImageCount),
+        RECORD_FIELD(TexFileHeader, mName)
+    > Schema;
+
+    void load(Misc::ByteReader &reader)
     {
-        mImageCount = VFS::read_le16(stream);
-        stream.read(mName.data(), mName.size());
+        reader.read(*this);
 
         mHeaders.resize(mImageCount);
-        for(TexEntryHeader &hdr : mHeaders)
-            hdr.load(stream);
+        reader.readArray(mHeaders.data(), mHeaders.size());
     }
 
     uint16_t getImageCount() const { return mImageCount; }
@@ -77,21 +88,21 @@ public:
     static const uint16_t sRleCompressed = 0x0002;
     static const uint16_t sImageRle  = 0x0108;
     static const uint16_t sRecordRle = 0x1108;
-    void load(std::istream &stream)
-    {
-        mOffsetX = VFS::read_le16(stream);
-        mOffsetY = VFS::read_le16(stream);
-        mWidth = VFS::read_le16(stream);
-        mHeight = VFS::read_le16(stream);
-        mCompression = VFS::read_le16(stream);
-        mRecordSize = VFS::read_le32(stream);
-        mDataOffset = VFS::read_le32(stream);
-        mIsNormal = VFS::read_le16(stream);
-        mFrameCount = VFS::read_le16(stream);
-        mUnknown = VFS::read_le16(stream);
-        mXScale = VFS::read_le16(stream);
-        mYScale = VFS::read_le16(stream);
-    }
+
+    typedef Misc::Record<
+        RECORD_FIELD(TexHeader, mOffsetX),
+        RECORD_FIELD(TexHeader, mOffsetY),
+        RECORD_FIELD(TexHeader, mWidth),
+        RECORD_FIELD(TexHeader, mHeight),
+        RECORD_FIELD(TexHeader, mCompression),
+        RECORD_FIELD(TexHeader, mRecordSize),
+        RECORD_FIELD(TexHeader, mDataOffset),
+        RECORD_FIELD(TexHeader, mIsNormal),
+        RECORD_FIELD(TexHeader, mFrameCount),
+        RECORD_FIELD(TexHeader, mUnknown),
+        RECORD_FIELD(TexHeader, mXScale),
+        RECORD_FIELD(TexHeader, mYScale)
+    > Schema;
 
     int16_t getXOffset() const { return mOffsetX; }
     int16_t getYOffset() const { return mOffsetY; }
@@ -105,6 +116,62 @@ public:
     int16_t getYScale() const { return mYScale; }
 };
 
+static_assert(TexEntryHeader::Schema::size() == 20, "Unexpected TexEntryHeader size");
+static_assert(TexFileHeader::Schema::size() == 26, "Unexpected TexFileHeader size");
+static_assert(TexHeader::Schema::size() == 28, "Unexpected TexHeader size");
+
+
+Misc::ThreadPool &getDecodePool()
+{
+    static Misc::ThreadPool pool;
+    return pool;
+}
+
+// Parsed file headers, and the size of the file they're from, by TEXTURE.???
+// file number.
+std::mutex gHeaderMutex;
+std::map<size_t,std::pair<size_t,std::shared_ptr<const TexFileHeader>>> gHeaderCache;
+
+/* Reads the TEXTURE.??? file for the given index into data, and returns its
+ * (cached) header.
+ */
+std::shared_ptr<const TexFileHeader> getFileHeader(size_t idx, VFS::EntryData &data)
+{
+    std::stringstream sstr; sstr.fill('0');
+    sstr<<"TEXTURE."<<std::setw(3)<<(idx>>7);
+
+    data = VFS::Manager::get().readAll(sstr.str());
+    if(!data) throw std::runtime_error("Failed to open "+sstr.str());
+
+    // The file size is kept with the header, in case a different file with
+    // the same name gets loaded (e.g. from another data path).
+    std::lock_guard<std::mutex> lock(gHeaderMutex);
+    auto iter = gHeaderCache.find(idx>>7);
+    if(iter != gHeaderCache.end() && iter->second.first == data.size())
+        return iter->second.second;
+
+    Misc::ByteReader reader(data.data(), data.size());
+    std::shared_ptr<TexFileHeader> hdr = std::make_shared<TexFileHeader>();
+    hdr->load(reader);
+
+    gHeaderCache[idx>>7] = std::make_pair(data.size(), hdr);
+    return hdr;
+}
+
+/* Allocates an RGBA8 image, or an 8-bit index image for use as an integer
+ * texture.
+ */
+void allocateImage(osg::Image *image, size_t width, size_t height, bool indexed)
+{
+    if(!indexed)
+        image->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    else
+    {
+        image->allocateImage(width, height, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE);
+        image->setInternalTextureFormat(GL_R8UI);
+    }
+}
+
 } // namespace
 
 
@@ -123,10 +190,21 @@ TexLoader::~TexLoader()
 }
 
 
-osg::Image *TexLoader::createDummyImage()
+osg::Image *TexLoader::createDummyImage(const PaletteLUT *lut)
 {
     osg::Image *image = new osg::Image();
 
+    if(!lut)
+    {
+        // Diagonal stripes, in whatever colors the palette has.
+        allocateImage(image, 2, 2, true);
+        image->data(0, 0)[0] = 255;
+        image->data(1, 0)[0] = 1;
+        image->data(0, 1)[0] = 1;
+        image->data(1, 1)[0] = 255;
+        return image;
+    }
+
     // Yellow/black diagonal stripes
     image->allocateImage(2, 2, 1, GL_RGBA, GL_UNSIGNED_BYTE);
     unsigned char *dst = image->data(0, 0);
@@ -152,71 +230,161 @@ osg::Image *TexLoader::createDummyImage()
 }
 
 
-osg::Image *TexLoader::loadUncompressedSingle(size_t width, size_t height, const Resource::Palette &palette, std::istream &stream)
+osg::Image *TexLoader::loadUncompressedSingle(size_t width, size_t height, const PaletteLUT *lut, Misc::ByteReader &reader)
 {
     osg::Image *image = new osg::Image();
-    image->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    allocateImage(image, width, height, !lut);
 
+    // Rows are always stored 256 bytes apart.
+    width = std::min<size_t>(width, 256);
     for(size_t y = 0;y < height;++y)
     {
-        std::array<uint8_t,256> line;
-        stream.read(reinterpret_cast<char*>(line.data()), line.size());
+        const uint8_t *line = reinterpret_cast<const uint8_t*>(reader.data() + reader.tell());
+        reader.skip(256);
 
-        unsigned char *dst = image->data(0, y);
-        for(size_t x = 0;x < width;++x)
-        {
-            const Resource::PaletteEntry &color = palette[line[x]];
-            *(dst++) = color.r;
-            *(dst++) = color.g;
-            *(dst++) = color.b;
-            *(dst++) = (line[x]==0) ? 0 : 255;
-        }
+        if(lut)
+            expandPalette(line, width, *lut, image->data(0, y));
+        else
+            memcpy(image->data(0, y), line, width);
     }
 
     return image;
 }
 
-void TexLoader::loadUncompressedMulti(osg::Image *image, const Resource::Palette &palette, std::istream &stream)
+void TexLoader::loadUncompressedMulti(osg::Image *image, const PaletteLUT *lut, const uint8_t *data, size_t size)
 {
-    size_t width = VFS::read_le16(stream);
-    size_t height = VFS::read_le16(stream);
-
-    for(uint32_t y = 0;y < height && stream;++y)
+    // Each row is a series of runs, alternating between transparent and
+    // literal pixels, each starting with its length. Runs are allowed to go
+    // past the end of a row, and carry on into the next one like the image
+    // is one long line, so only the end of the image bounds the output.
+    const uint8_t *src = data;
+    const uint8_t *src_end = data + size;
+    auto getByte = [&src, src_end]() -> uint8_t
+    {
+        if(src == src_end)
+            throw std::runtime_error("Attempted to read past the end of data");
+        return *(src++);
+    };
+
+    size_t width = getByte();
+    width |= getByte() << 8;
+    size_t height = getByte();
+    height |= getByte() << 8;
+
+    const size_t pixel_size = lut ? 4 : 1;
+    unsigned char *dst_base = image->data();
+    const size_t image_width = image->s();
+    const size_t image_size = image_width * image->t();
+
+    // Returns how many of count pixels, starting at pos, fit in the image.
+    auto clampRun = [image_size](size_t pos, size_t count) -> size_t
+    { return (pos < image_size) ? std::min(count, image_size-pos) : 0; };
+
+    for(size_t y = 0;y < height && src != src_end;++y)
     {
         bool isZero = true;
-        uint8_t c = stream.get();
+        size_t c = getByte();
 
-        uint32_t x = 0;
+        size_t x = 0;
         do {
+            size_t pos = y*image_width + x;
+            unsigned char *dst = dst_base + pos*pixel_size;
             if(isZero)
             {
-                for(uint32_t i = 0;i < c;++i)
-                {
-                    unsigned char *dst = image->data(x++, y);
-                    *(dst++) = palette[0].r;
-                    *(dst++) = palette[0].g;
-                    *(dst++) = palette[0].b;
-                    *(dst++) = 0;
-                }
+                if(!lut)
+                    memset(dst, 0, clampRun(pos, c));
+                else for(size_t i = clampRun(pos, c);i > 0;--i, dst += 4)
+                    memcpy(dst, &(*lut)[0], 4);
             }
-            else for(uint32_t i = 0;i < c;++i)
+            else
             {
-                unsigned char *dst = image->data(x++, y);
-                uint8_t idx = stream.get();
-                *(dst++) = palette[idx].r;
-                *(dst++) = palette[idx].g;
-                *(dst++) = palette[idx].b;
-                *(dst++) = (idx==0) ? 0 : 255;
+                if(c > size_t(src_end-src))
+                    throw std::runtime_error("Attempted to read past the end of data");
+                if(lut)
+                    expandPalette(src, clampRun(pos, c), *lut, dst);
+                else
+                    memcpy(dst, src, clampRun(pos, c));
+                src += c;
             }
-            if(x < width || (x >= width && isZero))
-                c = stream.get();
+            x += c;
+
+            if(x < width || (isZero && src != src_end))
+                c = getByte();
             isZero = !isZero;
-        } while(x < width && stream);
+        } while(x < width);
     }
 }
 
+void TexLoader::loadUncompressedFrames(ImagePtrArray &images, const PaletteLUT *lut, const uint8_t *data,
+                                       size_t size, const std::vector<uint32_t> &offsets)
+{
+    // The images are all allocated up front, so each frame can be decoded
+    // independently.
+    for(uint32_t offset : offsets)
+    {
+        if(offset > size)
+            throw std::runtime_error("Attempted to seek past the end of data");
+    }
+
+    size_t pixels = images.empty() ? 0 : images[0]->s() * images[0]->t() * images.size();
+    if(offsets.size() < 4 || pixels < 64*1024)
+    {
+        for(size_t i = 0;i < offsets.size();++i)
+            loadUncompressedMulti(images[i], lut, data+offsets[i], size-offsets[i]);
+        return;
+    }
+
+    // The calling thread decodes frames along with the pool, and only waits
+    // for frames that were actually started, so this can't deadlock if it's
+    // called from a thread the pool is also running jobs on.
+    struct Job {
+        std::atomic<size_t> mNext;
+        size_t mDone;
+        std::exception_ptr mError;
+        std::mutex mMutex;
+        std::condition_variable mCondVar;
+
+        Job() : mNext(0), mDone(0) { }
+    };
+    auto job = std::make_shared<Job>();
+
+    const size_t count = offsets.size();
+    auto work = [this, job, count, &images, lut, data, size, &offsets]()
+    {
+        size_t i;
+        while((i=job->mNext.fetch_add(1)) < count)
+        {
+            std::exception_ptr error;
+            try {
+                loadUncompressedMulti(images[i], lut, data+offsets[i], size-offsets[i]);
+            }
+            catch(...) {
+                error = std::current_exception();
+            }
 
-ImagePtrArray TexLoader::load(std::istream &stream, const TexEntryHeader &texentry, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale, const Resource::Palette &palette)
+            std::lock_guard<std::mutex> lock(job->mMutex);
+            if(error && !job->mError)
+                job->mError = error;
+            if(++job->mDone == count)
+                job->mCondVar.notify_all();
+        }
+    };
+
+    Misc::ThreadPool &pool = getDecodePool();
+    size_t helpers = std::min(pool.size(), count-1);
+    for(size_t i = 0;i < helpers;++i)
+        pool.enqueue(work);
+    work();
+
+    std::unique_lock<std::mutex> lock(job->mMutex);
+    while(job->mDone < count)
+        job->mCondVar.wait(lock);
+    if(job->mError)
+        std::rethrow_exception(job->mError);
+}
+
+
+ImagePtrArray TexLoader::load(Misc::ByteReader &reader, const TexEntryHeader &texentry, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale, const PaletteLUT *lut)
 {
     ImagePtrArray images;
 
@@ -225,23 +393,20 @@ ImagePtrArray TexLoader::load(std::istream &stream, const TexEntryHeader &texent
         osg::ref_ptr<osg::Image> image(new osg::Image());
 
         // Solid color "texture".
-        image->allocateImage(1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE);
-        uint8_t idx = texentry.getColor();
-        unsigned char *dst = image->data(0, 0);
-        *(dst++) = palette[idx].r;
-        *(dst++) = palette[idx].g;
-        *(dst++) = palette[idx].b;
-        *(dst++) = (idx==0) ? 0 : 255;
+        allocateImage(image, 1, 1, !lut);
+        if(lut)
+            memcpy(image->data(0, 0), &(*lut)[texentry.getColor()], 4);
+        else
+            image->data(0, 0)[0] = texentry.getColor();
 
         images.push_back(image);
         return images;
     }
 
-    if(!stream.seekg(texentry.getOffset()))
-        throw std::runtime_error("Failed to seek to texture offset");
+    reader.seek(texentry.getOffset());
 
     TexHeader texhdr;
-    texhdr.load(stream);
+    reader.read(texhdr);
 
     if(xoffset) *xoffset = texhdr.getXOffset();
     if(yoffset) *yoffset = texhdr.getYOffset();
@@ -254,7 +419,7 @@ ImagePtrArray TexLoader::load(std::istream &stream, const TexEntryHeader &texent
     if(texhdr.getFrameCount() == 0)
     {
         // Allocate a dummy image
-        images.push_back(createDummyImage());
+        images.push_back(createDummyImage(lut));
     }
     else if(texhdr.getFrameCount() == 1)
     {
@@ -268,14 +433,13 @@ ImagePtrArray TexLoader::load(std::istream &stream, const TexEntryHeader &texent
             std::cerr<< "Unhandled RecordRle compression type"<< std::endl;
         else //if(texhdr.getCompression() == texhdr.sUncompressed)
         {
-            if(!stream.seekg(texentry.getOffset() + texhdr.getDataOffset()))
-                throw std::runtime_error("Failed to seek to image offset");
+            reader.seek(texentry.getOffset() + texhdr.getDataOffset());
 
-            image = loadUncompressedSingle(texhdr.getWidth(), texhdr.getHeight(), palette, stream);
+            image = loadUncompressedSingle(texhdr.getWidth(), texhdr.getHeight(), lut, reader);
         }
 
         if(!image)
-            image = createDummyImage();
+            image = createDummyImage(lut);
 
         images.push_back(image);
     }
@@ -289,28 +453,115 @@ ImagePtrArray TexLoader::load(std::istream &stream, const TexEntryHeader &texent
             std::cerr<< "Unhandled RecordRle compression type"<< std::endl;
         else //if(texhdr.getCompression() == texhdr.sUncompressed)
         {
-            if(!stream.seekg(texentry.getOffset() + texhdr.getDataOffset()))
-                throw std::runtime_error("Failed to seek to image offset");
+            reader.seek(texentry.getOffset() + texhdr.getDataOffset());
             std::vector<uint32_t> offsets(texhdr.getFrameCount());
             for(uint32_t &offset : offsets)
-                offset = VFS::read_le32(stream);
+                offset = reader.get<uint32_t>();
 
-            for(uint32_t offset : offsets)
+            images.reserve(offsets.size());
+            for(size_t i = 0;i < offsets.size();++i)
             {
-                if(!stream.seekg(texentry.getOffset() + texhdr.getDataOffset() + offset))
-                    throw std::runtime_error("Failed to seek to frame offset");
                 images.push_back(new osg::Image());
-
-                osg::Image *image = images.back();
-                image->allocateImage(texhdr.getWidth(), texhdr.getHeight(), 1,
-                                    GL_RGBA, GL_UNSIGNED_BYTE);
-
-                loadUncompressedMulti(image, palette, stream);
+                allocateImage(images.back(), texhdr.getWidth(), texhdr.getHeight(), !lut);
             }
+
+            size_t base = texentry.getOffset() + texhdr.getDataOffset();
+            loadUncompressedFrames(images, lut, reinterpret_cast<const uint8_t*>(reader.data()+base),
+                                   reader.size()-base, offsets);
         }
 
         if(images.empty())
-            images.push_back(createDummyImage());
+            images.push_back(createDummyImage(lut));
+    }
+
+    return images;
+}
+
+
+ImagePtrArray TexLoader::loadImages(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale,
+                                    const PaletteLUT *lut)
+{
+    VFS::EntryData data;
+    std::shared_ptr<const TexFileHeader> hdr = getFileHeader(idx, data);
+    Misc::ByteReader reader(data.data(), data.size());
+
+    const TexEntryHeader &entryhdr = hdr->getHeaders().at(idx&0x7f);
+    return load(reader, entryhdr, xoffset, yoffset, xscale, yscale, lut);
+}
+
+std::vector<ImagePtrArray> TexLoader::loadFile(size_t idx, const PaletteLUT *lut)
+{
+    VFS::EntryData data;
+    std::shared_ptr<const TexFileHeader> hdr = getFileHeader(idx, data);
+    Misc::ByteReader reader(data.data(), data.size());
+
+    std::vector<ImagePtrArray> allimages;
+    allimages.reserve(hdr->getImageCount());
+
+    int16_t xoffset, yoffset, xscale, yscale;
+    for(const TexEntryHeader &entryhdr : hdr->getHeaders())
+        allimages.push_back(load(reader, entryhdr, &xoffset, &yoffset, &xscale, &yscale, lut));
+
+    return allimages;
+}
+
+std::vector<ImagePtrArray> TexLoader::loadList(const std::vector<size_t> &indices, const PaletteLUT *lut,
+                                               std::vector<TexImageInfo> *info)
+{
+    std::vector<ImagePtrArray> images(indices.size());
+    if(info) info->resize(indices.size());
+    if(indices.empty())
+        return images;
+
+    for(size_t idx : indices)
+    {
+        if((idx>>7) != (indices[0]>>7))
+            throw std::runtime_error("Batched textures must be from the same file");
+    }
+
+    VFS::EntryData data;
+    std::shared_ptr<const TexFileHeader> hdr = getFileHeader(indices[0], data);
+    Misc::ByteReader reader(data.data(), data.size());
+
+    // Load the images in the order they're stored, so the file is read
+    // front to back. Repeated indices sort next to each other, and are only
+    // loaded once.
+    const std::vector<TexEntryHeader> &headers = hdr->getHeaders();
+    std::vector<size_t> order(indices.size());
+    for(size_t i = 0;i < order.size();++i)
+    {
+        if((indices[i]&0x7f) >= headers.size())
+        {
+            std::stringstream sstr;
+            sstr<<"Texture index "<<indices[i]<<" out of range ("<<headers.size()<<" images in file)";
+            throw std::runtime_error(sstr.str());
+        }
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(),
+        [&headers, &indices](size_t lhs, size_t rhs) -> bool
+        {
+            uint32_t loffset = headers[indices[lhs]&0x7f].getOffset();
+            uint32_t roffset = headers[indices[rhs]&0x7f].getOffset();
+            if(loffset != roffset) return loffset < roffset;
+            return indices[lhs] < indices[rhs];
+        }
+    );
+
+    TexImageInfo dummy;
+    for(size_t i = 0;i < order.size();++i)
+    {
+        size_t cur = order[i];
+        TexImageInfo &curinfo = info ? (*info)[cur] : dummy;
+        if(i > 0 && indices[order[i-1]] == indices[cur])
+        {
+            images[cur] = images[order[i-1]];
+            if(info) curinfo = (*info)[order[i-1]];
+            continue;
+        }
+
+        images[cur] = load(reader, headers[indices[cur]&0x7f], &curinfo.mXOffset, &curinfo.mYOffset,
+                           &curinfo.mXScale, &curinfo.mYScale, lut);
     }
 
     return images;
@@ -320,36 +571,90 @@ ImagePtrArray TexLoader::load(std::istream &stream, const TexEntryHeader &texent
 ImagePtrArray TexLoader::load(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale,
                               const Resource::Palette &palette)
 {
-    std::stringstream sstr; sstr.fill('0');
-    sstr<<"TEXTURE."<<std::setw(3)<<(idx>>7);
+    PaletteLUT lut;
+    buildPaletteLUT(palette, lut);
+    return loadImages(idx, xoffset, yoffset, xscale, yscale, &lut);
+}
 
-    VFS::IStreamPtr stream = VFS::Manager::get().open(sstr.str());
+std::vector<ImagePtrArray> TexLoader::loadAll(size_t idx, const Resource::Palette &palette)
+{
+    PaletteLUT lut;
+    buildPaletteLUT(palette, lut);
+    return loadFile(idx, &lut);
+}
 
-    TexFileHeader hdr;
-    hdr.load(*stream);
 
-    const TexEntryHeader &entryhdr = hdr.getHeaders().at(idx&0x7f);
-    return load(*stream, entryhdr, xoffset, yoffset, xscale, yscale, palette);
+ImagePtrArray TexLoader::loadIndexed(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale)
+{
+    return loadImages(idx, xoffset, yoffset, xscale, yscale, nullptr);
 }
 
-std::vector<ImagePtrArray> TexLoader::loadAll(size_t idx, const Resource::Palette &palette)
+std::vector<ImagePtrArray> TexLoader::loadAllIndexed(size_t idx)
 {
-    std::stringstream sstr; sstr.fill('0');
-    sstr<<"TEXTURE."<<std::setw(3)<<(idx>>7);
+    return loadFile(idx, nullptr);
+}
 
-    VFS::IStreamPtr stream = VFS::Manager::get().open(sstr.str());
 
-    TexFileHeader hdr;
-    hdr.load(*stream);
+std::vector<ImagePtrArray> TexLoader::loadBatch(const std::vector<size_t> &indices, const Resource::Palette &palette,
+                                                std::vector<TexImageInfo> *info)
+{
+    PaletteLUT lut;
+    buildPaletteLUT(palette, lut);
+    return loadList(indices, &lut, info);
+}
 
-    std::vector<ImagePtrArray> allimages;
-    allimages.reserve(hdr.getImageCount());
+std::vector<ImagePtrArray> TexLoader::loadBatchIndexed(const std::vector<size_t> &indices,
+                                                       std::vector<TexImageInfo> *info)
+{
+    return loadList(indices, nullptr, info);
+}
 
-    int16_t xoffset, yoffset, xscale, yscale;
-    for(const TexEntryHeader &entryhdr : hdr.getHeaders())
-        allimages.push_back(load(*stream, entryhdr, &xoffset, &yoffset, &xscale, &yscale, palette));
 
-    return allimages;
+size_t TexLoader::getImageCount(size_t idx)
+{
+    VFS::EntryData data;
+    return getFileHeader(idx, data)->getImageCount();
+}
+
+void TexLoader::getImageLayout(size_t idx, size_t *width, size_t *height, size_t *frames, TexImageInfo *info)
+{
+    VFS::EntryData data;
+    std::shared_ptr<const TexFileHeader> hdr = getFileHeader(idx, data);
+    Misc::ByteReader reader(data.data(), data.size());
+
+    const TexEntryHeader &texentry = hdr->getHeaders().at(idx&0x7f);
+    if(info) *info = TexImageInfo{0, 0, 0, 0};
+    if(texentry.getOffset() == 0)
+    {
+        // Solid color
+        *width = *height = *frames = 1;
+        return;
+    }
+
+    reader.seek(texentry.getOffset());
+    TexHeader texhdr;
+    reader.read(texhdr);
+    if(info)
+        *info = TexImageInfo{texhdr.getXOffset(), texhdr.getYOffset(), texhdr.getXScale(), texhdr.getYScale()};
+
+    // This must match what load gives back, including when it falls back to
+    // a dummy image.
+    if(texhdr.getFrameCount() == 0 || texhdr.getCompression() == texhdr.sRleCompressed ||
+       texhdr.getCompression() == texhdr.sImageRle || texhdr.getCompression() == texhdr.sRecordRle)
+    {
+        *width = *height = 2;
+        *frames = 1;
+        return;
+    }
+    *width = texhdr.getWidth();
+    *height = texhdr.getHeight();
+    *frames = texhdr.getFrameCount();
+}
+
+void TexLoader::clearCache()
+{
+    std::lock_guard<std::mutex> lock(gHeaderMutex);
+    gHeaderCache.clear();
 }
 
 } // namespace DFOSG
@@ -7,6 +7,8 @@
 
 #include "components/resource/texturemanager.hpp"
 
+#include "palexpand.hpp"
+
 
 namespace
 {
@@ -18,11 +20,22 @@ namespace osg
     class Image;
 }
 
+namespace Misc
+{
+    class ByteReader;
+}
+
+
 namespace DFOSG
 {
 
 typedef std::vector<osg::ref_ptr<osg::Image>> ImagePtrArray;
 
+struct TexImageInfo {
+    int16_t mXOffset, mYOffset;
+    int16_t mXScale, mYScale;
+};
+
 
 class TexLoader {
     static TexLoader sLoader;
@@ -33,18 +46,28 @@ class TexLoader {
     TexLoader();
     ~TexLoader();
 
-    osg::Image *createDummyImage();
+    /* A null palette LUT means the images keep the 8-bit palette indices,
+     * rather than being expanded to RGBA8.
+     */
+    osg::Image *createDummyImage(const PaletteLUT *lut);
 
-    osg::Image *loadUncompressedSingle(size_t width, size_t height,
-                                       const Resource::Palette &palette,
-                                       std::istream &stream);
-    void loadUncompressedMulti(osg::Image *image, const Resource::Palette &palette,
-                               std::istream &stream);
+    osg::Image *loadUncompressedSingle(size_t width, size_t height, const PaletteLUT *lut,
+                                       Misc::ByteReader &reader);
+    void loadUncompressedMulti(osg::Image *image, const PaletteLUT *lut,
+                               const uint8_t *data, size_t size);
+    void loadUncompressedFrames(ImagePtrArray &images, const PaletteLUT *lut,
+                                const uint8_t *data, size_t size,
+                                const std::vector<uint32_t> &offsets);
 
-    ImagePtrArray load(std::istream &stream, const TexEntryHeader &texentry,
+    ImagePtrArray load(Misc::ByteReader &reader, const TexEntryHeader &texentry,
                        int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale,
-                       const Resource::Palette &palette);
+                       const PaletteLUT *lut);
 
+    ImagePtrArray loadImages(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale,
+                             const PaletteLUT *lut);
+    std::vector<ImagePtrArray> loadFile(size_t idx, const PaletteLUT *lut);
+    std::vector<ImagePtrArray> loadList(const std::vector<size_t> &indices, const PaletteLUT *lut,
+                                        std::vector<TexImageInfo> *info);
 public:
     ImagePtrArray load(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale, const Resource::Palette &palette);
 
@@ -56,6 +79,35 @@ public:
 
     std::vector<ImagePtrArray> loadAll(size_t idx, const Resource::Palette &palette);
 
+    /* Same as load and loadAll, but the images are left as 8-bit palette
+     * indices (GL_RED_INTEGER, with a GL_R8UI internal format), for shaders to
+     * look up in a palette texture. Index 0 is transparent.
+     */
+    ImagePtrArray loadIndexed(size_t idx, int16_t *xoffset, int16_t *yoffset, int16_t *xscale, int16_t *yscale);
+    std::vector<ImagePtrArray> loadAllIndexed(size_t idx);
+
+    /* Loads a list of images, which must all be from the same TEXTURE.???
+     * file, in a single pass over the file. The returned images (and info, if
+     * given) are in the same order as the indices.
+     */
+    std::vector<ImagePtrArray> loadBatch(const std::vector<size_t> &indices, const Resource::Palette &palette,
+                                         std::vector<TexImageInfo> *info=nullptr);
+    std::vector<ImagePtrArray> loadBatchIndexed(const std::vector<size_t> &indices,
+                                                std::vector<TexImageInfo> *info=nullptr);
+
+    /* Returns the number of images in the TEXTURE.??? file. */
+    size_t getImageCount(size_t idx);
+
+    /* Gets the size and number of frames of the images load would return for
+     * the given index (along with their info, if given) without decoding
+     * them.
+     */
+    void getImageLayout(size_t idx, size_t *width, size_t *height, size_t *frames,
+                        TexImageInfo *info=nullptr);
+
+    /* Forgets the cached file headers. */
+    void clearCache();
+
     static TexLoader &get() { return sLoader; }
 };
 
@@ -0,0 +1,537 @@
+
+#include "assetpack.hpp"
+
+#include <stdexcept>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "components/vfs/manager.hpp"
+#include "components/dfosg/meshopt.hpp"
+#include "misc/record.hpp"
+
+
+namespace
+{
+
+const char PackMagic[4] = { 'D', 'F', 'P', 'K' };
+
+// Entries are aligned so their contents can be used directly from the mapping.
+const size_t PackAlignment = 16;
+
+class PackHeader {
+public:
+    char mMagic[4];
+    uint32_t mVersion;
+    uint32_t mEntryCount;
+    uint32_t mFlags;
+    uint64_t mTableOffset;
+
+    typedef Misc::Record<
+        RECORD_FIELD(PackHeader, mMagic),
+        RECORD_FIELD(PackHeader, mVersion),
+        RECORD_FIELD(PackHeader, mEntryCount),
+        RECORD_FIELD(PackHeader, mFlags),
+        RECORD_FIELD(PackHeader, mTableOffset)
+    > Schema;
+};
+static_assert(PackHeader::Schema::size() == 24, "Unexpected PackHeader size");
+
+class PackEntry {
+public:
+    uint32_t mType;
+    uint32_t mId;
+    uint64_t mOffset;
+    uint32_t mSize;
+    uint32_t mRawSize;
+    uint32_t mCompression;
+    uint32_t mSourceSize;
+
+    typedef Misc::Record<
+        RECORD_FIELD(PackEntry, mType),
+        RECORD_FIELD(PackEntry, mId),
+        RECORD_FIELD(PackEntry, mOffset),
+        RECORD_FIELD(PackEntry, mSize),
+        RECORD_FIELD(PackEntry, mRawSize),
+        RECORD_FIELD(PackEntry, mCompression),
+        RECORD_FIELD(PackEntry, mSourceSize)
+    > Schema;
+};
+static_assert(PackEntry::Schema::size() == 32, "Unexpected PackEntry size");
+
+class PackMeshGroup {
+public:
+    uint16_t mTextureId;
+    uint16_t mIndexSize; // Bytes per index. 0 is from older packs, meaning 2.
+    uint32_t mVertexCount;
+    uint32_t mIndexCount;
+
+    typedef Misc::Record<
+        RECORD_FIELD(PackMeshGroup, mTextureId),
+        RECORD_FIELD(PackMeshGroup, mIndexSize),
+        RECORD_FIELD(PackMeshGroup, mVertexCount),
+        RECORD_FIELD(PackMeshGroup, mIndexCount)
+    > Schema;
+};
+static_assert(PackMeshGroup::Schema::size() == 12, "Unexpected PackMeshGroup size");
+
+typedef Misc::Record<
+    RECORD_FIELD(Resource::PackedTexture, mXOffset),
+    RECORD_FIELD(Resource::PackedTexture, mYOffset),
+    RECORD_FIELD(Resource::PackedTexture, mXScale),
+    RECORD_FIELD(Resource::PackedTexture, mYScale),
+    RECORD_FIELD(Resource::PackedTexture, mWidth),
+    RECORD_FIELD(Resource::PackedTexture, mHeight),
+    RECORD_FIELD(Resource::PackedTexture, mFrameCount)
+> PackedTextureSchema;
+static_assert(PackedTextureSchema::size() == 16, "Unexpected PackedTexture size");
+
+// The header, followed by the palette, padded to the entry alignment.
+const size_t PackHeaderSize = (PackHeader::Schema::size() + sizeof(Resource::Palette) +
+                               PackAlignment-1) & ~(PackAlignment-1);
+
+
+size_t makeKey(Resource::AssetPack::EntryType type, size_t id)
+{
+    return (id<<3) | type;
+}
+
+Resource::AssetPack::EntryType getCompressedType(DFOSG::BlockFormat format)
+{
+    return (format == DFOSG::Block_BC1) ? Resource::AssetPack::Type_TextureBC1 :
+                                          Resource::AssetPack::Type_TextureBC3;
+}
+
+std::string getTextureFileName(size_t idx)
+{
+    std::stringstream sstr; sstr.fill('0');
+    sstr<<"TEXTURE."<<std::setw(3)<<(idx>>7);
+    return sstr.str();
+}
+
+
+template<typename T>
+void putLE(std::vector<char> &buf, T val)
+{
+    typedef typename std::make_unsigned<T>::type UT;
+    UT uval = static_cast<UT>(val);
+    for(size_t i = 0;i < sizeof(T);++i)
+        buf.push_back(static_cast<char>((uval >> (i*8)) & 0xff));
+}
+
+template<typename T>
+void putArray(std::vector<char> &buf, const std::vector<T> &arr)
+{
+    const char *src = reinterpret_cast<const char*>(arr.data());
+    buf.insert(buf.end(), src, src + arr.size()*sizeof(T));
+}
+
+template<typename T>
+void getArray(Misc::ByteReader &reader, std::vector<T> &arr, size_t count)
+{
+    if(count > reader.remaining() / sizeof(T))
+        throw std::runtime_error("Attempted to read past the end of data");
+    arr.resize(count);
+    reader.read(arr.data(), count*sizeof(T));
+}
+
+/* Reads count indices of the given size (1, 2 or 4 bytes), widening them. */
+void getIndices(Misc::ByteReader &reader, std::vector<uint32_t> &indices, size_t count, size_t size)
+{
+    if(size == 4)
+    {
+        getArray(reader, indices, count);
+        return;
+    }
+    if(size != 1 && size != 2)
+        throw std::runtime_error("Invalid mesh index size "+std::to_string(size));
+    if(count > reader.remaining() / size)
+        throw std::runtime_error("Attempted to read past the end of data");
+
+    indices.resize(count);
+    for(uint32_t &idx : indices)
+        idx = (size == 1) ? reader.get<uint8_t>() : reader.get<uint16_t>();
+}
+
+/* Writes the indices with the given size (1, 2 or 4 bytes). */
+void putIndices(std::vector<char> &buf, const std::vector<uint32_t> &indices, size_t size)
+{
+    for(uint32_t idx : indices)
+    {
+        if(size == 1)
+            putLE<uint8_t>(buf, idx);
+        else if(size == 2)
+            putLE<uint16_t>(buf, idx);
+        else
+            putLE<uint32_t>(buf, idx);
+    }
+}
+
+void padTo(std::vector<char> &buf, size_t align)
+{
+    buf.resize((buf.size()+align-1) & ~(align-1), 0);
+}
+
+}
+
+
+namespace Resource
+{
+
+AssetPack AssetPack::sPack;
+
+AssetPack::AssetPack()
+{
+}
+
+AssetPack::~AssetPack()
+{
+}
+
+
+bool AssetPack::open(const std::string &fname)
+{
+    close();
+
+    // The vertex and pixel data is stored as little-endian, to be used as-is.
+    if(!Misc::IsLittleEndian)
+        return false;
+    if(!mFile.map(fname))
+        return false;
+
+    try {
+        Misc::ByteReader reader(mFile.data(), mFile.size());
+
+        PackHeader hdr;
+        reader.read(hdr);
+        if(memcmp(hdr.mMagic, PackMagic, sizeof(PackMagic)) != 0)
+            throw std::runtime_error(fname+" is not an asset pack");
+        if(hdr.mVersion != sVersion)
+        {
+            std::stringstream sstr;
+            sstr<< fname<<" is asset pack version "<<hdr.mVersion<<", expected "<<sVersion;
+            throw std::runtime_error(sstr.str());
+        }
+        reader.read(mPalette.data(), sizeof(mPalette));
+
+        reader.seek(hdr.mTableOffset);
+        mEntries.reserve(hdr.mEntryCount);
+        for(uint32_t i = 0;i < hdr.mEntryCount;++i)
+        {
+            PackEntry pentry;
+            reader.read(pentry);
+            if(pentry.mOffset > mFile.size() || pentry.mSize > mFile.size()-pentry.mOffset)
+                throw std::runtime_error(fname+" has an entry past the end of the file");
+            if(pentry.mCompression == Compress_None && pentry.mSize != pentry.mRawSize)
+                throw std::runtime_error(fname+" has an entry with a mismatched size");
+
+            Entry entry{pentry.mOffset, pentry.mSize, pentry.mRawSize, pentry.mCompression,
+                        pentry.mSourceSize, 0};
+            mEntries.insert(makeKey(static_cast<EntryType>(pentry.mType), pentry.mId), entry);
+        }
+    }
+    catch(...) {
+        close();
+        throw;
+    }
+
+    mName = fname;
+    return true;
+}
+
+void AssetPack::close()
+{
+    mEntries.clear();
+    mFile.unmap();
+    mName.clear();
+}
+
+
+Archives::EntryData AssetPack::getData(EntryType type, size_t id)
+{
+    Entry *entry = mEntries.find(makeKey(type, id));
+    if(!entry) return Archives::EntryData();
+
+    int state;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        state = entry->mSourceState;
+    }
+    if(state == 0)
+    {
+        /* Make sure the entry was made from the data we'd otherwise load. A
+         * mismatch means the game data was changed (e.g. patched or modded)
+         * since the pack was made.
+         */
+        VFS::EntryData source;
+        if(type == Type_Mesh)
+            source = VFS::Manager::get().readArchId(id);
+        else
+            source = VFS::Manager::get().readAll(getTextureFileName(id));
+        state = (source && source.size() == entry->mSourceSize) ? 1 : -1;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        entry->mSourceState = state;
+    }
+    if(state < 0)
+        return Archives::EntryData();
+
+    const char *src = mFile.data() + entry->mOffset;
+    if(entry->mCompression == Compress_None)
+        return Archives::EntryData(Archives::EntryView(src, entry->mSize));
+#ifdef HAVE_LZ4
+    if(entry->mCompression == Compress_LZ4)
+    {
+        std::shared_ptr<std::vector<char>> data(new std::vector<char>(entry->mRawSize));
+        int ret = LZ4_decompress_safe(src, data->data(), entry->mSize, entry->mRawSize);
+        if(ret < 0 || uint32_t(ret) != entry->mRawSize)
+            throw std::runtime_error("Failed to decompress asset pack entry from "+mName);
+        return Archives::EntryData(std::move(data));
+    }
+#endif
+    // Unknown compression, or not built with it. Load the original instead.
+    return Archives::EntryData();
+}
+
+
+bool AssetPack::loadMesh(size_t id, std::vector<DFOSG::MeshGroup> &groups)
+{
+    if(!isOpen()) return false;
+
+    Archives::EntryData data = getData(Type_Mesh, id);
+    if(!data) return false;
+
+    Misc::ByteReader reader(data.data(), data.size());
+    size_t numgroups = reader.get<uint32_t>();
+    if(numgroups > reader.remaining()/PackMeshGroup::Schema::size())
+        throw std::runtime_error("Invalid mesh entry in "+mName);
+    std::vector<PackMeshGroup> hdrs(numgroups);
+    reader.readArray(hdrs.data(), hdrs.size());
+
+    groups.resize(hdrs.size());
+    for(size_t i = 0;i < hdrs.size();++i)
+    {
+        DFOSG::MeshGroup &group = groups[i];
+        size_t count = hdrs[i].mVertexCount;
+
+        group.mTextureId = hdrs[i].mTextureId;
+        getArray(reader, group.mPositions, count*3);
+        getArray(reader, group.mNormals, count*3);
+        getArray(reader, group.mBinormals, count*3);
+        getArray(reader, group.mTexCoords, count*2);
+        size_t indexsize = hdrs[i].mIndexSize ? hdrs[i].mIndexSize : 2;
+        getIndices(reader, group.mIndices, hdrs[i].mIndexCount, indexsize);
+        for(uint32_t idx : group.mIndices)
+        {
+            if(idx >= count)
+                throw std::runtime_error("Invalid mesh index in "+mName);
+        }
+        // Each group is padded to 4 bytes.
+        size_t pad = (4 - (hdrs[i].mIndexCount*indexsize)%4) % 4;
+        reader.skip(pad);
+    }
+
+    return true;
+}
+
+bool AssetPack::loadTexture(size_t idx, const Palette &palette, PackedTexture &tex)
+{
+    if(!isOpen()) return false;
+    if(memcmp(palette.data(), mPalette.data(), sizeof(mPalette)) != 0)
+        return false;
+
+    Archives::EntryData data = getData(Type_Texture, idx);
+    if(!data) return false;
+
+    Misc::ByteReader reader(data.data(), data.size());
+    reader.read<PackedTextureSchema>(tex);
+    reader.seek((reader.tell()+PackAlignment-1) & ~(PackAlignment-1));
+    tex.mFormat = 0;
+    tex.mMipCount = 1;
+    if(tex.mFrameCount == 0 || tex.getFrameSize() == 0 ||
+       reader.remaining()/tex.getFrameSize() < tex.mFrameCount)
+        throw std::runtime_error("Invalid texture entry in "+mName);
+
+    tex.mPixels = reinterpret_cast<const unsigned char*>(data.data() + reader.tell());
+    tex.mData = data;
+    return true;
+}
+
+
+bool AssetPack::loadCompressedTexture(size_t idx, const Palette &palette, DFOSG::BlockFormat format,
+                                      PackedTexture &tex)
+{
+    if(!isOpen()) return false;
+    if(memcmp(palette.data(), mPalette.data(), sizeof(mPalette)) != 0)
+        return false;
+
+    Archives::EntryData data = getData(getCompressedType(format), idx);
+    if(!data) return false;
+
+    Misc::ByteReader reader(data.data(), data.size());
+    reader.read<PackedTextureSchema>(tex);
+    tex.mFormat = reader.get<uint32_t>();
+    tex.mMipCount = reader.get<uint32_t>();
+    reader.seek((reader.tell()+PackAlignment-1) & ~(PackAlignment-1));
+    // Packs from before each format had its own type may have either here.
+    if(tex.mFormat != uint32_t(format))
+        return false;
+    if(tex.mMipCount == 0 || tex.mMipCount > DFOSG::getMipCount(tex.mWidth, tex.mHeight) ||
+       tex.mFrameCount == 0 || tex.getFrameSize() == 0 ||
+       reader.remaining()/tex.getFrameSize() < tex.mFrameCount)
+        throw std::runtime_error("Invalid compressed texture entry in "+mName);
+
+    tex.mPixels = reinterpret_cast<const unsigned char*>(data.data() + reader.tell());
+    tex.mData = data;
+    return true;
+}
+
+bool AssetPack::canCompress()
+{
+#ifdef HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+AssetPackWriter::AssetPackWriter(const std::string &fname, const Palette &palette, bool compress)
+  : mCompress(compress), mRawBytes(0), mStoredBytes(0)
+{
+    if(!Misc::IsLittleEndian)
+        throw std::runtime_error("Asset packs can only be written on little-endian systems");
+    if(mCompress && !AssetPack::canCompress())
+        throw std::runtime_error("Not built with LZ4 support");
+
+    mFile.open(fname.c_str(), std::ios_base::binary);
+    if(!mFile.is_open())
+        throw std::runtime_error("Failed to create "+fname);
+
+    // The entry count and table offset are filled in by finish().
+    std::vector<char> hdr(PackMagic, PackMagic+sizeof(PackMagic));
+    putLE<uint32_t>(hdr, AssetPack::sVersion);
+    putLE<uint32_t>(hdr, 0);
+    putLE<uint32_t>(hdr, 0);
+    putLE<uint64_t>(hdr, 0);
+    const char *pal = reinterpret_cast<const char*>(palette.data());
+    hdr.insert(hdr.end(), pal, pal+sizeof(palette));
+    padTo(hdr, PackAlignment);
+
+    mFile.write(hdr.data(), hdr.size());
+}
+
+
+void AssetPackWriter::add(AssetPack::EntryType type, size_t id, uint32_t srcsize, const std::vector<char> &data)
+{
+    Entry entry{uint32_t(type), uint32_t(id), uint64_t(mFile.tellp()), uint32_t(data.size()),
+                uint32_t(data.size()), AssetPack::Compress_None, srcsize};
+
+    const std::vector<char> *out = &data;
+#ifdef HAVE_LZ4
+    std::vector<char> compressed;
+    if(mCompress)
+    {
+        compressed.resize(LZ4_compressBound(data.size()));
+        int ret = LZ4_compress_default(data.data(), compressed.data(), data.size(), compressed.size());
+        if(ret > 0 && size_t(ret) < data.size())
+        {
+            compressed.resize(ret);
+            entry.mSize = ret;
+            entry.mCompression = AssetPack::Compress_LZ4;
+            out = &compressed;
+        }
+    }
+#endif
+
+    std::vector<char> padded(*out);
+    padTo(padded, PackAlignment);
+    if(!mFile.write(padded.data(), padded.size()))
+        throw std::runtime_error("Failed to write asset pack entry");
+
+    mRawBytes += entry.mRawSize;
+    mStoredBytes += entry.mSize;
+    mEntries.push_back(entry);
+}
+
+void AssetPackWriter::addMesh(size_t id, uint32_t srcsize, const std::vector<DFOSG::MeshGroup> &groups)
+{
+    std::vector<char> data;
+    putLE<uint32_t>(data, groups.size());
+    for(const DFOSG::MeshGroup &group : groups)
+    {
+        putLE<uint16_t>(data, group.mTextureId);
+        putLE<uint16_t>(data, DFOSG::getIndexSize(group.getVertexCount()));
+        putLE<uint32_t>(data, group.getVertexCount());
+        putLE<uint32_t>(data, group.mIndices.size());
+    }
+    for(const DFOSG::MeshGroup &group : groups)
+    {
+        putArray(data, group.mPositions);
+        putArray(data, group.mNormals);
+        putArray(data, group.mBinormals);
+        putArray(data, group.mTexCoords);
+        putIndices(data, group.mIndices, DFOSG::getIndexSize(group.getVertexCount()));
+        padTo(data, 4);
+    }
+    add(AssetPack::Type_Mesh, id, srcsize, data);
+}
+
+void AssetPackWriter::addTexture(size_t idx, uint32_t srcsize, const PackedTexture &tex)
+{
+    std::vector<char> data;
+    putLE<int16_t>(data, tex.mXOffset);
+    putLE<int16_t>(data, tex.mYOffset);
+    putLE<int16_t>(data, tex.mXScale);
+    putLE<int16_t>(data, tex.mYScale);
+    putLE<uint16_t>(data, tex.mWidth);
+    putLE<uint16_t>(data, tex.mHeight);
+    putLE<uint32_t>(data, tex.mFrameCount);
+    if(tex.mFormat != 0)
+    {
+        putLE<uint32_t>(data, tex.mFormat);
+        putLE<uint32_t>(data, tex.mMipCount);
+    }
+    padTo(data, PackAlignment);
+
+    const char *pixels = reinterpret_cast<const char*>(tex.mPixels);
+    data.insert(data.end(), pixels, pixels + tex.getFrameSize()*tex.mFrameCount);
+    add((tex.mFormat != 0) ? getCompressedType(static_cast<DFOSG::BlockFormat>(tex.mFormat)) :
+                             AssetPack::Type_Texture,
+        idx, srcsize, data);
+}
+
+
+void AssetPackWriter::finish()
+{
+    std::vector<char> table;
+    for(const Entry &entry : mEntries)
+    {
+        putLE<uint32_t>(table, entry.mType);
+        putLE<uint32_t>(table, entry.mId);
+        putLE<uint64_t>(table, entry.mOffset);
+        putLE<uint32_t>(table, entry.mSize);
+        putLE<uint32_t>(table, entry.mRawSize);
+        putLE<uint32_t>(table, entry.mCompression);
+        putLE<uint32_t>(table, entry.mSourceSize);
+    }
+    uint64_t table_offset = mFile.tellp();
+    mFile.write(table.data(), table.size());
+
+    std::vector<char> hdr;
+    putLE<uint32_t>(hdr, mEntries.size());
+    putLE<uint32_t>(hdr, 0);
+    putLE<uint64_t>(hdr, table_offset);
+    mFile.seekp(8);
+    mFile.write(hdr.data(), hdr.size());
+
+    mFile.close();
+    if(mFile.fail())
+        throw std::runtime_error("Failed to write asset pack");
+}
+
+} // namespace Resource
@@ -0,0 +1,190 @@
+#ifndef COMPONENTS_RESOURCE_ASSETPACK_HPP
+#define COMPONENTS_RESOURCE_ASSETPACK_HPP
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+
+#include "components/archives/archive.hpp"
+#include "components/dfosg/meshloader.hpp"
+#include "components/dfosg/texcompress.hpp"
+#include "misc/flathashmap.hpp"
+
+#include "texturemanager.hpp"
+
+
+namespace Resource
+{
+
+/* A texture image from the pack, already expanded to RGBA8 or compressed to
+ * a DFOSG::BlockFormat with all its mipmaps. The pixels of each frame follow
+ * one another, and stay valid as long as mData is held.
+ */
+struct PackedTexture {
+    int16_t mXOffset, mYOffset;
+    int16_t mXScale, mYScale;
+    uint16_t mWidth, mHeight;
+    uint32_t mFrameCount;
+
+    // 0 for RGBA8, otherwise a DFOSG::BlockFormat
+    uint32_t mFormat;
+    uint32_t mMipCount;
+
+    const unsigned char *mPixels;
+    Archives::EntryData mData;
+
+    PackedTexture() : mFormat(0), mMipCount(1), mPixels(nullptr) { }
+
+    size_t getFrameSize() const
+    {
+        if(mFormat == 0)
+            return size_t(mWidth) * mHeight * 4;
+
+        DFOSG::BlockFormat format = static_cast<DFOSG::BlockFormat>(mFormat);
+        size_t size = 0;
+        for(size_t i = 0, w = mWidth, h = mHeight;i < mMipCount;++i)
+        {
+            size += DFOSG::getCompressedSize(format, w, h);
+            w = std::max<size_t>(w/2, 1);
+            h = std::max<size_t>(h/2, 1);
+        }
+        return size;
+    }
+};
+
+
+/* A pack of game data that has been converted ahead of time (see dfpack), so
+ * it can be used without parsing or decoding the original files. The pack is
+ * memory-mapped, and each entry records the size of the file it came from;
+ * entries whose source no longer matches are ignored, so the caller falls
+ * back to loading the original data.
+ */
+class AssetPack {
+public:
+    enum EntryType {
+        Type_Mesh = 1,
+        Type_Texture = 2,
+        // Block-compressed textures, with one type per format so a pack can
+        // hold each.
+        Type_TextureBC1 = 3,
+        Type_TextureBC3 = 4
+    };
+
+    enum Compression {
+        Compress_None = 0,
+        Compress_LZ4 = 1
+    };
+
+    static const uint32_t sVersion = 1;
+
+private:
+    static AssetPack sPack;
+
+    struct Entry {
+        uint64_t mOffset;
+        uint32_t mSize;
+        uint32_t mRawSize;
+        uint32_t mCompression;
+        uint32_t mSourceSize;
+
+        // 0 = not yet checked, 1 = source matches, -1 = source changed
+        int mSourceState;
+    };
+
+    Archives::MappedFile mFile;
+    std::string mName;
+    Palette mPalette;
+    Misc::FlatHashMap<size_t,Entry> mEntries;
+
+    std::mutex mMutex;
+
+    AssetPack(const AssetPack&) = delete;
+    AssetPack& operator=(const AssetPack&) = delete;
+
+    AssetPack();
+    ~AssetPack();
+
+    Archives::EntryData getData(EntryType type, size_t id);
+
+public:
+    /* Opens the given pack. Returns false if it doesn't exist or isn't a
+     * valid pack of this version.
+     */
+    bool open(const std::string &fname);
+    void close();
+
+    bool isOpen() const { return mFile.isMapped(); }
+    const std::string &getName() const { return mName; }
+    size_t getEntryCount() const { return mEntries.size(); }
+
+    /* Loads the given ARCH3D mesh's triangles. Returns false if it's not in
+     * the pack.
+     */
+    bool loadMesh(size_t id, std::vector<DFOSG::MeshGroup> &groups);
+
+    /* Loads the given texture (see TextureManager::getTexture), as decoded
+     * with the given palette. Returns false if it's not in the pack, or the
+     * pack was made with a different palette.
+     */
+    bool loadTexture(size_t idx, const Palette &palette, PackedTexture &tex);
+    /* Same as loadTexture, but for a texture compressed to the given format
+     * (with mipmaps). Returns false if it's not in the pack in that format.
+     */
+    bool loadCompressedTexture(size_t idx, const Palette &palette, DFOSG::BlockFormat format,
+                               PackedTexture &tex);
+
+    static bool canCompress();
+
+    static AssetPack &get() { return sPack; }
+};
+
+
+/* Writes a new asset pack. Entries are written as they're added, and the
+ * entry table is written by finish().
+ */
+class AssetPackWriter {
+    struct Entry {
+        uint32_t mType;
+        uint32_t mId;
+        uint64_t mOffset;
+        uint32_t mSize;
+        uint32_t mRawSize;
+        uint32_t mCompression;
+        uint32_t mSourceSize;
+    };
+
+    std::ofstream mFile;
+    std::vector<Entry> mEntries;
+    bool mCompress;
+
+    uint64_t mRawBytes;
+    uint64_t mStoredBytes;
+
+    void add(AssetPack::EntryType type, size_t id, uint32_t srcsize, const std::vector<char> &data);
+
+public:
+    /* Creates the pack file. If compress is true, entries are LZ4-compressed
+     * when it makes them smaller.
+     */
+    AssetPackWriter(const std::string &fname, const Palette &palette, bool compress);
+
+    void addMesh(size_t id, uint32_t srcsize, const std::vector<DFOSG::MeshGroup> &groups);
+    /* Adds a texture. Compressed textures (with a non-0 mFormat) are stored
+     * separately for each format, so a pack can have every kind for the same
+     * texture.
+     */
+    void addTexture(size_t idx, uint32_t srcsize, const PackedTexture &tex);
+
+    void finish();
+
+    size_t getEntryCount() const { return mEntries.size(); }
+    uint64_t getRawBytes() const { return mRawBytes; }
+    uint64_t getStoredBytes() const { return mStoredBytes; }
+};
+
+} // namespace Resource
+
+#endif /* COMPONENTS_RESOURCE_ASSETPACK_HPP */
@@ -1,6 +1,10 @@
 
 #include "meshmanager.hpp"
 
+#include <memory>
+#include <string>
+#include <cstring>
+
 #include <osg/Node>
 #include <osg/MatrixTransform>
 #include <osg/Billboard>
@@ -10,8 +14,45 @@
 #include <osgDB/ReadFile>
 
 #include "components/dfosg/meshloader.hpp"
+#include "components/dfosg/meshopt.hpp"
 
 #include "texturemanager.hpp"
+#include "assetpack.hpp"
+#include "resourcecache.hpp"
+
+
+namespace
+{
+
+/* Reads a shader file, defining PALETTE_INDEXED in it when textures are
+ * loaded as palette indices.
+ */
+osg::ref_ptr<osg::Shader> readShader(osg::Shader::Type type, const std::string &fname)
+{
+    osg::ref_ptr<osg::Shader> shader = osgDB::readShaderFile(type, fname);
+    if(shader && Resource::TextureManager::get().isIndexed())
+    {
+        // The define has to come after the #version line.
+        std::string source = shader->getShaderSource();
+        size_t pos = source.find("#version");
+        pos = (pos == std::string::npos) ? 0 : source.find('\n', pos);
+        pos = (pos == std::string::npos) ? source.length() : pos+1;
+        source.insert(pos, "#define PALETTE_INDEXED\n");
+        shader->setShaderSource(source);
+    }
+    return shader;
+}
+
+/* Binds the palette texture to unit 2 for shaders using indexed textures. */
+void setupPalette(osg::StateSet *ss)
+{
+    if(!Resource::TextureManager::get().isIndexed())
+        return;
+    ss->setTextureAttribute(2, Resource::TextureManager::get().getPaletteTexture());
+    ss->addUniform(new osg::Uniform("paletteTex", 2));
+}
+
+} // namespace
 
 
 namespace Resource
@@ -20,6 +61,7 @@ namespace Resource
 MeshManager MeshManager::sManager;
 
 MeshManager::MeshManager()
+  : mOptimize(true)
 {
 }
 
@@ -34,6 +76,7 @@ void MeshManager::initialize()
 
 void MeshManager::deinitialize()
 {
+    ResourceCache::get().clear();
     mStateSetCache.clear();
     mTerrainCache.clear();
     mFlatCache.clear();
@@ -55,76 +98,85 @@ osg::ref_ptr<osg::Node> MeshManager::get(size_t idx)
     {
         osg::ref_ptr<osg::Node> node;
         if(iter->second.lock(node))
+        {
+            ResourceCache::get().touch(ResourceCache::Type_Model, idx);
             return node;
+        }
     }
 
     if(!mModelProgram)
     {
         mModelProgram = new osg::Program();
-        mModelProgram->addShader(osgDB::readShaderFile(osg::Shader::VERTEX, "shaders/object.vert"));
-        mModelProgram->addShader(osgDB::readShaderFile(osg::Shader::FRAGMENT, "shaders/object.frag"));
+        mModelProgram->addShader(readShader(osg::Shader::VERTEX, "shaders/object.vert"));
+        mModelProgram->addShader(readShader(osg::Shader::FRAGMENT, "shaders/object.frag"));
     }
 
-    DFOSG::Mesh *mesh = DFOSG::MeshLoader::get().load(idx);
+    std::vector<DFOSG::MeshGroup> groups;
+    if(!AssetPack::get().loadMesh(idx, groups))
+    {
+        std::unique_ptr<DFOSG::Mesh> mesh(DFOSG::MeshLoader::get().load(idx));
+        DFOSG::buildMeshGroups(*mesh, groups);
+        if(mOptimize)
+            DFOSG::optimizeMeshGroups(groups);
+    }
+
+    // Load all the textures first, so images from the same file are loaded
+    // together.
+    std::vector<size_t> texids;
+    texids.reserve(groups.size());
+    for(const DFOSG::MeshGroup &group : groups)
+        texids.push_back(group.mTextureId);
+    std::vector<osg::ref_ptr<osg::Texture>> textures = TextureManager::get().getTextures(texids);
 
     osg::ref_ptr<osg::Geode> geode(new osg::Geode());
-    for(auto iter = mesh->getPlanes().begin();iter != mesh->getPlanes().end();)
+    size_t memsize = 0;
+    for(size_t g = 0;g < groups.size();++g)
     {
-        osg::ref_ptr<osg::Vec3Array> vtxs(new osg::Vec3Array());
-        osg::ref_ptr<osg::Vec3Array> nrms(new osg::Vec3Array());
-        osg::ref_ptr<osg::Vec3Array> binrms(new osg::Vec3Array());
-        osg::ref_ptr<osg::Vec2Array> texcrds(new osg::Vec2Array());
-        osg::ref_ptr<osg::Vec4ubArray> colors(new osg::Vec4ubArray());
-        osg::ref_ptr<osg::DrawElementsUShort> idxs(new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES));
-        uint16_t texid = iter->getTextureId();
-
-        osg::ref_ptr<osg::Texture> tex = TextureManager::get().getTexture(texid);
+        static_assert(sizeof(osg::Vec3) == sizeof(float)*3, "osg::Vec3 is not 3 floats");
+        const DFOSG::MeshGroup &group = groups[g];
+        size_t count = group.getVertexCount();
+        uint16_t texid = group.mTextureId;
+
+        osg::ref_ptr<osg::Texture> tex = textures[g];
         float width = tex->getTextureWidth();
         float height = tex->getTextureHeight();
 
-        do {
-            const std::vector<DFOSG::MdlPlanePoint> &pts = iter->getPoints();
-            size_t last_total = vtxs->size();
-
-            vtxs->resize(last_total + pts.size());
-            nrms->resize(last_total + pts.size());
-            binrms->resize(last_total + pts.size());
-            texcrds->resize(last_total + pts.size());
-            colors->resize(last_total + pts.size());
-            idxs->resize((last_total + pts.size() - 2) * 3);
-
-            size_t j = last_total;
-            for(const DFOSG::MdlPlanePoint &pt : pts)
-            {
-                uint32_t vidx = pt.getIndex();
-
-                (*vtxs)[j].x() = mesh->getPoints()[vidx].x() / 256.0f;
-                (*vtxs)[j].y() = mesh->getPoints()[vidx].y() / 256.0f;
-                (*vtxs)[j].z() = mesh->getPoints()[vidx].z() / 256.0f;
-
-                (*nrms)[j].x() = iter->getNormal().x() / 256.0f;
-                (*nrms)[j].y() = iter->getNormal().y() / 256.0f;
-                (*nrms)[j].z() = iter->getNormal().z() / 256.0f;
-
-                (*binrms)[j].x() = iter->getBinormal().x() / 256.0f;
-                (*binrms)[j].y() = iter->getBinormal().y() / 256.0f;
-                (*binrms)[j].z() = iter->getBinormal().z() / 256.0f;
-
-                (*texcrds)[j].x() = pt.u() / width;
-                (*texcrds)[j].y() = pt.v() / height;
-
-                (*colors)[j] = osg::Vec4ub(255, 255, 255, 255);
-
-                if(j >= last_total+2)
-                {
-                    (*idxs)[(j-2)*3 + 0] = last_total;
-                    (*idxs)[(j-2)*3 + 1] = j-1;
-                    (*idxs)[(j-2)*3 + 2] = j;
-                }
-
-                ++j;
-            }
-        } while(++iter != mesh->getPlanes().end() && iter->getTextureId() == texid);
+        osg::ref_ptr<osg::Vec3Array> vtxs(new osg::Vec3Array(count));
+        osg::ref_ptr<osg::Vec3Array> nrms(new osg::Vec3Array(count));
+        osg::ref_ptr<osg::Vec3Array> binrms(new osg::Vec3Array(count));
+        osg::ref_ptr<osg::Vec2Array> texcrds(new osg::Vec2Array(count));
+        osg::ref_ptr<osg::Vec4ubArray> colors(new osg::Vec4ubArray(count));
+        if(count > 0)
+        {
+            memcpy(&(*vtxs)[0], group.mPositions.data(), count*sizeof(osg::Vec3));
+            memcpy(&(*nrms)[0], group.mNormals.data(), count*sizeof(osg::Vec3));
+            memcpy(&(*binrms)[0], group.mBinormals.data(), count*sizeof(osg::Vec3));
+        }
+        for(size_t j = 0;j < count;++j)
+        {
+            (*texcrds)[j].x() = group.mTexCoords[j*2 + 0] / width;
+            (*texcrds)[j].y() = group.mTexCoords[j*2 + 1] / height;
+            (*colors)[j] = osg::Vec4ub(255, 255, 255, 255);
+        }
+        // Use the smallest index type the vertices fit in.
+        osg::ref_ptr<osg::DrawElements> idxs;
+        switch(DFOSG::getIndexSize(count))
+        {
+            case 1:
+                idxs = new osg::DrawElementsUByte(osg::PrimitiveSet::TRIANGLES,
+                                                  group.mIndices.begin(), group.mIndices.end());
+                break;
+            case 2:
+                idxs = new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES,
+                                                   group.mIndices.begin(), group.mIndices.end());
+                break;
+            default:
+                idxs = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES,
+                                                 group.mIndices.begin(), group.mIndices.end());
+                break;
+        }
+        memsize += vtxs->getTotalDataSize() + nrms->getTotalDataSize() + binrms->getTotalDataSize() +
+                   texcrds->getTotalDataSize() + colors->getTotalDataSize() + idxs->getTotalDataSize();
 
         osg::ref_ptr<osg::VertexBufferObject> vbo(new osg::VertexBufferObject());
         vtxs->setVertexBufferObject(vbo);
@@ -161,6 +213,7 @@ osg::ref_ptr<osg::Node> MeshManager::get(size_t idx)
             ss->setAttributeAndModes(mModelProgram);
             ss->addUniform(new osg::Uniform("diffuseTex", 0));
             ss->setTextureAttribute(0, tex);
+            setupPalette(ss);
             stateiter = ss;
         }
 
@@ -168,9 +221,22 @@ osg::ref_ptr<osg::Node> MeshManager::get(size_t idx)
     }
 
     mModelCache[idx] = osg::ref_ptr<osg::Node>(geode);
+    ResourceCache::get().insert(ResourceCache::Type_Model, idx, geode.get(), memsize);
     return geode;
 }
 
+std::vector<size_t> MeshManager::getLoadedModels() const
+{
+    std::vector<size_t> ids;
+    for(const auto &model : mModelCache)
+    {
+        osg::ref_ptr<osg::Node> node;
+        if(model.second.lock(node))
+            ids.push_back(model.first);
+    }
+    return ids;
+}
+
 osg::ref_ptr<osg::Node> MeshManager::loadFlat(size_t texid, bool centered, size_t *num_frames)
 {
     auto iter = mFlatCache.find(std::make_pair(texid, centered));
@@ -179,6 +245,7 @@ osg::ref_ptr<osg::Node> MeshManager::loadFlat(size_t texid, bool centered, size_
         osg::ref_ptr<osg::Node> node;
         if(iter->second.lock(node))
         {
+            ResourceCache::get().touch(ResourceCache::Type_Flat, texid*2 + centered);
             if(num_frames)
             {
                 osg::ref_ptr<osg::Texture> tex = TextureManager::get().getTexture(texid);
@@ -191,8 +258,8 @@ osg::ref_ptr<osg::Node> MeshManager::loadFlat(size_t texid, bool centered, size_
     if(!mFlatProgram)
     {
         mFlatProgram = new osg::Program();
-        mFlatProgram->addShader(osgDB::readShaderFile(osg::Shader::VERTEX, "shaders/sprite.vert"));
-        mFlatProgram->addShader(osgDB::readShaderFile(osg::Shader::FRAGMENT, "shaders/sprite.frag"));
+        mFlatProgram->addShader(readShader(osg::Shader::VERTEX, "shaders/sprite.vert"));
+        mFlatProgram->addShader(readShader(osg::Shader::FRAGMENT, "shaders/sprite.frag"));
     }
 
     int16_t xoffset, yoffset;
@@ -260,6 +327,7 @@ osg::ref_ptr<osg::Node> MeshManager::loadFlat(size_t texid, bool centered, size_
     ss->setAttributeAndModes(new osg::AlphaFunc(osg::AlphaFunc::LESS, 0.5f));
     ss->addUniform(new osg::Uniform("diffuseTex", 0));
     ss->setTextureAttribute(0, tex);
+    setupPalette(ss);
 
     if(centered)
         bb->addDrawable(geometry);
@@ -268,6 +336,10 @@ osg::ref_ptr<osg::Node> MeshManager::loadFlat(size_t texid, bool centered, size_
     base->addChild(bb);
 
     mFlatCache[std::make_pair(texid, centered)] = osg::ref_ptr<osg::Node>(base);
+    ResourceCache::get().insert(ResourceCache::Type_Flat, texid*2 + centered, base.get(),
+        vtxs->getTotalDataSize() + texcrds->getTotalDataSize() + nrms->getTotalDataSize() +
+        colors->getTotalDataSize()
+    );
     return base;
 }
 
@@ -284,8 +356,8 @@ osg::ref_ptr<osg::Node> MeshManager::getTerrain(int size)
     if(!mTerrainProgram)
     {
         mTerrainProgram = new osg::Program();
-        mTerrainProgram->addShader(osgDB::readShaderFile(osg::Shader::VERTEX, "shaders/terrain.vert"));
-        mTerrainProgram->addShader(osgDB::readShaderFile(osg::Shader::FRAGMENT, "shaders/terrain.frag"));
+        mTerrainProgram->addShader(readShader(osg::Shader::VERTEX, "shaders/terrain.vert"));
+        mTerrainProgram->addShader(readShader(osg::Shader::FRAGMENT, "shaders/terrain.frag"));
     }
 
     osg::ref_ptr<osg::Vec3Array> vtxs(new osg::Vec3Array(4));
@@ -315,6 +387,7 @@ osg::ref_ptr<osg::Node> MeshManager::getTerrain(int size)
     ss->setAttributeAndModes(mTerrainProgram);
     ss->addUniform(new osg::Uniform("diffuseTex", 0));
     ss->addUniform(new osg::Uniform("tilemapTex", 1));
+    setupPalette(ss);
 
     osg::ref_ptr<osg::Geode> base(new osg::Geode());
     base->addDrawable(geometry);
@@ -1,6 +1,7 @@
 #ifndef COMPONENTS_RESOURCE_MESHMANAGER_HPP
 #define COMPONENTS_RESOURCE_MESHMANAGER_HPP
 
+#include <vector>
 #include <map>
 
 #include <osg/ref_ptr>
@@ -29,6 +30,8 @@ class MeshManager {
     osg::ref_ptr<osg::Program> mFlatProgram;
     osg::ref_ptr<osg::Program> mTerrainProgram;
 
+    bool mOptimize;
+
     MeshManager();
     ~MeshManager();
 
@@ -38,6 +41,16 @@ public:
 
     osg::ref_ptr<osg::Node> get(size_t idx);
 
+    /* Enables welding and reordering the vertices of models loaded afterward
+     * (see DFOSG::optimizeMeshGroups). Models from the asset pack are used as
+     * they were packed.
+     */
+    void setOptimize(bool optimize) { mOptimize = optimize; }
+    bool getOptimize() const { return mOptimize; }
+
+    /* Returns the IDs of the models that are currently loaded. */
+    std::vector<size_t> getLoadedModels() const;
+
     /* Loads a billboard flat for the given texture (see TextureManager::get),
      * with either a centered billboard or one rooted on its bottom. Optionally
      * returns the number of frames in the loaded texture.
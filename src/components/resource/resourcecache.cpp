@@ -0,0 +1,137 @@
+
+#include "resourcecache.hpp"
+
+
+namespace Resource
+{
+
+ResourceCache ResourceCache::sCache;
+
+
+ResourceCache::ResourceCache()
+  : mLimit(0)
+{
+    resetStats();
+    for(Stats &stats : mStats)
+    {
+        stats.mEntries = 0;
+        stats.mBytes = 0;
+    }
+}
+
+ResourceCache::~ResourceCache()
+{
+}
+
+
+void ResourceCache::evict(size_t limit)
+{
+    size_t total = 0;
+    for(const Stats &stats : mStats)
+        total += stats.mBytes;
+
+    while(total > limit && !mLru.empty())
+    {
+        const Entry &entry = mLru.back();
+        Stats &stats = mStats[entry.mType];
+        stats.mBytes -= entry.mSize;
+        --stats.mEntries;
+        ++stats.mEvictions;
+        total -= entry.mSize;
+
+        mLookup.erase(std::make_pair(entry.mType, entry.mKey));
+        mLru.pop_back();
+    }
+}
+
+
+void ResourceCache::touch(Type type, size_t key)
+{
+    ++mStats[type].mHits;
+
+    auto iter = mLookup.find(std::make_pair(type, key));
+    if(iter != mLookup.end())
+        mLru.splice(mLru.begin(), mLru, iter->second);
+}
+
+void ResourceCache::insert(Type type, size_t key, osg::Referenced *object, size_t size)
+{
+    Stats &stats = mStats[type];
+    ++stats.mMisses;
+
+    auto iter = mLookup.find(std::make_pair(type, key));
+    if(iter != mLookup.end())
+    {
+        // Reloaded after the held one was replaced (e.g. by a mode change).
+        stats.mBytes -= iter->second->mSize;
+        --stats.mEntries;
+        mLru.erase(iter->second);
+        mLookup.erase(iter);
+    }
+    if(!object || size > mLimit)
+        return;
+
+    evict(mLimit - size);
+
+    stats.mBytes += size;
+    ++stats.mEntries;
+    mLru.push_front(Entry{type, key, object, size});
+    mLookup[std::make_pair(type, key)] = mLru.begin();
+}
+
+void ResourceCache::remove(Type type, size_t key)
+{
+    auto iter = mLookup.find(std::make_pair(type, key));
+    if(iter == mLookup.end())
+        return;
+
+    Stats &stats = mStats[type];
+    stats.mBytes -= iter->second->mSize;
+    --stats.mEntries;
+    mLru.erase(iter->second);
+    mLookup.erase(iter);
+}
+
+
+void ResourceCache::setLimit(size_t limit)
+{
+    mLimit = limit;
+    evict(mLimit);
+}
+
+
+void ResourceCache::clear()
+{
+    mLookup.clear();
+    mLru.clear();
+    for(Stats &stats : mStats)
+    {
+        stats.mEntries = 0;
+        stats.mBytes = 0;
+    }
+}
+
+void ResourceCache::resetStats()
+{
+    for(Stats &stats : mStats)
+    {
+        stats.mHits = 0;
+        stats.mMisses = 0;
+        stats.mEvictions = 0;
+    }
+}
+
+
+const char *ResourceCache::getTypeName(Type type)
+{
+    switch(type)
+    {
+        case Type_Texture: return "textures";
+        case Type_Model: return "models";
+        case Type_Flat: return "flats";
+        case Type_Count: break;
+    }
+    return "unknown";
+}
+
+} // namespace Resource
@@ -0,0 +1,103 @@
+#ifndef COMPONENTS_RESOURCE_RESOURCECACHE_HPP
+#define COMPONENTS_RESOURCE_RESOURCECACHE_HPP
+
+#include <unordered_map>
+#include <functional>
+#include <utility>
+#include <array>
+#include <list>
+#include <cstddef>
+
+#include <osg/ref_ptr>
+#include <osg/Referenced>
+
+
+namespace Resource
+{
+
+/* Keeps loaded meshes and textures alive after the scene lets go of them, up
+ * to a memory budget, so going back and forth between locations doesn't have
+ * to reload the same assets. The managers still look up their own caches;
+ * this just holds strong references to what they loaded, least-recently-used
+ * first out. Only to be used from the main thread.
+ */
+class ResourceCache {
+public:
+    enum Type {
+        Type_Texture,
+        Type_Model,
+        Type_Flat,
+
+        Type_Count
+    };
+
+    struct Stats {
+        size_t mHits;
+        size_t mMisses;
+        size_t mEvictions;
+        size_t mEntries;
+        size_t mBytes;
+    };
+
+private:
+    static ResourceCache sCache;
+
+    struct Entry {
+        Type mType;
+        size_t mKey;
+        osg::ref_ptr<osg::Referenced> mObject;
+        size_t mSize;
+    };
+    typedef std::list<Entry> LruList;
+
+    struct KeyHash {
+        size_t operator()(const std::pair<Type,size_t> &key) const
+        { return std::hash<size_t>()(key.second*Type_Count + key.first); }
+    };
+
+    LruList mLru; // Most recently used at the front
+    std::unordered_map<std::pair<Type,size_t>,LruList::iterator,KeyHash> mLookup;
+
+    size_t mLimit;
+    std::array<Stats,Type_Count> mStats;
+
+    ResourceCache(const ResourceCache&) = delete;
+    ResourceCache& operator=(const ResourceCache&) = delete;
+
+    ResourceCache();
+    ~ResourceCache();
+
+    void evict(size_t limit);
+
+public:
+    /* Records a lookup that found the object already loaded, and moves it to
+     * the front if it's being held.
+     */
+    void touch(Type type, size_t key);
+
+    /* Records a lookup that had to load the object, and holds on to it.
+     * Objects larger than the budget are not held.
+     */
+    void insert(Type type, size_t key, osg::Referenced *object, size_t size);
+
+    /* Stops holding the object, if it is, without counting an eviction. */
+    void remove(Type type, size_t key);
+
+    /* Sets the budget in bytes, releasing the least recently used objects to
+     * get under it.
+     */
+    void setLimit(size_t limit);
+    size_t getLimit() const { return mLimit; }
+
+    void clear();
+    void resetStats();
+    Stats getStats(Type type) const { return mStats[type]; }
+
+    static const char *getTypeName(Type type);
+
+    static ResourceCache &get() { return sCache; }
+};
+
+} // namespace Resource
+
+#endif /* COMPONENTS_RESOURCE_RESOURCECACHE_HPP */
@@ -1,8 +1,12 @@
 
 #include "texturemanager.hpp"
 
+#include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
 
 #include <osg/Vec3ub>
 #include <osg/Image>
@@ -11,29 +15,274 @@
 
 #include "components/vfs/manager.hpp"
 #include "components/dfosg/texloader.hpp"
+#include "components/dfosg/texcompress.hpp"
+
+#include "misc/threadpool.hpp"
+
+#include "assetpack.hpp"
+#include "resourcecache.hpp"
 
 
 namespace
 {
 
-osg::ref_ptr<osg::Image> rotateImage(const osg::Image &image)
+/* Makes an image from a compressed level 0 and the given number of mipmaps
+ * following it, as laid out by DFOSG::compressImageMips.
+ */
+osg::ref_ptr<osg::Image> makeCompressedImage(DFOSG::BlockFormat format, size_t width, size_t height,
+                                             size_t mipcount, const unsigned char *data)
+{
+    osg::Image::MipmapDataType offsets;
+    size_t total = 0;
+    for(size_t i = 0, w = width, h = height;i < mipcount;++i)
+    {
+        if(i > 0) offsets.push_back(total);
+        total += DFOSG::getCompressedSize(format, w, h);
+        w = std::max<size_t>(w/2, 1);
+        h = std::max<size_t>(h/2, 1);
+    }
+
+    unsigned char *pixels = new unsigned char[total];
+    memcpy(pixels, data, total);
+
+    GLenum glformat = (format == DFOSG::Block_BC1) ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT :
+                                                     GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    osg::ref_ptr<osg::Image> image(new osg::Image());
+    image->setImage(width, height, 1, glformat, glformat, GL_UNSIGNED_BYTE, pixels,
+                    osg::Image::USE_NEW_DELETE);
+    image->setMipmapLevels(offsets);
+    return image;
+}
+
+/* Estimates the texture memory used by the images, including mipmaps. */
+size_t getImagesSize(const std::vector<osg::ref_ptr<osg::Image>> &images, bool genmipmaps)
+{
+    size_t size = 0;
+    for(const osg::ref_ptr<osg::Image> &image : images)
+        size += image->getTotalSizeInBytesIncludingMipmaps();
+    // Generated mipmaps add about a third.
+    return genmipmaps ? size + size/3 : size;
+}
+
+/* Hashes the images' size, format, and data (including any mipmaps), to find
+ * textures that may be identical. Matches are checked with hasSameImages.
+ */
+uint64_t hashImages(const std::vector<osg::ref_ptr<osg::Image>> &images)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](uint64_t val)
+    {
+        hash = (hash^val) * 1099511628211ull;
+        hash ^= hash >> 29;
+    };
+
+    mix(images.size());
+    for(const osg::ref_ptr<osg::Image> &image : images)
+    {
+        size_t size = image->getTotalSizeInBytesIncludingMipmaps();
+        mix(image->s());
+        mix(image->t());
+        mix(image->getPixelFormat());
+        mix(image->getDataType());
+        mix(size);
+
+        const unsigned char *data = image->data();
+        size_t i = 0;
+        for(;size-i >= 8;i += 8)
+        {
+            uint64_t val;
+            memcpy(&val, data+i, 8);
+            mix(val);
+        }
+        if(i < size)
+        {
+            uint64_t val = 0;
+            memcpy(&val, data+i, size-i);
+            mix(val);
+        }
+    }
+    return hash;
+}
+
+/* Checks that a texture found by hash really has the given images. */
+bool hasSameImages(const osg::Texture *tex, const std::vector<osg::ref_ptr<osg::Image>> &images)
 {
-    osg::ref_ptr<osg::Image> out(new osg::Image());
-    out->allocateImage(image.s(), image.t(), 1, image.getPixelFormat(), image.getDataType());
+    const osg::Texture2DArray *tex2darr = dynamic_cast<const osg::Texture2DArray*>(tex);
+    if(!tex2darr || size_t(tex2darr->getTextureDepth()) != images.size())
+        return false;
 
-    size_t s = std::min(image.s(), image.t());
-    for(size_t y = 0;y < s;++y)
+    for(size_t i = 0;i < images.size();++i)
     {
-        uint32_t *dst = reinterpret_cast<uint32_t*>(out->data(0, y));
-        for(size_t x = 0;x < s;++x)
-            dst[x] = *reinterpret_cast<const uint32_t*>(image.data((s-1-y), x));
+        const osg::Image *image = images[i].get();
+        const osg::Image *other = tex2darr->getImage(i);
+        if(!other || other->s() != image->s() || other->t() != image->t() ||
+           other->getPixelFormat() != image->getPixelFormat() ||
+           other->getDataType() != image->getDataType())
+            return false;
+
+        size_t size = image->getTotalSizeInBytesIncludingMipmaps();
+        if(other->getTotalSizeInBytesIncludingMipmaps() != size ||
+           memcmp(other->data(), image->data(), size) != 0)
+            return false;
     }
+    return true;
+}
 
-    return out;
+std::vector<osg::ref_ptr<osg::Image>> loadPackedImages(const Resource::PackedTexture &tex)
+{
+    std::vector<osg::ref_ptr<osg::Image>> images(tex.mFrameCount);
+    for(size_t i = 0;i < images.size();++i)
+    {
+        if(tex.mFormat != 0)
+        {
+            images[i] = makeCompressedImage(static_cast<DFOSG::BlockFormat>(tex.mFormat), tex.mWidth,
+                                            tex.mHeight, tex.mMipCount, tex.mPixels + i*tex.getFrameSize());
+            continue;
+        }
+        images[i] = new osg::Image();
+        images[i]->allocateImage(tex.mWidth, tex.mHeight, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        memcpy(images[i]->data(), tex.mPixels + i*tex.getFrameSize(), tex.getFrameSize());
+    }
+    return images;
 }
 
+
+bool getBlockFormat(Resource::TextureManager::Compression compression, DFOSG::BlockFormat *format)
+{
+    if(compression == Resource::TextureManager::Compress_None)
+        return false;
+    *format = (compression == Resource::TextureManager::Compress_BC1) ? DFOSG::Block_BC1 :
+                                                                         DFOSG::Block_BC3;
+    return true;
+}
+
+/* Loads a texture from the asset pack, preferring one already compressed
+ * with the given compression.
+ */
+bool loadPacked(size_t idx, const Resource::Palette &palette, Resource::TextureManager::Compression compression,
+                Resource::PackedTexture &packed)
+{
+    DFOSG::BlockFormat format;
+    if(getBlockFormat(compression, &format) &&
+       Resource::AssetPack::get().loadCompressedTexture(idx, palette, format, packed))
+        return true;
+    return Resource::AssetPack::get().loadTexture(idx, palette, packed);
+}
+
+/* Compresses RGBA images with the given compression, generating their
+ * mipmaps. Images that are already compressed are left alone.
+ */
+void compressImages(Resource::TextureManager::Compression compression,
+                    std::vector<osg::ref_ptr<osg::Image>> &images)
+{
+    DFOSG::BlockFormat format;
+    if(!getBlockFormat(compression, &format))
+        return;
+
+    DFOSG::CompressedImage compressed;
+    for(osg::ref_ptr<osg::Image> &image : images)
+    {
+        if(image->isCompressed() || image->getPixelFormat() != GL_RGBA)
+            continue;
+        DFOSG::compressImageMips(format, image->data(), image->s(), image->t(), compressed);
+        image = makeCompressedImage(format, compressed.mWidth, compressed.mHeight,
+                                    compressed.mMipOffsets.size(), compressed.mData.data());
+    }
+}
+
+/* Sets the wrap and filter modes for a texture, and whether it needs its
+ * mipmaps generated.
+ */
+void setupTexture(osg::Texture *tex, osg::Texture::WrapMode wrap, bool indexed, bool genmipmaps)
+{
+    tex->setResizeNonPowerOfTwoHint(false);
+    tex->setWrap(osg::Texture::WRAP_S, wrap);
+    tex->setWrap(osg::Texture::WRAP_T, wrap);
+    tex->setUnRefImageDataAfterApply(true);
+    // Filter should be configurable. Defaults to nearest to retain DF's pixely
+    // look (with linear mipmapping to reduce aliasing). Integer textures can't
+    // be filtered or mipmapped, so indexed textures are only nearest.
+    tex->setFilter(osg::Texture::MIN_FILTER, indexed ? osg::Texture::NEAREST :
+                                                       osg::Texture::NEAREST_MIPMAP_LINEAR);
+    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    if(!genmipmaps)
+        tex->setUseHardwareMipMapGeneration(false);
+}
+
+
+Misc::ThreadPool &getLoadPool()
+{
+    static Misc::ThreadPool pool(2);
+    return pool;
+}
+
+/* Decodes a list of textures from the same TEXTURE.??? file, for a worker
+ * thread, along with the hash of each one's images (after compression, as
+ * createTexture does). Only uses what's passed in, so the manager's state can
+ * change while it runs. Textures that fail to load are reported and left
+ * without images, rather than failing the rest.
+ */
+std::vector<std::vector<osg::ref_ptr<osg::Image>>> decodeTextures(const std::vector<size_t> &indices,
+    const Resource::Palette &palette, bool indexed, Resource::TextureManager::Compression compression,
+    std::vector<uint64_t> &hashes)
+{
+    std::vector<std::vector<osg::ref_ptr<osg::Image>>> images(indices.size());
+    std::vector<size_t> toload;
+    std::vector<size_t> fileindices;
+    for(size_t i = 0;i < indices.size();++i)
+    {
+        Resource::PackedTexture packed;
+        try {
+            if(!indexed && loadPacked(indices[i], palette, compression, packed))
+            {
+                images[i] = loadPackedImages(packed);
+                continue;
+            }
+        }
+        catch(std::exception &e) {
+            // Try the original instead.
+            std::cerr<< "Failed to load packed texture "<<indices[i]<<": "<<e.what() <<std::endl;
+        }
+        toload.push_back(i);
+        fileindices.push_back(indices[i]);
+    }
+
+    try {
+        std::vector<DFOSG::ImagePtrArray> loaded = indexed ?
+            DFOSG::TexLoader::get().loadBatchIndexed(fileindices) :
+            DFOSG::TexLoader::get().loadBatch(fileindices, palette);
+        for(size_t j = 0;j < toload.size();++j)
+            images[toload[j]] = std::move(loaded[j]);
+    }
+    catch(std::exception&) {
+        // Load them one at a time, to find which failed.
+        int16_t xoffset, yoffset, xscale, yscale;
+        for(size_t i : toload)
+        {
+            try {
+                images[i] = indexed ?
+                    DFOSG::TexLoader::get().loadIndexed(indices[i], &xoffset, &yoffset, &xscale, &yscale) :
+                    DFOSG::TexLoader::get().load(indices[i], &xoffset, &yoffset, &xscale, &yscale, palette);
+            }
+            catch(std::exception &e) {
+                std::cerr<< "Failed to load texture "<<indices[i]<<": "<<e.what() <<std::endl;
+                images[i].clear();
+            }
+        }
+    }
+
+    hashes.resize(images.size());
+    for(size_t i = 0;i < images.size();++i)
+    {
+        if(!indexed)
+            compressImages(compression, images[i]);
+        hashes[i] = hashImages(images[i]);
+    }
+    return images;
 }
 
+} // namespace
+
 namespace Resource
 {
 
@@ -41,6 +290,8 @@ TextureManager TextureManager::sManager;
 
 
 TextureManager::TextureManager()
+  : mIndexed(false), mCompression(Compress_None), mAsync(false), mUploadBudget(4*1024*1024)
+  , mDedupHits(0), mDedupHitBytes(0)
 {
 }
 
@@ -51,56 +302,120 @@ TextureManager::~TextureManager()
 
 void TextureManager::initialize()
 {
-    VFS::IStreamPtr stream = VFS::Manager::get().open("PAL.PAL");
-
-    std::streamsize len = 0;
-    if(stream && stream->seekg(0, std::ios_base::end))
-    {
-        len = stream->tellg();
-        stream->seekg(0);
-    }
+    VFS::EntryData data = VFS::Manager::get().readAll("PAL.PAL");
 
+    const char *pal = data.data();
+    size_t len = data.size();
     if(len == 776)
     {
         len -= 8;
-        stream->ignore(8);
+        pal += 8;
     }
 
     if(len != sizeof(mCurrentPalette))
         throw std::runtime_error("Invalid palette size (expected 768 or 776 bytes)");
 
-    stream->read(reinterpret_cast<char*>(mCurrentPalette.data()), sizeof(mCurrentPalette));
+    memcpy(mCurrentPalette.data(), pal, sizeof(mCurrentPalette));
+    if(mPaletteTexture)
+        setPalette(mCurrentPalette);
 }
 
 
-osg::ref_ptr<osg::Texture> TextureManager::getTexture(size_t idx, int16_t *xoffset, int16_t *yoffset, float *xscale, float *yscale)
+void TextureManager::setPalette(const Palette &palette)
 {
-    auto iter = mTexCache.find(idx);
-    if(iter != mTexCache.end())
+    mCurrentPalette = palette;
+    if(!mPaletteTexture)
+        return;
+
+    DFOSG::PaletteLUT lut;
+    DFOSG::buildPaletteLUT(mCurrentPalette, lut);
+
+    osg::Image *image = mPaletteTexture->getImage();
+    memcpy(image->data(), lut.data(), sizeof(lut));
+    image->dirty();
+}
+
+void TextureManager::setIndexed(bool indexed)
+{
+    if(mIndexed != indexed)
     {
-        osg::ref_ptr<osg::Texture> tex;
-        if(iter->second.mTexture.lock(tex))
-        {
-            *xoffset = iter->second.mXOffset;
-            *yoffset = iter->second.mYOffset;
-            *xscale = iter->second.mXScale;
-            *yscale = iter->second.mYScale;
-            return tex;
-        }
+        mTexCache.clear();
+        mContentCache.clear();
     }
+    mIndexed = indexed;
+}
 
-    int16_t x_offset, y_offset, x_scale, y_scale;
-    std::vector<osg::ref_ptr<osg::Image>> images = DFOSG::TexLoader::get().load(
-        idx, &x_offset, &y_offset, &x_scale, &y_scale, mCurrentPalette
-    );
-    *xoffset = x_offset;
-    *yoffset = y_offset;
-    *xscale = 1.0f + x_scale/256.0f;
-    *yscale = 1.0f + y_scale/256.0f;
+void TextureManager::setCompression(Compression compression)
+{
+    if(mCompression != compression)
+    {
+        mTexCache.clear();
+        mContentCache.clear();
+    }
+    mCompression = compression;
+}
+
+osg::ref_ptr<osg::Texture> TextureManager::getPaletteTexture()
+{
+    if(!mPaletteTexture)
+    {
+        osg::ref_ptr<osg::Image> image(new osg::Image());
+        image->allocateImage(256, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+
+        mPaletteTexture = new osg::Texture2D(image);
+        mPaletteTexture->setTextureSize(256, 1);
+        mPaletteTexture->setUseHardwareMipMapGeneration(false);
+        mPaletteTexture->setResizeNonPowerOfTwoHint(false);
+        mPaletteTexture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+        mPaletteTexture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+        // Keep the image around, so palette changes can update it.
+        mPaletteTexture->setUnRefImageDataAfterApply(false);
+        mPaletteTexture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        mPaletteTexture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+
+        setPalette(mCurrentPalette);
+    }
+    return mPaletteTexture;
+}
+
+
+void TextureManager::setAsync(bool async)
+{
+    if(!async)
+        finishLoads();
+    mAsync = async;
+}
+
+
+osg::ref_ptr<osg::Texture> TextureManager::createTexture(size_t idx, std::vector<osg::ref_ptr<osg::Image>> images,
+                                                         int16_t xoffset, int16_t yoffset, int16_t xscale, int16_t yscale)
+{
     if(images.empty())
         return osg::ref_ptr<osg::Texture>();
 
+    if(!mIndexed)
+        compressImages(mCompression, images);
+
+    // Share the texture of an identical set of images, if one's loaded.
+    uint64_t hash = hashImages(images);
     osg::ref_ptr<osg::Texture> tex;
+    auto shared = mContentCache.find(hash);
+    if(shared != mContentCache.end() && !shared->second.mTexture.lock(tex))
+        mContentCache.erase(shared);
+    else if(shared != mContentCache.end() && hasSameImages(tex, images))
+    {
+        size_t size = shared->second.mSize;
+        mTexCache[idx] = TextureInfo{
+            tex, xoffset, yoffset, 1.0f + xscale/256.0f, 1.0f + yscale/256.0f, size
+        };
+        // Each index holds its own reference, so the budget counts a shared
+        // texture once for each. That errs on the side of holding less.
+        ResourceCache::get().insert(ResourceCache::Type_Texture, idx, tex.get(), size);
+        ++mDedupHits;
+        mDedupHitBytes += size;
+        return tex;
+    }
+
     {
         osg::ref_ptr<osg::Texture2DArray> tex2darr(new osg::Texture2DArray());
         tex2darr->setTextureSize(images[0]->s(), images[0]->t(), images.size());
@@ -110,18 +425,328 @@ osg::ref_ptr<osg::Texture> TextureManager::getTexture(size_t idx, int16_t *xoffs
         tex = tex2darr;
     }
 
-    tex->setResizeNonPowerOfTwoHint(false);
-    tex->setWrap(osg::Texture::WRAP_S, osg::Texture::REPEAT);
-    tex->setWrap(osg::Texture::WRAP_T, osg::Texture::REPEAT);
-    tex->setUnRefImageDataAfterApply(true);
-    // Filter should be configurable. Defaults to nearest to retain DF's pixely
-    // look (with linear mipmapping to reduce aliasing).
-    tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST_MIPMAP_LINEAR);
-    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    // Compressed images come with their mipmaps.
+    bool genmipmaps = !mIndexed && !images[0]->isCompressed();
+    setupTexture(tex, osg::Texture::REPEAT, mIndexed, genmipmaps);
+    // Keep the images to compare with, in case others hash the same.
+    tex->setUnRefImageDataAfterApply(false);
+
+    size_t size = getImagesSize(images, genmipmaps);
+    mTexCache[idx] = TextureInfo{
+        tex, xoffset, yoffset, 1.0f + xscale/256.0f, 1.0f + yscale/256.0f, size
+    };
+    // A different texture with the same hash keeps its place.
+    mContentCache.insert(std::make_pair(hash, SharedTexture{tex, size}));
+    ResourceCache::get().insert(ResourceCache::Type_Texture, idx, tex.get(), size);
+    return tex;
+}
+
+osg::ref_ptr<osg::Texture> TextureManager::loadTexture(size_t idx)
+{
+    int16_t xoffset, yoffset, xscale, yscale;
+    std::vector<osg::ref_ptr<osg::Image>> images;
+    PackedTexture packed;
+    if(mIndexed)
+        images = DFOSG::TexLoader::get().loadIndexed(idx, &xoffset, &yoffset, &xscale, &yscale);
+    else if(loadPacked(idx, mCurrentPalette, mCompression, packed))
+    {
+        xoffset = packed.mXOffset;
+        yoffset = packed.mYOffset;
+        xscale = packed.mXScale;
+        yscale = packed.mYScale;
+        images = loadPackedImages(packed);
+    }
+    else
+        images = DFOSG::TexLoader::get().load(
+            idx, &xoffset, &yoffset, &xscale, &yscale, mCurrentPalette
+        );
+
+    return createTexture(idx, images, xoffset, yoffset, xscale, yscale);
+}
+
+osg::ref_ptr<osg::Texture2DArray> TextureManager::createPendingTexture(size_t idx, size_t width, size_t height, size_t frames,
+                                                                       int16_t xoffset, int16_t yoffset, int16_t xscale, int16_t yscale)
+{
+    osg::ref_ptr<osg::Texture2DArray> tex(new osg::Texture2DArray());
+    tex->setTextureSize(width, height, frames);
+    // The images will be set as they're loaded.
+    tex->setDataVariance(osg::Object::DYNAMIC);
+
+    DFOSG::BlockFormat format;
+    size_t size;
+    bool genmipmaps = false;
+    if(mIndexed)
+    {
+        tex->setInternalFormat(GL_R8UI);
+        tex->setSourceFormat(GL_RED_INTEGER);
+        tex->setSourceType(GL_UNSIGNED_BYTE);
+        size = width * height * frames;
+    }
+    else if(getBlockFormat(mCompression, &format))
+    {
+        tex->setInternalFormat((format == DFOSG::Block_BC1) ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT :
+                                                              GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+        size = DFOSG::getCompressedSize(format, width, height) * frames;
+        size += size/3;
+    }
+    else
+    {
+        tex->setInternalFormat(GL_RGBA8);
+        tex->setSourceFormat(GL_RGBA);
+        tex->setSourceType(GL_UNSIGNED_BYTE);
+        size = width * height * 4 * frames;
+        size += size/3;
+        genmipmaps = true;
+    }
+    setupTexture(tex, osg::Texture::REPEAT, mIndexed, genmipmaps);
+    // As in createTexture, keep the images to compare with.
+    tex->setUnRefImageDataAfterApply(false);
 
     mTexCache[idx] = TextureInfo{
-        tex, x_offset, y_offset, 1.0f + x_scale/256.0f, 1.0f + y_scale/256.0f
+        tex, xoffset, yoffset, 1.0f + xscale/256.0f, 1.0f + yscale/256.0f, size
     };
+    ResourceCache::get().insert(ResourceCache::Type_Texture, idx, tex.get(), size);
+    return tex;
+}
+
+void TextureManager::queueLoad(const std::vector<size_t> &indices,
+                               const std::vector<osg::ref_ptr<osg::Texture2DArray>> &textures)
+{
+    PendingLoad pending;
+    pending.mIndices = indices;
+    pending.mTextures = textures;
+    pending.mNext = 0;
+
+    const Palette palette = mCurrentPalette;
+    const bool indexed = mIndexed;
+    const Compression compression = mCompression;
+    pending.mFuture = getLoadPool().enqueue(
+        [indices, palette, indexed, compression]() -> DecodedImages
+        {
+            DecodedImages decoded;
+            decoded.mImages = decodeTextures(indices, palette, indexed, compression, decoded.mHashes);
+            return decoded;
+        }
+    );
+    mPending.push_back(std::move(pending));
+}
+
+size_t TextureManager::setImages(osg::Texture2DArray *tex, const std::vector<osg::ref_ptr<osg::Image>> &images)
+{
+    if(images.empty())
+        return 0;
+
+    if(tex->getTextureWidth() != images[0]->s() || tex->getTextureHeight() != images[0]->t() ||
+       size_t(tex->getTextureDepth()) != images.size())
+    {
+        // Shouldn't happen, but reallocate rather than upload mismatched
+        // layers.
+        tex->setTextureSize(images[0]->s(), images[0]->t(), images.size());
+        tex->dirtyTextureObject();
+    }
+
+    size_t size = 0;
+    for(size_t i = 0;i < images.size();++i)
+    {
+        tex->setImage(i, images[i]);
+        size += images[i]->getTotalSizeInBytesIncludingMipmaps();
+    }
+    return size;
+}
+
+size_t TextureManager::fillTexture(PendingLoad &pending, size_t i)
+{
+    osg::Texture2DArray *tex = pending.mTextures[i];
+    size_t idx = pending.mIndices[i];
+    if(pending.mDecoded.mImages[i].empty())
+    {
+        dropPendingTexture(idx, tex);
+        return 0;
+    }
+    size_t size = setImages(tex, pending.mDecoded.mImages[i]);
+
+    // Only dedup if the index still uses this texture. It may have been
+    // dropped for a mode change while loading.
+    auto cached = mTexCache.find(idx);
+    if(cached == mTexCache.end() || cached->second.mTexture.get() != tex)
+        return size;
+
+    // This texture was already given out, so it still gets its images, but
+    // later lookups of the index get the identical one instead.
+    uint64_t hash = pending.mDecoded.mHashes[i];
+    osg::ref_ptr<osg::Texture> existing;
+    auto shared = mContentCache.find(hash);
+    if(shared == mContentCache.end() || !shared->second.mTexture.lock(existing))
+        mContentCache[hash] = SharedTexture{tex, cached->second.mSize};
+    else if(existing.get() != tex && hasSameImages(existing, pending.mDecoded.mImages[i]))
+    {
+        ++mDedupHits;
+        mDedupHitBytes += cached->second.mSize;
+        cached->second.mTexture = existing;
+        cached->second.mSize = shared->second.mSize;
+        ResourceCache::get().insert(ResourceCache::Type_Texture, idx, existing.get(), shared->second.mSize);
+    }
+    return size;
+}
+
+void TextureManager::dropPendingTexture(size_t idx, const osg::Texture *tex)
+{
+    auto cached = mTexCache.find(idx);
+    if(cached == mTexCache.end() || cached->second.mTexture.get() != tex)
+        return;
+
+    mTexCache.erase(cached);
+    ResourceCache::get().remove(ResourceCache::Type_Texture, idx);
+    mLoadFailed.insert(idx);
+}
+
+bool TextureManager::shouldLoadAsync(size_t idx, size_t width, size_t height, size_t frames)
+{
+    // Textures that failed in the background are loaded right away, so the
+    // caller gets the error if it happens again.
+    if(mLoadFailed.erase(idx) > 0)
+        return false;
+    // Solid colors and dummies are loaded right away too, since they're quick
+    // and most likely already have a texture to share.
+    return width*height*frames > 4;
+}
+
+void TextureManager::update()
+{
+    // Textures are only uploaded when their images are set, so give out the
+    // loaded images until the budget is used up.
+    size_t total = 0;
+    bool started = false;
+    auto iter = mPending.begin();
+    while(iter != mPending.end() && (!started || total < mUploadBudget))
+    {
+        if(iter->mFuture.valid())
+        {
+            if(iter->mFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                ++iter;
+                continue;
+            }
+            try {
+                iter->mDecoded = iter->mFuture.get();
+            }
+            catch(std::exception &e) {
+                std::cerr<< "Failed to load textures: "<<e.what() <<std::endl;
+                for(size_t i = 0;i < iter->mTextures.size();++i)
+                    dropPendingTexture(iter->mIndices[i], iter->mTextures[i]);
+                iter = mPending.erase(iter);
+                continue;
+            }
+        }
+
+        while(iter->mNext < iter->mTextures.size() && (!started || total < mUploadBudget))
+        {
+            total += fillTexture(*iter, iter->mNext);
+            ++iter->mNext;
+            started = true;
+        }
+        if(iter->mNext < iter->mTextures.size())
+            break;
+        iter = mPending.erase(iter);
+    }
+}
+
+void TextureManager::finishLoads()
+{
+    for(PendingLoad &pending : mPending)
+    {
+        try {
+            if(pending.mFuture.valid())
+                pending.mDecoded = pending.mFuture.get();
+            for(;pending.mNext < pending.mTextures.size();++pending.mNext)
+                fillTexture(pending, pending.mNext);
+        }
+        catch(std::exception &e) {
+            std::cerr<< "Failed to load textures: "<<e.what() <<std::endl;
+            for(;pending.mNext < pending.mTextures.size();++pending.mNext)
+                dropPendingTexture(pending.mIndices[pending.mNext], pending.mTextures[pending.mNext]);
+        }
+    }
+    mPending.clear();
+}
+
+
+TextureManager::DedupStats TextureManager::getDedupStats() const
+{
+    DedupStats stats{0, 0, 0, mDedupHits, mDedupHitBytes};
+
+    // Count how many loaded indices use each texture.
+    std::map<const osg::Texture*,std::pair<size_t,size_t>> users;
+    for(const auto &entry : mTexCache)
+    {
+        osg::ref_ptr<osg::Texture> tex;
+        if(!entry.second.mTexture.lock(tex))
+            continue;
+        std::pair<size_t,size_t> &user = users[tex.get()];
+        ++user.first;
+        user.second = entry.second.mSize;
+        ++stats.mIndices;
+    }
+    for(const auto &user : users)
+        stats.mSavedBytes += (user.second.first-1) * user.second.second;
+    stats.mTextures = users.size();
+    return stats;
+}
+
+void TextureManager::resetDedupStats()
+{
+    mDedupHits = 0;
+    mDedupHitBytes = 0;
+}
+
+
+osg::ref_ptr<osg::Texture> TextureManager::getTexture(size_t idx, int16_t *xoffset, int16_t *yoffset, float *xscale, float *yscale)
+{
+    auto iter = mTexCache.find(idx);
+    if(iter != mTexCache.end())
+    {
+        osg::ref_ptr<osg::Texture> tex;
+        if(iter->second.mTexture.lock(tex))
+        {
+            ResourceCache::get().touch(ResourceCache::Type_Texture, idx);
+            *xoffset = iter->second.mXOffset;
+            *yoffset = iter->second.mYOffset;
+            *xscale = iter->second.mXScale;
+            *yscale = iter->second.mYScale;
+            return tex;
+        }
+    }
+
+    osg::ref_ptr<osg::Texture> tex;
+    if(mAsync)
+    {
+        size_t width, height, frames;
+        DFOSG::TexImageInfo info;
+        DFOSG::TexLoader::get().getImageLayout(idx, &width, &height, &frames, &info);
+        if(shouldLoadAsync(idx, width, height, frames))
+        {
+            osg::ref_ptr<osg::Texture2DArray> pending = createPendingTexture(
+                idx, width, height, frames, info.mXOffset, info.mYOffset, info.mXScale, info.mYScale
+            );
+            queueLoad(std::vector<size_t>(1, idx), std::vector<osg::ref_ptr<osg::Texture2DArray>>(1, pending));
+            tex = pending;
+        }
+    }
+    if(!tex)
+        tex = loadTexture(idx);
+
+    *xoffset = 0;
+    *yoffset = 0;
+    *xscale = 1.0f;
+    *yscale = 1.0f;
+    iter = mTexCache.find(idx);
+    if(iter != mTexCache.end())
+    {
+        *xoffset = iter->second.mXOffset;
+        *yoffset = iter->second.mYOffset;
+        *xscale = iter->second.mXScale;
+        *yscale = iter->second.mYScale;
+    }
     return tex;
 }
 
@@ -133,6 +758,88 @@ osg::ref_ptr<osg::Texture> TextureManager::getTexture(size_t idx)
 }
 
 
+std::vector<osg::ref_ptr<osg::Texture>> TextureManager::getTextures(const std::vector<size_t> &indices)
+{
+    std::vector<osg::ref_ptr<osg::Texture>> textures(indices.size());
+
+    // Find what isn't already loaded, grouped by file.
+    std::map<size_t,std::vector<size_t>> toload;
+    for(size_t i = 0;i < indices.size();++i)
+    {
+        auto iter = mTexCache.find(indices[i]);
+        if(iter != mTexCache.end() && iter->second.mTexture.lock(textures[i]))
+        {
+            ResourceCache::get().touch(ResourceCache::Type_Texture, indices[i]);
+            continue;
+        }
+
+        PackedTexture packed;
+        if(mAsync)
+            toload[indices[i]>>7].push_back(i);
+        else if(!mIndexed && loadPacked(indices[i], mCurrentPalette, mCompression, packed))
+            textures[i] = createTexture(indices[i], loadPackedImages(packed), packed.mXOffset,
+                                        packed.mYOffset, packed.mXScale, packed.mYScale);
+        else
+            toload[indices[i]>>7].push_back(i);
+    }
+
+    std::vector<size_t> fileindices;
+    std::vector<DFOSG::TexImageInfo> info;
+    for(const auto &file : toload)
+    {
+        fileindices.clear();
+        for(size_t i : file.second)
+            fileindices.push_back(indices[i]);
+
+        if(mAsync)
+        {
+            // Make the textures now, and load their images in the background
+            // all together.
+            std::vector<osg::ref_ptr<osg::Texture2DArray>> pending;
+            std::vector<size_t> pendingindices;
+            for(size_t i : file.second)
+            {
+                auto iter = mTexCache.find(indices[i]);
+                if(iter != mTexCache.end() && iter->second.mTexture.lock(textures[i]))
+                    continue;
+
+                size_t width, height, frames;
+                DFOSG::TexImageInfo layout;
+                DFOSG::TexLoader::get().getImageLayout(indices[i], &width, &height, &frames, &layout);
+                if(!shouldLoadAsync(indices[i], width, height, frames))
+                {
+                    textures[i] = loadTexture(indices[i]);
+                    continue;
+                }
+                pending.push_back(createPendingTexture(indices[i], width, height, frames, layout.mXOffset,
+                                                       layout.mYOffset, layout.mXScale, layout.mYScale));
+                pendingindices.push_back(indices[i]);
+                textures[i] = pending.back();
+            }
+            if(!pending.empty())
+                queueLoad(pendingindices, pending);
+            continue;
+        }
+
+        std::vector<DFOSG::ImagePtrArray> images = mIndexed ?
+            DFOSG::TexLoader::get().loadBatchIndexed(fileindices, &info) :
+            DFOSG::TexLoader::get().loadBatch(fileindices, mCurrentPalette, &info);
+        for(size_t j = 0;j < file.second.size();++j)
+        {
+            // The same texture may be listed more than once.
+            size_t i = file.second[j];
+            auto iter = mTexCache.find(indices[i]);
+            if(iter != mTexCache.end() && iter->second.mTexture.lock(textures[i]))
+                continue;
+            textures[i] = createTexture(indices[i], images[j], info[j].mXOffset, info[j].mYOffset,
+                                        info[j].mXScale, info[j].mYScale);
+        }
+    }
+
+    return textures;
+}
+
+
 osg::ref_ptr<osg::Texture> TextureManager::getTerrainTileset(size_t idx)
 {
     auto iter = mTexCache.find(idx|0x7f);
@@ -140,47 +847,44 @@ osg::ref_ptr<osg::Texture> TextureManager::getTerrainTileset(size_t idx)
     {
         osg::ref_ptr<osg::Texture> tex;
         if(iter->second.mTexture.lock(tex))
+        {
+            ResourceCache::get().touch(ResourceCache::Type_Texture, idx|0x7f);
             return tex;
+        }
     }
 
-    std::vector<std::vector<osg::ref_ptr<osg::Image>>> images = DFOSG::TexLoader::get().loadAll(
-        idx, mCurrentPalette
-    );
+    std::vector<std::vector<osg::ref_ptr<osg::Image>>> images = mIndexed ?
+        DFOSG::TexLoader::get().loadAllIndexed(idx) :
+        DFOSG::TexLoader::get().loadAll(idx, mCurrentPalette);
     if(images.empty())
         throw std::runtime_error("No images found from texture "+std::to_string(idx>>7));
 
+    // Only the unrotated tiles are stored. The terrain shader rotates the
+    // texture coordinates as given by the tilemap (see createTerrainMap).
+    std::vector<osg::ref_ptr<osg::Image>> tiles(std::min<size_t>(images.size(), 64));
+    for(size_t i = 0;i < tiles.size();++i)
+        tiles[i] = images[i].at(0);
+    if(!mIndexed)
+        compressImages(mCompression, tiles);
+
     osg::ref_ptr<osg::Texture> tex;
     {
-        size_t numimages = std::min<size_t>(images.size(), 64);
         osg::ref_ptr<osg::Texture2DArray> tex2darr(new osg::Texture2DArray());
-        tex2darr->setTextureSize(images[0][0]->s(), images[0][0]->t(), numimages*4);
+        tex2darr->setTextureSize(tiles[0]->s(), tiles[0]->t(), tiles.size());
         tex2darr->setResizeNonPowerOfTwoHint(false);
-        for(size_t i = 0;i < numimages;++i)
-        {
-            osg::ref_ptr<osg::Image> image = images[i].at(0);
-            tex2darr->setImage(i*4, image);
-            image = rotateImage(*image);
-            tex2darr->setImage(i*4 + 1, image);
-            image = rotateImage(*image);
-            tex2darr->setImage(i*4 + 2, image);
-            image = rotateImage(*image);
-            tex2darr->setImage(i*4 + 3, image);
-        }
+        for(size_t i = 0;i < tiles.size();++i)
+            tex2darr->setImage(i, tiles[i]);
         tex = tex2darr;
     }
 
-    tex->setResizeNonPowerOfTwoHint(false);
-    tex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
-    tex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
-    tex->setUnRefImageDataAfterApply(true);
-    // Filter should be configurable. Defaults to nearest to retain DF's pixely
-    // look (with linear mipmapping to reduce aliasing).
-    tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST_MIPMAP_LINEAR);
-    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    bool genmipmaps = !mIndexed && !tiles[0]->isCompressed();
+    setupTexture(tex, osg::Texture::CLAMP_TO_EDGE, mIndexed, genmipmaps);
 
+    size_t size = getImagesSize(tiles, genmipmaps);
     mTexCache[idx|0x7f] = TextureInfo{
-        tex, 0, 0, 1.0f, 1.0f
+        tex, 0, 0, 1.0f, 1.0f, size
     };
+    ResourceCache::get().insert(ResourceCache::Type_Texture, idx|0x7f, tex.get(), size);
     return tex;
 }
 
@@ -191,7 +895,8 @@ osg::ref_ptr<osg::Texture> TextureManager::createTerrainMap(const uint8_t *data,
     image->setInternalTextureFormat(GL_R8UI);
     for(size_t y = 0;y < dim;++y)
     {
-        // Swap rotate and texture ID bits (puts rotations next to each other)
+        // Swap rotate and texture ID bits, so the tile is in the upper six
+        // bits and the number of 90-degree rotations in the lower two.
         const uint8_t *src = data + (y*dim);
         uint8_t *dst = image->data(0, y);
         for(size_t x = 0;x < dim;++x)
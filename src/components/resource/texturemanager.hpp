@@ -2,8 +2,13 @@
 #define COMPONENTS_RESOURCE_TEXTUREMANAGER_HPP
 
 #include <string>
+#include <vector>
+#include <future>
 #include <array>
+#include <deque>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <cstdint>
 
 #include <osg/ref_ptr>
@@ -12,7 +17,10 @@
 
 namespace osg
 {
+    class Image;
     class Texture;
+    class Texture2D;
+    class Texture2DArray;
 }
 
 namespace Resource
@@ -28,15 +36,82 @@ struct TextureInfo {
 
     int16_t mXOffset, mYOffset;
     float mXScale, mYScale;
+
+    // Estimated texture memory, including mipmaps
+    size_t mSize;
 };
 
 class TextureManager {
+public:
+    enum Compression {
+        Compress_None,
+        Compress_BC1,
+        Compress_BC3
+    };
+
+    struct DedupStats {
+        // Loaded textures, and the indices using them
+        size_t mTextures;
+        size_t mIndices;
+        // Memory the loaded indices would need without sharing
+        size_t mSavedBytes;
+
+        // Loads that found an identical texture, and their total size, since
+        // the last reset
+        size_t mHits;
+        size_t mHitBytes;
+    };
+
+private:
     static TextureManager sManager;
 
     Palette mCurrentPalette;
     static_assert(sizeof(Palette)==768, "Palette is not 768 bytes");
 
+    bool mIndexed;
+    osg::ref_ptr<osg::Texture2D> mPaletteTexture;
+
+    Compression mCompression;
+
+    /* Decoded images for a list of textures, with a hash of each one's
+     * content (see hashImages).
+     */
+    struct DecodedImages {
+        std::vector<std::vector<osg::ref_ptr<osg::Image>>> mImages;
+        std::vector<uint64_t> mHashes;
+    };
+
+    /* Textures whose images are being loaded in the background, and are
+     * given to them a few at a time as they finish.
+     */
+    struct PendingLoad {
+        std::vector<size_t> mIndices;
+        std::vector<osg::ref_ptr<osg::Texture2DArray>> mTextures;
+        std::future<DecodedImages> mFuture;
+        DecodedImages mDecoded;
+        size_t mNext;
+    };
+    std::deque<PendingLoad> mPending;
+    bool mAsync;
+    size_t mUploadBudget;
+
     std::map<size_t,TextureInfo> mTexCache;
+    // Indices whose background load failed, to be loaded right away when
+    // next asked for.
+    std::set<size_t> mLoadFailed;
+
+    /* Loaded textures by a hash of their images, so indices that decode to
+     * the same thing (solid colors, dummy images, repeated images) can share
+     * one texture. The textures keep their images, so a match can be checked
+     * before it's shared.
+     */
+    struct SharedTexture {
+        osg::observer_ptr<osg::Texture> mTexture;
+        size_t mSize;
+    };
+    std::unordered_map<uint64_t,SharedTexture> mContentCache;
+    size_t mDedupHits;
+    size_t mDedupHitBytes;
 
     TextureManager(const TextureManager&) = delete;
     TextureManager& operator=(const TextureManager&) = delete;
@@ -44,15 +119,92 @@ class TextureManager {
     TextureManager();
     ~TextureManager();
 
+    osg::ref_ptr<osg::Texture> createTexture(size_t idx, std::vector<osg::ref_ptr<osg::Image>> images,
+                                             int16_t xoffset, int16_t yoffset, int16_t xscale, int16_t yscale);
+    /* Loads the images for the given index right away, and makes (or finds)
+     * its texture.
+     */
+    osg::ref_ptr<osg::Texture> loadTexture(size_t idx);
+    /* Creates a texture with the given size, for the images of the given
+     * index to be set on later.
+     */
+    osg::ref_ptr<osg::Texture2DArray> createPendingTexture(size_t idx, size_t width, size_t height, size_t frames,
+                                                           int16_t xoffset, int16_t yoffset, int16_t xscale, int16_t yscale);
+    void queueLoad(const std::vector<size_t> &indices,
+                   const std::vector<osg::ref_ptr<osg::Texture2DArray>> &textures);
+    static size_t setImages(osg::Texture2DArray *tex, const std::vector<osg::ref_ptr<osg::Image>> &images);
+    /* Gives a pending texture its images, and points the index at an
+     * identical texture if one's already loaded. Returns the bytes given.
+     */
+    size_t fillTexture(PendingLoad &pending, size_t i);
+    /* Forgets a pending texture whose images failed to load, so the next
+     * lookup of the index loads it again.
+     */
+    void dropPendingTexture(size_t idx, const osg::Texture *tex);
+    bool shouldLoadAsync(size_t idx, size_t width, size_t height, size_t frames);
+
 public:
     void initialize();
 
     const Palette &getCurrentPalette() const { return mCurrentPalette; }
+    /* Changes the current palette. In indexed mode, this just updates the
+     * palette texture, so already-loaded textures change with it. Otherwise
+     * it only affects textures loaded afterward.
+     */
+    void setPalette(const Palette &palette);
+
+    /* Enables indexed mode, where textures are loaded as 8-bit palette indices
+     * (GL_R8UI) and shaders look up the color in the palette texture. Must be
+     * set before any textures are loaded.
+     */
+    void setIndexed(bool indexed);
+    bool isIndexed() const { return mIndexed; }
+
+    /* Sets block compression for textures loaded afterward. The mipmaps are
+     * made on the CPU when compressing, and compressed textures in the asset
+     * pack are used if available. Has no effect in indexed mode.
+     */
+    void setCompression(Compression compression);
+    Compression getCompression() const { return mCompression; }
+
+    /* Enables background loading. Textures are then returned right away with
+     * their proper size but no image data (so they show as blank), and get
+     * their images from update() once they're decoded. Terrain tilesets are
+     * still loaded right away.
+     */
+    void setAsync(bool async);
+    bool isAsync() const { return mAsync; }
+
+    /* Sets roughly how many bytes of image data update() gives to textures
+     * each call. At least one texture is always given its images.
+     */
+    void setUploadBudget(size_t bytes) { mUploadBudget = bytes; }
+    size_t getUploadBudget() const { return mUploadBudget; }
+
+    /* Gives loaded images to their textures, within the upload budget. Call
+     * once per frame.
+     */
+    void update();
+    /* Waits for all background loads, and gives every texture its images. */
+    void finishLoads();
+
+    /* Reports how many of the currently loaded textures are shared, and how
+     * much memory that saves.
+     */
+    DedupStats getDedupStats() const;
+    void resetDedupStats();
+
+    // A 256x1 RGBA texture of the current palette, with index 0 transparent.
+    osg::ref_ptr<osg::Texture> getPaletteTexture();
 
     // The index has the TEXTURE.??? file number in the upper nine bits, and
     // the image index in the lower 7 bits.
     osg::ref_ptr<osg::Texture> getTexture(size_t idx, int16_t *xoffset, int16_t *yoffset, float *xscale, float *yscale);
     osg::ref_ptr<osg::Texture> getTexture(size_t idx);
+    /* Gets a list of textures, loading the ones from the same TEXTURE.???
+     * file together.
+     */
+    std::vector<osg::ref_ptr<osg::Texture>> getTextures(const std::vector<size_t> &indices);
 
     // Really returns a Texture2DArray
     osg::ref_ptr<osg::Texture> getTerrainTileset(size_t idx);
@@ -0,0 +1,110 @@
+
+#include "bytecache.hpp"
+
+
+namespace VFS
+{
+
+ByteCache::ByteCache(size_t limit)
+  : mBytes(0), mLimit(limit), mHits(0), mMisses(0), mEvictions(0)
+{
+}
+
+
+void ByteCache::evict(size_t limit)
+{
+    while(mBytes > limit && !mLru.empty())
+    {
+        mBytes -= mLru.back().second->size();
+        mLookup.erase(mLru.back().first);
+        mLru.pop_back();
+        ++mEvictions;
+    }
+}
+
+
+ByteBufferPtr ByteCache::get(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto iter = mLookup.find(key);
+    if(iter == mLookup.end())
+    {
+        ++mMisses;
+        return ByteBufferPtr();
+    }
+
+    ++mHits;
+    mLru.splice(mLru.begin(), mLru, iter->second);
+    return iter->second->second;
+}
+
+void ByteCache::insert(const std::string &key, ByteBufferPtr data)
+{
+    if(!data) return;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(data->size() > mLimit)
+        return;
+
+    auto iter = mLookup.find(key);
+    if(iter != mLookup.end())
+    {
+        // Another thread may have loaded the same data; keep the newest.
+        mBytes -= iter->second->second->size();
+        mLru.erase(iter->second);
+        mLookup.erase(iter);
+    }
+
+    evict(mLimit - data->size());
+
+    mBytes += data->size();
+    mLru.push_front(std::make_pair(key, std::move(data)));
+    mLookup[key] = mLru.begin();
+}
+
+
+void ByteCache::setLimit(size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLimit = limit;
+    evict(mLimit);
+}
+
+size_t ByteCache::getLimit() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mLimit;
+}
+
+
+void ByteCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLookup.clear();
+    mLru.clear();
+    mBytes = 0;
+}
+
+void ByteCache::resetStats()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHits = 0;
+    mMisses = 0;
+    mEvictions = 0;
+}
+
+ByteCache::Stats ByteCache::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    Stats stats;
+    stats.mHits = mHits;
+    stats.mMisses = mMisses;
+    stats.mEvictions = mEvictions;
+    stats.mEntries = mLookup.size();
+    stats.mBytes = mBytes;
+    stats.mLimit = mLimit;
+    return stats;
+}
+
+} // namespace VFS
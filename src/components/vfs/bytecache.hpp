@@ -0,0 +1,72 @@
+#ifndef COMPONENTS_VFS_BYTECACHE_HPP
+#define COMPONENTS_VFS_BYTECACHE_HPP
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <list>
+
+
+namespace VFS
+{
+
+typedef std::shared_ptr<const std::vector<char>> ByteBufferPtr;
+
+/* A size-bounded, least-recently-used cache of whole file contents. Buffers
+ * are shared, so an evicted buffer stays valid for anyone still using it.
+ * All methods are safe to call from multiple threads.
+ */
+class ByteCache {
+public:
+    struct Stats {
+        size_t mHits;
+        size_t mMisses;
+        size_t mEvictions;
+        size_t mEntries;
+        size_t mBytes;
+        size_t mLimit;
+    };
+
+private:
+    typedef std::list<std::pair<std::string,ByteBufferPtr>> LruList;
+
+    LruList mLru; // Most recently used at the front
+    std::unordered_map<std::string,LruList::iterator> mLookup;
+
+    size_t mBytes;
+    size_t mLimit;
+
+    size_t mHits;
+    size_t mMisses;
+    size_t mEvictions;
+
+    mutable std::mutex mMutex;
+
+    void evict(size_t limit);
+
+public:
+    ByteCache(size_t limit);
+
+    /* Returns the cached buffer for the given key, or an empty pointer if
+     * it's not cached.
+     */
+    ByteBufferPtr get(const std::string &key);
+
+    /* Adds a buffer to the cache. Buffers larger than the cache limit are not
+     * stored.
+     */
+    void insert(const std::string &key, ByteBufferPtr data);
+
+    void setLimit(size_t limit);
+    size_t getLimit() const;
+
+    void clear();
+    void resetStats();
+    Stats getStats() const;
+};
+
+} // namespace VFS
+
+#endif /* COMPONENTS_VFS_BYTECACHE_HPP */
@@ -0,0 +1,111 @@
+
+#include "iostats.hpp"
+
+#include <ctime>
+
+
+namespace VFS
+{
+
+IoStats::IoStats() : mEnabled(false)
+{
+}
+
+
+void IoStats::recordRead(const std::string &archive, const std::string &name, size_t bytes,
+                         Source source, std::chrono::nanoseconds time)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    Counters *counters[2] = { &mFiles[archive+":"+name], &mArchives[archive] };
+    for(Counters *c : counters)
+    {
+        ++c->mReads;
+        if(source == Source_Disk)
+            ++c->mDiskReads;
+        c->mBytes += bytes;
+        c->mTime += time;
+    }
+
+    if(mTrace.is_open())
+    {
+        auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - mTraceStart
+        );
+        mTrace<< now.count()<<'\t'<<archive<<'\t'<<name<<'\t'<<bytes<<'\t'
+              << getSourceName(source)<<'\t'<<time.count()<<'\n';
+    }
+}
+
+void IoStats::recordSeeks(const std::string &archive, const std::string &name, size_t seeks)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFiles[archive+":"+name].mSeeks += seeks;
+    mArchives[archive].mSeeks += seeks;
+}
+
+
+bool IoStats::startTrace(const std::string &fname)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mTrace.is_open())
+        mTrace.close();
+
+    mTrace.open(fname.c_str(), std::ios_base::binary);
+    if(!mTrace.is_open())
+        return false;
+
+    std::time_t start_time = std::time(nullptr);
+    mTrace<< "# VFS access trace, started "<<std::ctime(&start_time)
+          << "# time_us\tarchive\tname\tbytes\tsource\ttime_ns\n";
+    mTraceStart = std::chrono::steady_clock::now();
+    mEnabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void IoStats::stopTrace()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTrace.close();
+}
+
+bool IoStats::isTracing() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTrace.is_open();
+}
+
+
+void IoStats::reset()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFiles.clear();
+    mArchives.clear();
+}
+
+std::map<std::string,IoStats::Counters> IoStats::getFileStats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFiles;
+}
+
+std::map<std::string,IoStats::Counters> IoStats::getArchiveStats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mArchives;
+}
+
+
+const char *IoStats::getSourceName(Source source)
+{
+    switch(source)
+    {
+        case Source_Mapped: return "mapped";
+        case Source_Cache: return "cache";
+        case Source_Disk: return "disk";
+        case Source_Missing: return "missing";
+    }
+    return "unknown";
+}
+
+} // namespace VFS
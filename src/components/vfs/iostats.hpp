@@ -0,0 +1,83 @@
+#ifndef COMPONENTS_VFS_IOSTATS_HPP
+#define COMPONENTS_VFS_IOSTATS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+
+namespace VFS
+{
+
+/* Optional instrumentation of VFS reads. When enabled, every read is counted
+ * per file and per archive, and can also be written to a trace file with the
+ * time it happened. All methods are safe to call from multiple threads.
+ */
+class IoStats {
+public:
+    enum Source {
+        Source_Mapped, // Read directly from a mapped archive
+        Source_Cache,  // Found in the byte cache
+        Source_Disk,   // Read from disk
+        Source_Missing // Not found
+    };
+
+    struct Counters {
+        size_t mReads;
+        size_t mDiskReads;
+        uint64_t mBytes;
+        size_t mSeeks;
+        std::chrono::nanoseconds mTime;
+
+        Counters() : mReads(0), mDiskReads(0), mBytes(0), mSeeks(0), mTime(0) { }
+    };
+
+private:
+    std::atomic<bool> mEnabled;
+
+    std::map<std::string,Counters> mFiles;
+    std::map<std::string,Counters> mArchives;
+
+    std::ofstream mTrace;
+    std::chrono::steady_clock::time_point mTraceStart;
+
+    mutable std::mutex mMutex;
+
+public:
+    IoStats();
+
+    void setEnabled(bool enable) { mEnabled.store(enable, std::memory_order_relaxed); }
+    bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+    /* Records a read of the named file from the given archive (or "<loose>"
+     * for loose files).
+     */
+    void recordRead(const std::string &archive, const std::string &name, size_t bytes,
+                    Source source, std::chrono::nanoseconds time);
+    /* Records seeks made on a stream opened for the named file. */
+    void recordSeeks(const std::string &archive, const std::string &name, size_t seeks);
+
+    /* Starts writing each read to the given file, one tab-separated line per
+     * read: microseconds since the trace started, archive, file name, bytes,
+     * source, and nanoseconds taken. Also enables the statistics.
+     */
+    bool startTrace(const std::string &fname);
+    void stopTrace();
+    bool isTracing() const;
+
+    void reset();
+
+    std::map<std::string,Counters> getFileStats() const;
+    std::map<std::string,Counters> getArchiveStats() const;
+
+    static const char *getSourceName(Source source);
+};
+
+} // namespace VFS
+
+#endif /* COMPONENTS_VFS_IOSTATS_HPP */
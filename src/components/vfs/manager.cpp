@@ -14,11 +14,20 @@
 #include <sstream>
 #include <vector>
 #include <set>
+#include <cctype>
+#include <cstring>
+#include <array>
+#include <chrono>
 
 #include <osgDB/Registry>
 
 #include "components/archives/archive.hpp"
 #include "components/archives/bsaarchive.hpp"
+#include "misc/flathashmap.hpp"
+#include "misc/threadpool.hpp"
+
+#include "bytecache.hpp"
+#include "iostats.hpp"
 
 #include "osg_callbacks.hpp"
 
@@ -26,13 +35,282 @@
 namespace
 {
 
+/* Guards the archive list, root paths, and name indices below. Archives are
+ * immutable once loaded, so the lock is only needed to find where a file is;
+ * the actual reading happens without it.
+ */
+std::mutex gMutex;
+
 // FIXME: These really should be Archives...
 std::vector<std::string> gRootPaths;
 std::vector<std::unique_ptr<Archives::Archive>> gArchives;
+std::vector<std::string> gArchiveNames;
 // Architecture and sound archive entries are addressed by ID, so need some
 // special handling.
 Archives::BsaArchive gArchitecture;
 Archives::BsaArchive gSound;
+const std::string gArchitectureName("ARCH3D.BSA");
+const std::string gSoundName("DAGGER.SND");
+
+/* Loose files found in the root paths, mapping the upper-cased relative name
+ * to the full path on disk. Built when a path is added, so looking up a loose
+ * file doesn't need to touch the filesystem.
+ */
+Misc::FlatHashMap<std::string,std::string> gLooseFiles;
+
+/* Sorted list of every name in the archives and root paths, so list() can
+ * answer a pattern with a literal prefix by scanning just the matching range.
+ */
+std::set<std::string> gAllNames;
+
+VFS::ByteCache gCache(64*1024*1024);
+VFS::IoStats gIoStats;
+
+const std::string gLooseName("<loose>");
+
+
+/* Where a read was served from, for the I/O statistics. */
+struct ReadInfo {
+    const std::string *mArchive;
+    VFS::IoStats::Source mSource;
+
+    ReadInfo() : mArchive(&gLooseName), mSource(VFS::IoStats::Source_Missing) { }
+};
+
+
+VFS::ByteBufferPtr readWhole(std::istream &stream)
+{
+    std::shared_ptr<std::vector<char>> data(new std::vector<char>());
+    if(stream.seekg(0, std::ios_base::end))
+    {
+        std::streamoff len = stream.tellg();
+        if(len > 0 && stream.seekg(0))
+        {
+            data->resize(len);
+            stream.read(data->data(), len);
+            data->resize(stream.gcount());
+            return data;
+        }
+    }
+    stream.clear();
+    stream.seekg(0);
+    std::array<char,4096> buf;
+    while(stream.read(buf.data(), buf.size()) || stream.gcount() > 0)
+        data->insert(data->end(), buf.data(), buf.data()+stream.gcount());
+    return data;
+}
+
+VFS::EntryData readFile(const std::string &path)
+{
+    std::ifstream stream(path.c_str(), std::ios_base::binary);
+    if(!stream.good()) return VFS::EntryData();
+    return VFS::EntryData(readWhole(stream));
+}
+
+/* Reads an entry through the cache. On a miss, reader is called to get the
+ * entry's data.
+ */
+template<typename F>
+VFS::EntryData readCached(const std::string &key, ReadInfo &info, F reader)
+{
+    VFS::ByteBufferPtr data = gCache.get(key);
+    if(data)
+    {
+        info.mSource = VFS::IoStats::Source_Cache;
+        return VFS::EntryData(std::move(data));
+    }
+
+    VFS::EntryData entry = reader();
+    if(entry) info.mSource = VFS::IoStats::Source_Disk;
+    gCache.insert(key, entry.getStorage());
+    return entry;
+}
+
+/* Calls reader to read a file, recording the read in the I/O statistics when
+ * they're enabled. The name is only made if it's needed.
+ */
+template<typename F, typename N>
+VFS::EntryData readRecorded(ReadInfo &info, F reader, N getname)
+{
+    if(!gIoStats.isEnabled())
+        return reader();
+
+    auto start = std::chrono::steady_clock::now();
+    VFS::EntryData data = reader();
+    if(!data) info.mSource = VFS::IoStats::Source_Missing;
+    gIoStats.recordRead(*info.mArchive, getname(), data.size(), info.mSource,
+                        std::chrono::steady_clock::now() - start);
+    return data;
+}
+
+
+/* A stream that counts the seeks made on it, for the I/O statistics. */
+class CountingStreamBuf : public Archives::MemoryStreamBuf {
+public:
+    size_t mSeeks;
+
+    CountingStreamBuf(const char *data, size_t size) : MemoryStreamBuf(data, size), mSeeks(0) { }
+
+    virtual pos_type seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode)
+    {
+        // tellg() is a zero seek from the current position, and doesn't move.
+        if(offset != 0 || whence != std::ios_base::cur)
+            ++mSeeks;
+        return MemoryStreamBuf::seekoff(offset, whence, mode);
+    }
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode mode)
+    {
+        ++mSeeks;
+        return MemoryStreamBuf::seekpos(pos, mode);
+    }
+};
+
+class CountingStream : public std::istream {
+    VFS::EntryData mData;
+    CountingStreamBuf mBuffer;
+    std::string mArchive;
+    std::string mName;
+
+public:
+    CountingStream(const VFS::EntryData &data, const std::string &archive, std::string&& name)
+      : std::istream(nullptr), mData(data), mBuffer(data.data(), data.size())
+      , mArchive(archive), mName(std::move(name))
+    {
+        rdbuf(&mBuffer);
+    }
+    ~CountingStream()
+    {
+        if(mBuffer.mSeeks > 0)
+            gIoStats.recordSeeks(mArchive, mName, mBuffer.mSeeks);
+    }
+};
+
+template<typename N>
+VFS::IStreamPtr makeStream(const VFS::EntryData &data, const ReadInfo &info, N getname)
+{
+    if(!data) return VFS::IStreamPtr();
+    if(gIoStats.isEnabled())
+        return VFS::IStreamPtr(new CountingStream(data, *info.mArchive, getname()));
+    return VFS::IStreamPtr(new Archives::EntryDataStream(data));
+}
+
+
+/* Threads for asynchronous opens and prefetching. A couple is enough to keep
+ * the disk busy while the main thread does other work.
+ */
+Misc::ThreadPool &getIoPool()
+{
+    static Misc::ThreadPool pool(2);
+    return pool;
+}
+
+
+bool isDirEntry(const std::string &path, const dirent *ent)
+{
+    if(ent->d_type == DT_DIR)
+        return true;
+    if(ent->d_type != DT_UNKNOWN)
+        return false;
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Converts a requested name into the key used for the loose file index.
+ * Returns false if the name can't be resolved through the index (absolute
+ * paths, or paths that step out of the root), in which case the file system
+ * needs to be checked directly.
+ */
+bool makeLooseKey(const char *name, std::string &key)
+{
+    key.clear();
+    if(name[0] == '/' || name[0] == '\\' || (name[0] && name[1] == ':'))
+        return false;
+
+    while(name[0] == '.' && (name[1] == '/' || name[1] == '\\'))
+        name += 2;
+    for(;*name;++name)
+    {
+        char c = *name;
+        if(c == '\\') c = '/';
+        if(c == '/' && !key.empty() && key.back() == '/')
+            continue;
+        key += std::toupper(static_cast<unsigned char>(c));
+    }
+
+    if(key == ".." || key.compare(0, 3, "../") == 0 || key.find("/../") != std::string::npos ||
+       (key.length() >= 3 && key.compare(key.length()-3, 3, "/..") == 0))
+        return false;
+    return true;
+}
+
+
+/* Finds the named file in the archives or root paths, and reads it. */
+VFS::EntryData readLookup(const char *name, ReadInfo &info)
+{
+    std::unique_lock<std::mutex> lock(gMutex);
+    auto iter = gArchives.rbegin();
+    while(iter != gArchives.rend())
+    {
+        Archives::Archive *archive = iter->get();
+        if(archive->exists(name))
+        {
+            size_t archidx = std::distance(iter, gArchives.rend()) - 1;
+            info.mArchive = &gArchiveNames[archidx];
+            lock.unlock();
+
+            if(archive->isMapped())
+            {
+                info.mSource = VFS::IoStats::Source_Mapped;
+                return archive->readAll(name);
+            }
+            std::string key = "#"+std::to_string(archidx)+":"+name;
+            return readCached(key, info, [archive, name]() { return archive->readAll(name); });
+        }
+        ++iter;
+    }
+
+    std::string key;
+    if(makeLooseKey(name, key))
+    {
+        const std::string *found = gLooseFiles.find(key);
+        if(!found) return VFS::EntryData();
+        std::string path = *found;
+        lock.unlock();
+
+        return readCached(path, info, [&path]() { return readFile(path); });
+    }
+
+    std::vector<std::string> rootpaths = gRootPaths;
+    lock.unlock();
+
+    auto piter = rootpaths.rbegin();
+    while(piter != rootpaths.rend())
+    {
+        VFS::EntryData data = readFile(*piter+name);
+        if(data)
+        {
+            info.mSource = VFS::IoStats::Source_Disk;
+            return data;
+        }
+        ++piter;
+    }
+
+    return VFS::EntryData();
+}
+
+/* Reads an entry from one of the ID-addressed archives. */
+VFS::EntryData readId(Archives::BsaArchive &archive, const std::string &archname, size_t id,
+                      ReadInfo &info)
+{
+    info.mArchive = &archname;
+    if(archive.isMapped())
+    {
+        info.mSource = VFS::IoStats::Source_Mapped;
+        return archive.readAll(id);
+    }
+    return readCached("#"+archname+":"+std::to_string(id), info,
+                      [&archive, id]() { return archive.readAll(id); });
+}
 
 }
 
@@ -54,15 +332,19 @@ void Manager::initialize(std::string&& root_path)
     static const char names[4][16] = {
         "MAPS.BSA", "BLOCKS.BSA", "MONSTER.BSA", "MIDI.BSA"
     };
+    std::lock_guard<std::mutex> lock(gMutex);
     for(size_t i = 0;i < 4;++i)
     {
         std::unique_ptr<Archives::BsaArchive> archive(new Archives::BsaArchive());
         archive->load(root_path+names[i]);
+        gAllNames.insert(archive->list().begin(), archive->list().end());
         gArchives.push_back(std::move(archive));
+        gArchiveNames.push_back(names[i]);
     }
-    gArchitecture.load(root_path+"ARCH3D.BSA");
-    gSound.load(root_path+"DAGGER.SND");
+    gArchitecture.load(root_path+gArchitectureName);
+    gSound.load(root_path+gSoundName);
 
+    index_dir(root_path+".", "");
     gRootPaths.push_back(std::move(root_path));
 
     osgDB::Registry::instance()->setReadFileCallback(new OSGReadCallback());
@@ -74,44 +356,145 @@ void Manager::addDataPath(std::string&& path)
         path += "./";
     else if(path.back() != '/' && path.back() != '\\')
         path += "/";
-    gRootPaths.push_back(std::move(path));
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        index_dir(path+".", "");
+        gRootPaths.push_back(std::move(path));
+    }
+    // Files may now be found where they weren't before.
+    OSGReadCallback::clearCache();
 }
 
 
-IStreamPtr Manager::open(const char *name)
+EntryData Manager::readAll(const char *name)
 {
-    auto iter = gArchives.rbegin();
-    while(iter != gArchives.rend())
-    {
-        IStreamPtr stream((*iter)->open(name));
-        if(stream) return stream;
-        ++iter;
-    }
+    ReadInfo info;
+    return readRecorded(info, [name, &info]() { return readLookup(name, info); },
+                        [name]() { return std::string(name); });
+}
 
-    std::unique_ptr<std::ifstream> stream(new std::ifstream());
-    auto piter = gRootPaths.rbegin();
-    while(piter != gRootPaths.rend())
-    {
-        stream->open((*piter+name).c_str(), std::ios_base::binary);
-        if(stream->good()) return IStreamPtr(std::move(stream));
-        ++piter;
-    }
+EntryData Manager::readSoundId(size_t id)
+{
+    ReadInfo info;
+    return readRecorded(info, [id, &info]() { return readId(gSound, gSoundName, id, info); },
+                        [id]() { return std::to_string(id); });
+}
 
-    return IStreamPtr();
+EntryData Manager::readArchId(size_t id)
+{
+    ReadInfo info;
+    return readRecorded(info, [id, &info]() { return readId(gArchitecture, gArchitectureName, id, info); },
+                        [id]() { return std::to_string(id); });
+}
+
+
+IStreamPtr Manager::open(const char *name)
+{
+    ReadInfo info;
+    auto getname = [name]() { return std::string(name); };
+    EntryData data = readRecorded(info, [name, &info]() { return readLookup(name, info); }, getname);
+    return makeStream(data, info, getname);
 }
 
 IStreamPtr Manager::openSoundId(size_t id)
 {
-    return gSound.open(id);
+    ReadInfo info;
+    auto getname = [id]() { return std::to_string(id); };
+    EntryData data = readRecorded(info, [id, &info]() { return readId(gSound, gSoundName, id, info); },
+                                  getname);
+    return makeStream(data, info, getname);
 }
 
 IStreamPtr Manager::openArchId(size_t id)
 {
-    return gArchitecture.open(id);
+    ReadInfo info;
+    auto getname = [id]() { return std::to_string(id); };
+    EntryData data = readRecorded(info, [id, &info]() { return readId(gArchitecture, gArchitectureName, id, info); },
+                                  getname);
+    return makeStream(data, info, getname);
+}
+
+ByteCache &Manager::getCache()
+{
+    return gCache;
+}
+
+IoStats &Manager::getIoStats()
+{
+    return gIoStats;
 }
 
+
+std::future<IStreamPtr> Manager::openAsync(std::string name)
+{
+    return getIoPool().enqueue([this, name]() { return open(name.c_str()); });
+}
+
+std::future<IStreamPtr> Manager::openArchIdAsync(size_t id)
+{
+    return getIoPool().enqueue([this, id]() { return openArchId(id); });
+}
+
+void Manager::prefetch(const std::vector<std::string> &names)
+{
+    /* Entries of unmapped archives are read together as one batch per
+     * archive, which lets the reads be submitted at once.
+     */
+    std::vector<std::vector<std::string>> batches;
+    std::vector<std::string> others;
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        batches.resize(gArchives.size());
+        for(const std::string &name : names)
+        {
+            auto iter = gArchives.rbegin();
+            while(iter != gArchives.rend() && !(*iter)->exists(name.c_str()))
+                ++iter;
+            if(iter != gArchives.rend() && !(*iter)->isMapped())
+                batches[std::distance(iter, gArchives.rend())-1].push_back(name);
+            else
+                others.push_back(name);
+        }
+    }
+
+    for(size_t i = 0;i < batches.size();++i)
+    {
+        if(batches[i].empty()) continue;
+
+        Archives::Archive *archive = gArchives[i].get();
+        std::vector<std::string> batch = std::move(batches[i]);
+        getIoPool().enqueue([archive, i, batch]()
+        {
+            std::vector<std::vector<char>> data = archive->readBatch(batch);
+            for(size_t j = 0;j < batch.size();++j)
+            {
+                if(data[j].empty()) continue;
+                gCache.insert("#"+std::to_string(i)+":"+batch[j],
+                              std::make_shared<std::vector<char>>(std::move(data[j])));
+            }
+        });
+    }
+
+    for(const std::string &name : others)
+    {
+        getIoPool().enqueue([this, name]()
+        {
+            /* Reading the file fills the cache for unmapped files. For mapped
+             * ones, touch each page to fault it in.
+             */
+            EntryData data = readAll(name.c_str());
+            volatile char sink = 0;
+            for(size_t i = 0;i < data.size();i += 4096)
+                sink = data.data()[i];
+            (void)sink;
+        });
+    }
+}
+
+
 bool Manager::exists(const char *name)
 {
+    std::unique_lock<std::mutex> lock(gMutex);
     auto iter = gArchives.rbegin();
     while(iter != gArchives.rend())
     {
@@ -120,8 +503,15 @@ bool Manager::exists(const char *name)
         ++iter;
     }
 
+    std::string key;
+    if(makeLooseKey(name, key))
+        return gLooseFiles.exists(key);
+
+    std::vector<std::string> rootpaths = gRootPaths;
+    lock.unlock();
+
     std::ifstream file;
-    for(const std::string &path : gRootPaths)
+    for(const std::string &path : rootpaths)
     {
         file.open((path+name).c_str(), std::ios_base::binary);
         if(file.is_open()) return true;
@@ -131,7 +521,7 @@ bool Manager::exists(const char *name)
 }
 
 
-void Manager::add_dir(const std::string &path, const std::string &pre, const char *pattern, std::set<std::string> &names)
+void Manager::index_dir(const std::string &path, const std::string &pre)
 {
     DIR *dir = opendir(path.c_str());
     if(!dir) return;
@@ -142,17 +532,22 @@ void Manager::add_dir(const std::string &path, const std::string &pre, const cha
         if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
             continue;
 
-        if(!S_ISDIR(ent->d_type))
-        {
-            std::string fname = pre + ent->d_name;
-            if(!pattern || fnmatch(pattern, fname.c_str(), 0) == 0)
-                names.insert(fname);
-        }
+        std::string fullpath = path+"/"+ent->d_name;
+        if(isDirEntry(fullpath, ent))
+            index_dir(fullpath, pre+ent->d_name+"/");
         else
         {
-            std::string newpath = path+"/"+ent->d_name;
-            std::string newpre = pre+ent->d_name+"/";
-            add_dir(newpath, newpre, pattern, names);
+            std::string fname = pre+ent->d_name;
+            std::string key;
+            makeLooseKey(fname.c_str(), key);
+            gAllNames.insert(std::move(fname));
+
+            // Paths added later take precedence over earlier ones.
+            std::string *existing = gLooseFiles.find(key);
+            if(existing)
+                *existing = std::move(fullpath);
+            else
+                gLooseFiles.insert(std::move(key), std::move(fullpath));
         }
     }
 
@@ -161,24 +556,23 @@ void Manager::add_dir(const std::string &path, const std::string &pre, const cha
 
 std::set<std::string> Manager::list(const char *pattern) const
 {
-    std::set<std::string> files;
+    std::lock_guard<std::mutex> lock(gMutex);
+    if(!pattern)
+        return gAllNames;
 
-    auto piter = gRootPaths.rbegin();
-    while(piter != gRootPaths.rend())
-    {
-        add_dir(*piter+".", "", pattern, files);
-        ++piter;
-    }
+    /* Only names that start with the pattern's literal prefix can match, so
+     * just check those.
+     */
+    size_t prefixlen = strcspn(pattern, "*?[\\");
+    std::string prefix(pattern, prefixlen);
 
-    auto iter = gArchives.rbegin();
-    while(iter != gArchives.rend())
+    std::set<std::string> files;
+    auto iter = gAllNames.lower_bound(prefix);
+    for(;iter != gAllNames.end() && iter->compare(0, prefixlen, prefix) == 0;++iter)
     {
-        for(const std::string &name : (*iter)->list())
-        {
-            if(!pattern || fnmatch(pattern, name.c_str(), 0) == 0)
-                files.insert(name);
-        }
-        ++iter;
+        bool match = (pattern[prefixlen] == '\0') ? (iter->length() == prefixlen) :
+                     (fnmatch(pattern, iter->c_str(), 0) == 0);
+        if(match) files.insert(files.end(), *iter);
     }
 
     return files;
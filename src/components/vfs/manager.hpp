@@ -6,12 +6,17 @@
 #include <memory>
 #include <string>
 #include <set>
+#include <vector>
+#include <future>
+
+#include "components/archives/archive.hpp"
 
 
 namespace VFS
 {
 
 typedef std::shared_ptr<std::istream> IStreamPtr;
+typedef Archives::EntryData EntryData;
 
 inline uint32_t read_le32(std::istream &stream)
 {
@@ -31,11 +36,17 @@ inline uint16_t read_le16(std::istream &stream)
 }
 
 
+class ByteCache;
+class IoStats;
+
+/* The VFS manager is safe to use from multiple threads once initialize() has
+ * been called.
+ */
 class Manager {
     Manager(const Manager&) = delete;
     Manager& operator=(const Manager&) = delete;
 
-    static void add_dir(const std::string &path, const std::string &pre, const char *pattern, std::set<std::string> &names);
+    static void index_dir(const std::string &path, const std::string &pre);
 
     Manager();
 
@@ -43,6 +54,15 @@ public:
     void initialize(std::string&& root_path=std::string());
     void addDataPath(std::string&& path);
 
+    /* Returns the whole contents of a file as one contiguous buffer, or an
+     * invalid EntryData if it doesn't exist. Parsers that need random access
+     * should prefer this over open(), which just wraps it in a stream.
+     */
+    EntryData readAll(const char *name);
+    EntryData readAll(std::string&& name) { return readAll(name.c_str()); }
+    EntryData readSoundId(size_t id);
+    EntryData readArchId(size_t id);
+
     IStreamPtr open(const char *name);
     IStreamPtr open(std::string&& name) { return open(name.c_str()); }
     IStreamPtr openSoundId(size_t id);
@@ -51,6 +71,23 @@ public:
     bool exists(const char *name);
     std::set<std::string> list(const char *pattern=nullptr) const;
 
+    /* Opens a file on a background I/O thread. */
+    std::future<IStreamPtr> openAsync(std::string name);
+    std::future<IStreamPtr> openArchIdAsync(size_t id);
+
+    /* Reads the given files on background I/O threads, so they're in memory
+     * by the time they're opened.
+     */
+    void prefetch(const std::vector<std::string> &names);
+
+    /* The cache holding the contents of recently opened files that aren't
+     * directly memory-mapped.
+     */
+    ByteCache &getCache();
+
+    /* Statistics on what's been read, when enabled. */
+    IoStats &getIoStats();
+
     static Manager &get()
     {
         static Manager manager;
@@ -4,36 +4,113 @@
 #include <osgDB/Registry>
 #include <osgDB/FileNameUtils>
 
+#include <mutex>
+
+#include "misc/flathashmap.hpp"
+
+
+namespace
+{
+
+/* Maps a lookup (the name plus the search paths it was tried with) to the
+ * path it was found at, or to an empty string if it wasn't found, so repeated
+ * lookups don't need to search the VFS again.
+ */
+std::mutex gPathMutex;
+Misc::FlatHashMap<std::string,std::string> gPathCache;
+
+std::string makeLookupKey(const std::string &fname, const osgDB::FilePathList *optpaths,
+                          const osgDB::FilePathList &regpaths)
+{
+    std::string key = fname;
+    key += '\0';
+    if(optpaths)
+    {
+        for(const auto &path : *optpaths)
+        {
+            key += path;
+            key += '\0';
+        }
+    }
+    key += '\1';
+    for(const auto &path : regpaths)
+    {
+        key += path;
+        key += '\0';
+    }
+    return key;
+}
+
+}
 
 namespace VFS
 {
 
 VFS::IStreamPtr OSGReadCallback::open(const std::string &fname, const osgDB::Options *options)
 {
+    const osgDB::FilePathList *optpaths = options ? &options->getDatabasePathList() : nullptr;
+    const osgDB::FilePathList &regpaths = osgDB::Registry::instance()->getDataFilePathList();
+    std::string key = makeLookupKey(fname, optpaths, regpaths);
+
     VFS::IStreamPtr istream;
+    {
+        std::unique_lock<std::mutex> lock(gPathMutex);
+        const std::string *resolved = gPathCache.find(key);
+        if(resolved)
+        {
+            if(resolved->empty())
+                return istream;
+            std::string path = *resolved;
+            lock.unlock();
+
+            if((istream=VFS::Manager::get().open(path.c_str())))
+                return istream;
+        }
+    }
+
     // try to find the proper path in vfs
+    std::string found;
     if((istream=VFS::Manager::get().open(fname.c_str())))
-        return istream;
-    if(options)
+        found = fname;
+    if(!istream && optpaths)
     {
-        const osgDB::FilePathList &pl = options->getDatabasePathList();
-        for(const auto &path : pl)
+        for(const auto &path : *optpaths)
         {
             std::string searchpath = path + "/" + fname;
             if((istream=VFS::Manager::get().open(searchpath.c_str())))
-                return istream;
+            {
+                found = std::move(searchpath);
+                break;
+            }
         }
     }
-    const osgDB::FilePathList &pl = osgDB::Registry::instance()->getDataFilePathList();
-    for(const auto &path : pl)
+    if(!istream)
     {
-        std::string searchpath = path + "/" + fname;
-        if((istream=VFS::Manager::get().open(searchpath.c_str())))
-            return istream;
+        for(const auto &path : regpaths)
+        {
+            std::string searchpath = path + "/" + fname;
+            if((istream=VFS::Manager::get().open(searchpath.c_str())))
+            {
+                found = std::move(searchpath);
+                break;
+            }
+        }
     }
+
+    std::lock_guard<std::mutex> lock(gPathMutex);
+    if(std::string *resolved = gPathCache.find(key))
+        *resolved = std::move(found);
+    else
+        gPathCache.insert(std::move(key), std::move(found));
     return istream;
 }
 
+void OSGReadCallback::clearCache()
+{
+    std::lock_guard<std::mutex> lock(gPathMutex);
+    gPathCache.clear();
+}
+
 #define WRAP_READER(func)                                                      \
 OSGReadCallback::ReadResult OSGReadCallback::func(const std::string &fname, const osgDB::Options *options)\
 {                                                                              \
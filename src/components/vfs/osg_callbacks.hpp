@@ -27,6 +27,11 @@ class OSGReadCallback : public osgDB::ReadFileCallback {
 
 public:
     OSGReadCallback() { }
+
+    /* Forgets where previously requested files were found (or that they
+     * weren't), for when the VFS contents change.
+     */
+    static void clearCache();
 };
 
 } // namespace VFS
@@ -0,0 +1,214 @@
+
+#include <stdexcept>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+#include <osg/Image>
+
+#include "components/archives/bsaarchive.hpp"
+#include "components/vfs/manager.hpp"
+#include "components/resource/texturemanager.hpp"
+#include "components/resource/assetpack.hpp"
+#include "components/dfosg/meshloader.hpp"
+#include "components/dfosg/meshopt.hpp"
+#include "components/dfosg/texloader.hpp"
+#include "components/dfosg/texcompress.hpp"
+
+
+namespace
+{
+
+/* Converts every ARCH3D.BSA mesh into triangle groups, optionally optimized
+ * as MeshManager does.
+ */
+void packMeshes(Resource::AssetPackWriter &writer, const std::string &root_path, bool optimize)
+{
+    // The VFS doesn't list ARCH3D IDs, so get them from the archive itself.
+    Archives::BsaArchive archive;
+    archive.load(root_path+"ARCH3D.BSA");
+
+    size_t count = 0;
+    DFOSG::MeshOptStats total{0, 0, 0, 0, 0.0f, 0.0f};
+    std::vector<DFOSG::MeshGroup> groups;
+    for(size_t id : archive.getIds())
+    {
+        try {
+            VFS::EntryData data = VFS::Manager::get().readArchId(id);
+            if(!data) throw std::runtime_error("Failed to read");
+
+            Misc::ByteReader reader(data.data(), data.size());
+            DFOSG::Mesh mesh;
+            mesh.load(reader);
+            DFOSG::buildMeshGroups(mesh, groups);
+            if(optimize)
+            {
+                DFOSG::MeshOptStats stats;
+                DFOSG::optimizeMeshGroups(groups, &stats);
+                total.mVertices += stats.mVertices;
+                total.mIndices += stats.mIndices;
+                total.mOptVertices += stats.mOptVertices;
+                total.mOptIndices += stats.mOptIndices;
+            }
+
+            writer.addMesh(id, data.size(), groups);
+            ++count;
+        }
+        catch(std::exception &e) {
+            std::cerr<< "Skipping mesh "<<id<<": "<<e.what() <<std::endl;
+        }
+    }
+    std::cout<< "Packed "<<count<<" meshes" <<std::endl;
+    if(optimize)
+        std::cout<< "  Optimized from "<<total.mVertices<<" vertices and "<<total.mIndices<<" indices, to "
+                 <<total.mOptVertices<<" vertices and "<<total.mOptIndices<<" indices" <<std::endl;
+}
+
+/* Decodes every image of every TEXTURE.??? file with the given palette. Each
+ * is also stored compressed to the given block formats, with mipmaps.
+ */
+void packTextures(Resource::AssetPackWriter &writer, const Resource::Palette &palette,
+                  const std::vector<DFOSG::BlockFormat> &formats)
+{
+    size_t count = 0;
+    for(size_t file = 0;file < 512;++file)
+    {
+        std::stringstream sstr; sstr.fill('0');
+        sstr<<"TEXTURE."<<std::setw(3)<<file;
+        std::string name = sstr.str();
+
+        VFS::EntryData source = VFS::Manager::get().readAll(name.c_str());
+        if(!source) continue;
+
+        std::vector<size_t> indices;
+        std::vector<DFOSG::ImagePtrArray> allimages;
+        std::vector<DFOSG::TexImageInfo> info;
+        try {
+            size_t numimages = DFOSG::TexLoader::get().getImageCount(file<<7);
+            for(size_t i = 0;i < numimages && i < 128;++i)
+                indices.push_back((file<<7) | i);
+            allimages = DFOSG::TexLoader::get().loadBatch(indices, palette, &info);
+        }
+        catch(std::exception &e) {
+            std::cerr<< "Skipping "<<name<<": "<<e.what() <<std::endl;
+            continue;
+        }
+
+        for(size_t i = 0;i < indices.size();++i)
+        {
+            size_t idx = indices[i];
+            const DFOSG::ImagePtrArray &images = allimages[i];
+            if(images.empty()) continue;
+
+            Resource::PackedTexture tex;
+            tex.mXOffset = info[i].mXOffset;
+            tex.mYOffset = info[i].mYOffset;
+            tex.mXScale = info[i].mXScale;
+            tex.mYScale = info[i].mYScale;
+            tex.mWidth = images[0]->s();
+            tex.mHeight = images[0]->t();
+            tex.mFrameCount = images.size();
+
+            std::vector<unsigned char> pixels;
+            pixels.reserve(tex.getFrameSize() * tex.mFrameCount);
+            for(const osg::ref_ptr<osg::Image> &image : images)
+            {
+                if(size_t(image->s()) != tex.mWidth || size_t(image->t()) != tex.mHeight ||
+                   image->getTotalSizeInBytes() != tex.getFrameSize())
+                    break;
+                pixels.insert(pixels.end(), image->data(), image->data()+tex.getFrameSize());
+            }
+            if(pixels.size() != tex.getFrameSize() * tex.mFrameCount)
+            {
+                std::cerr<< "Skipping "<<name<<" image "<<i<<": mismatched frames" <<std::endl;
+                continue;
+            }
+            tex.mPixels = pixels.data();
+
+            writer.addTexture(idx, source.size(), tex);
+            ++count;
+
+            for(DFOSG::BlockFormat format : formats)
+            {
+                Resource::PackedTexture ctex = tex;
+                std::vector<unsigned char> blocks;
+                DFOSG::CompressedImage compressed;
+                for(size_t f = 0;f < tex.mFrameCount;++f)
+                {
+                    DFOSG::compressImageMips(format, tex.mPixels + f*tex.getFrameSize(), tex.mWidth,
+                                             tex.mHeight, compressed);
+                    blocks.insert(blocks.end(), compressed.mData.begin(), compressed.mData.end());
+                }
+                ctex.mFormat = format;
+                ctex.mMipCount = compressed.mMipOffsets.size();
+                ctex.mPixels = blocks.data();
+
+                writer.addTexture(idx, source.size(), ctex);
+            }
+        }
+    }
+    std::cout<< "Packed "<<count<<" textures" <<std::endl;
+}
+
+}
+
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3)
+    {
+        std::cerr<< "Usage: "<<argv[0]<<" <data root> <output pack> [option]" <<std::endl
+                 << "  Available options:" <<std::endl
+                 << "    -lz4  - Compress entries with LZ4" <<std::endl
+                 << "    -bc1  - Also store textures compressed to BC1, with mipmaps" <<std::endl
+                 << "    -bc3  - Also store textures compressed to BC3, with mipmaps" <<std::endl
+                 << "    -nomeshopt - Store meshes without welding and reordering vertices" <<std::endl
+                 <<std::endl;
+        return 1;
+    }
+
+    std::string root_path = argv[1];
+    std::string packname = argv[2];
+    bool compress = false;
+    bool meshopt = true;
+    std::vector<DFOSG::BlockFormat> formats;
+    for(int i = 3;i < argc;++i)
+    {
+        if(strcmp(argv[i], "-lz4") == 0)
+            compress = true;
+        else if(strcmp(argv[i], "-bc1") == 0)
+            formats.push_back(DFOSG::Block_BC1);
+        else if(strcmp(argv[i], "-bc3") == 0)
+            formats.push_back(DFOSG::Block_BC3);
+        else if(strcmp(argv[i], "-nomeshopt") == 0)
+            meshopt = false;
+        else
+            throw std::runtime_error(std::string("Invalid option: ")+argv[i]);
+    }
+
+    if(!root_path.empty() && root_path.back() != '/' && root_path.back() != '\\')
+        root_path += "/";
+
+    auto start = std::chrono::steady_clock::now();
+
+    VFS::Manager::get().initialize(std::string(root_path));
+    Resource::TextureManager::get().initialize();
+
+    Resource::AssetPackWriter writer(packname, Resource::TextureManager::get().getCurrentPalette(),
+                                     compress);
+    packMeshes(writer, root_path, meshopt);
+    packTextures(writer, Resource::TextureManager::get().getCurrentPalette(), formats);
+    writer.finish();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start
+    );
+    std::cout<< "Wrote "<<writer.getEntryCount()<<" entries to "<<packname<<", "
+             <<(writer.getStoredBytes()/1024)<<" KiB ("<<(writer.getRawBytes()/1024)<<" KiB raw) in "
+             <<elapsed.count()<<"ms" <<std::endl;
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+#ifndef MISC_FLATHASHMAP_HPP
+#define MISC_FLATHASHMAP_HPP
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+
+namespace Misc
+{
+
+/* Hash functor usable with both std::string and const char* keys, so a
+ * string-keyed map can be searched without constructing a temporary string.
+ * Uses 64-bit FNV-1a, which is fast and good enough for short file names.
+ */
+struct FlatHash {
+    static uint64_t hash(const char *str, size_t len)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for(size_t i = 0;i < len;++i)
+        {
+            h ^= static_cast<unsigned char>(str[i]);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    size_t operator()(const std::string &str) const
+    { return static_cast<size_t>(hash(str.data(), str.length())); }
+    size_t operator()(const char *str) const
+    { return static_cast<size_t>(hash(str, strlen(str))); }
+
+    size_t operator()(size_t key) const
+    {
+        // Integer finalizer from MurmurHash3, to spread sequential IDs.
+        uint64_t h = key;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return static_cast<size_t>(h);
+    }
+};
+
+
+/* A hash map using open addressing with linear probing, storing keys and
+ * values in a single flat array.
+ *
+ * This is intended for lookup tables that are built once and then queried
+ * many times (e.g. archive entry tables), so it only supports insertion and
+ * lookup. The table is kept at most half full, so a probe sequence is short
+ * and only touches a cache line or two, unlike a node-based map.
+ */
+template<typename Key, typename Value, typename Hasher=FlatHash>
+class FlatHashMap {
+    struct Slot {
+        Key mKey;
+        Value mValue;
+        bool mUsed;
+
+        Slot() : mKey(), mValue(), mUsed(false) { }
+    };
+
+    std::vector<Slot> mSlots;
+    size_t mMask;
+    size_t mSize;
+    Hasher mHasher;
+
+    void grow()
+    {
+        reserve(mSlots.empty() ? 8 : mSlots.size());
+    }
+
+    template<typename K>
+    size_t findSlot(const K &key) const
+    {
+        if(mSlots.empty())
+            return mSlots.size();
+
+        size_t pos = mHasher(key) & mMask;
+        while(mSlots[pos].mUsed)
+        {
+            if(mSlots[pos].mKey == key)
+                return pos;
+            pos = (pos+1) & mMask;
+        }
+        return mSlots.size();
+    }
+
+public:
+    FlatHashMap() : mMask(0), mSize(0) { }
+
+    bool empty() const { return mSize == 0; }
+    size_t size() const { return mSize; }
+
+    void clear()
+    {
+        mSlots.clear();
+        mMask = 0;
+        mSize = 0;
+    }
+
+    /* Reserves space for at least count entries without rehashing. */
+    void reserve(size_t count)
+    {
+        size_t newsize = 16;
+        while(newsize < count*2)
+            newsize <<= 1;
+        if(newsize <= mSlots.size())
+            return;
+
+        std::vector<Slot> oldslots;
+        oldslots.swap(mSlots);
+
+        mSlots.resize(newsize);
+        mMask = mSlots.size() - 1;
+        mSize = 0;
+        for(Slot &slot : oldslots)
+        {
+            if(slot.mUsed)
+                insert(std::move(slot.mKey), std::move(slot.mValue));
+        }
+    }
+
+    /* Inserts the given key and value. Returns false if the key already
+     * exists, in which case the existing value is left alone.
+     */
+    bool insert(Key key, Value value)
+    {
+        if((mSize+1)*2 > mSlots.size())
+            grow();
+
+        size_t pos = mHasher(key) & mMask;
+        while(mSlots[pos].mUsed)
+        {
+            if(mSlots[pos].mKey == key)
+                return false;
+            pos = (pos+1) & mMask;
+        }
+
+        mSlots[pos].mKey = std::move(key);
+        mSlots[pos].mValue = std::move(value);
+        mSlots[pos].mUsed = true;
+        ++mSize;
+        return true;
+    }
+
+    /* Returns a pointer to the value for the given key, or nullptr if it
+     * doesn't exist.
+     */
+    template<typename K>
+    const Value *find(const K &key) const
+    {
+        size_t pos = findSlot(key);
+        return (pos < mSlots.size()) ? &mSlots[pos].mValue : nullptr;
+    }
+    template<typename K>
+    Value *find(const K &key)
+    {
+        size_t pos = findSlot(key);
+        return (pos < mSlots.size()) ? &mSlots[pos].mValue : nullptr;
+    }
+
+    template<typename K>
+    bool exists(const K &key) const
+    { return findSlot(key) < mSlots.size(); }
+};
+
+} // namespace Misc
+
+#endif /* MISC_FLATHASHMAP_HPP */
@@ -0,0 +1,233 @@
+#ifndef MISC_RECORD_HPP
+#define MISC_RECORD_HPP
+
+#include <type_traits>
+#include <stdexcept>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <array>
+
+
+namespace Misc
+{
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+constexpr bool IsLittleEndian = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+#elif defined(_WIN32) || defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+constexpr bool IsLittleEndian = true;
+#else
+/* Unknown byte order. Byte-swapping is correct for either, just slower. */
+constexpr bool IsLittleEndian = false;
+#endif
+
+
+/* Decodes a little-endian integer of type T. */
+template<typename T>
+inline T decodeLE(const char *src)
+{
+    static_assert(std::is_integral<T>::value, "Only integral types can be decoded");
+
+    T ret;
+    if(IsLittleEndian || sizeof(T) == 1)
+        memcpy(&ret, src, sizeof(T));
+    else
+    {
+        typedef typename std::make_unsigned<T>::type UT;
+        UT val = 0;
+        for(size_t i = 0;i < sizeof(T);++i)
+            val |= static_cast<UT>(static_cast<unsigned char>(src[i])) << (i*8);
+        memcpy(&ret, &val, sizeof(T));
+    }
+    return ret;
+}
+
+
+/* Describes how a value stored in a file as FileT is decoded into a member of
+ * type MemberT. Raw() is true when the in-memory representation is identical
+ * to the file's, so the value can simply be copied.
+ */
+template<typename FileT, typename MemberT>
+struct FieldCodec {
+    static constexpr size_t size() { return sizeof(FileT); }
+    static constexpr bool raw()
+    { return std::is_same<FileT,MemberT>::value && (IsLittleEndian || sizeof(FileT) == 1); }
+
+    static void decode(MemberT &dst, const char *src)
+    { dst = static_cast<MemberT>(decodeLE<FileT>(src)); }
+};
+
+template<typename FileT, typename MemberT, size_t N>
+struct FieldCodec<FileT[N], MemberT[N]> {
+    typedef FieldCodec<FileT,MemberT> ElemCodec;
+
+    static constexpr size_t size() { return ElemCodec::size() * N; }
+    static constexpr bool raw() { return ElemCodec::raw(); }
+
+    static void decode(MemberT (&dst)[N], const char *src)
+    {
+        if(raw())
+            memcpy(&dst[0], src, size());
+        else for(size_t i = 0;i < N;++i)
+            ElemCodec::decode(dst[i], src + i*ElemCodec::size());
+    }
+};
+
+template<typename FileT, typename MemberT, size_t N>
+struct FieldCodec<std::array<FileT,N>, std::array<MemberT,N>> {
+    typedef FieldCodec<FileT,MemberT> ElemCodec;
+
+    static constexpr size_t size() { return ElemCodec::size() * N; }
+    static constexpr bool raw()
+    { return ElemCodec::raw() && sizeof(std::array<MemberT,N>) == size(); }
+
+    static void decode(std::array<MemberT,N> &dst, const char *src)
+    {
+        if(raw())
+            memcpy(dst.data(), src, size());
+        else for(size_t i = 0;i < N;++i)
+            ElemCodec::decode(dst[i], src + i*ElemCodec::size());
+    }
+};
+
+
+/* A field of a record, read from the file as FileT into the given member. */
+template<typename FileT, typename C, typename MemberT, MemberT C::*Member>
+struct Field {
+    typedef FieldCodec<FileT,MemberT> Codec;
+
+    static constexpr size_t size() { return Codec::size(); }
+
+    static void decode(C &obj, const char *src)
+    { Codec::decode(obj.*Member, src); }
+};
+
+/* Unused or unknown bytes in a record. */
+template<size_t N>
+struct Skip {
+    static constexpr size_t size() { return N; }
+
+    template<typename C>
+    static void decode(C&, const char*) { }
+};
+
+
+/* A fixed-size record layout, made of Fields and Skips in file order. The
+ * size and each field's offset are compile-time constants, so decoding a
+ * record compiles down to a series of fixed-offset loads. On little-endian
+ * hosts, each field is copied directly (which the compiler merges for
+ * adjacent fields), and byte-swapped otherwise.
+ */
+template<typename... Fields>
+struct Record;
+
+template<>
+struct Record<> {
+    static constexpr size_t size() { return 0; }
+
+    template<typename C>
+    static void decode(C&, const char*) { }
+};
+
+template<typename F, typename... Rest>
+struct Record<F, Rest...> {
+    static constexpr size_t size() { return F::size() + Record<Rest...>::size(); }
+
+    template<typename C>
+    static void decode(C &obj, const char *src)
+    {
+        F::decode(obj, src);
+        Record<Rest...>::decode(obj, src + F::size());
+    }
+};
+
+#define RECORD_FIELD(cls, member) \
+    ::Misc::Field<decltype(cls::member), cls, decltype(cls::member), &cls::member>
+#define RECORD_FIELD_AS(type, cls, member) \
+    ::Misc::Field<type, cls, decltype(cls::member), &cls::member>
+
+
+/* Reads values and records from a block of memory. All reads are bounds-
+ * checked, throwing a runtime_error instead of going past the end.
+ */
+class ByteReader {
+    const char *mData;
+    size_t mSize;
+    size_t mPos;
+
+    void check(size_t len) const
+    {
+        if(len > mSize-mPos)
+            throw std::runtime_error("Attempted to read past the end of data");
+    }
+
+public:
+    ByteReader(const char *data, size_t size) : mData(data), mSize(size), mPos(0) { }
+
+    const char *data() const { return mData; }
+    size_t size() const { return mSize; }
+
+    size_t tell() const { return mPos; }
+    size_t remaining() const { return mSize - mPos; }
+    bool eof() const { return mPos >= mSize; }
+
+    void seek(size_t pos)
+    {
+        if(pos > mSize)
+            throw std::runtime_error("Attempted to seek past the end of data");
+        mPos = pos;
+    }
+    void skip(size_t len)
+    {
+        check(len);
+        mPos += len;
+    }
+
+    /* Reads a little-endian integer. */
+    template<typename T>
+    T get()
+    {
+        check(sizeof(T));
+        T ret = decodeLE<T>(mData+mPos);
+        mPos += sizeof(T);
+        return ret;
+    }
+
+    void read(void *dst, size_t len)
+    {
+        check(len);
+        memcpy(dst, mData+mPos, len);
+        mPos += len;
+    }
+
+    /* Reads a record using the layout R. */
+    template<typename R, typename C>
+    void read(C &obj)
+    {
+        check(R::size());
+        R::decode(obj, mData+mPos);
+        mPos += R::size();
+    }
+
+    /* Reads a record using the object's own layout (C::Schema). */
+    template<typename C>
+    void read(C &obj)
+    { read<typename C::Schema>(obj); }
+
+    /* Reads count consecutive records, checking the bounds only once. */
+    template<typename C>
+    void readArray(C *objs, size_t count)
+    {
+        typedef typename C::Schema R;
+        if(count > remaining() / R::size())
+            throw std::runtime_error("Attempted to read past the end of data");
+        const char *src = mData+mPos;
+        for(size_t i = 0;i < count;++i)
+            R::decode(objs[i], src + i*R::size());
+        mPos += count * R::size();
+    }
+};
+
+} // namespace Misc
+
+#endif /* MISC_RECORD_HPP */
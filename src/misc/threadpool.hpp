@@ -0,0 +1,98 @@
+#ifndef MISC_THREADPOOL_HPP
+#define MISC_THREADPOOL_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <algorithm>
+
+
+namespace Misc
+{
+
+/* A simple fixed-size pool of worker threads, which run queued jobs in the
+ * order they're submitted. Destroying the pool finishes any queued jobs
+ * before joining the threads.
+ */
+class ThreadPool {
+    std::vector<std::thread> mThreads;
+    std::deque<std::function<void()>> mJobs;
+
+    std::mutex mMutex;
+    std::condition_variable mCondVar;
+    bool mQuit;
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while(1)
+        {
+            while(mJobs.empty() && !mQuit)
+                mCondVar.wait(lock);
+            if(mJobs.empty())
+                break;
+
+            std::function<void()> job = std::move(mJobs.front());
+            mJobs.pop_front();
+
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+public:
+    /* Creates a pool with the given number of threads. If 0, the number of
+     * hardware threads is used.
+     */
+    explicit ThreadPool(size_t count=0) : mQuit(false)
+    {
+        if(count == 0)
+            count = std::max(1u, std::thread::hardware_concurrency());
+        mThreads.reserve(count);
+        for(size_t i = 0;i < count;++i)
+            mThreads.emplace_back(&ThreadPool::worker, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQuit = true;
+        }
+        mCondVar.notify_all();
+        for(std::thread &thrd : mThreads)
+            thrd.join();
+    }
+
+    size_t size() const { return mThreads.size(); }
+
+    /* Queues a job to run on a worker thread, and returns a future for its
+     * result. Any exception thrown by the job is stored in the future.
+     */
+    template<typename F>
+    auto enqueue(F&& func) -> std::future<decltype(func())>
+    {
+        typedef decltype(func()) ResultT;
+        auto task = std::make_shared<std::packaged_task<ResultT()>>(std::forward<F>(func));
+        std::future<ResultT> ret = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJobs.push_back([task]() { (*task)(); });
+        }
+        mCondVar.notify_one();
+        return ret;
+    }
+};
+
+} // namespace Misc
+
+#endif /* MISC_THREADPOOL_HPP */
@@ -2,6 +2,7 @@
 #include "engine.hpp"
 
 #include <stdexcept>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -24,10 +25,16 @@
 
 #include "components/sdlutil/graphicswindow.hpp"
 #include "components/vfs/manager.hpp"
+#include "components/vfs/bytecache.hpp"
+#include "components/vfs/iostats.hpp"
 #include "components/settings/configfile.hpp"
 #include "components/resource/texturemanager.hpp"
 #include "components/resource/meshmanager.hpp"
+#include "components/resource/assetpack.hpp"
+#include "components/resource/resourcecache.hpp"
 #include "components/dfosg/meshloader.hpp"
+#include "components/dfosg/meshopt.hpp"
+#include "components/dfosg/palexpand.hpp"
 
 #include "render/pipeline.hpp"
 #include "gui/iface.hpp"
@@ -126,6 +133,31 @@ namespace DF
 CVAR(CVarInt, vid_width, 1280, 0);
 CVAR(CVarInt, vid_height, 720, 0);
 CVAR(CVarBool, vid_fullscreen, false);
+// Size limit, in megabytes, for the VFS cache of file contents
+CVAR(CVarInt, vfs_cachesize, 64, 0, 4096);
+// Preconverted asset pack (made with dfpack), used in place of the original
+// data when present
+CVAR(CVarString, vfs_assetpack, "opendf.pak");
+// Collect VFS I/O statistics from startup (see vfsstats)
+CVAR(CVarBool, vfs_stats, false);
+// Upload textures as 8-bit palette indices, with the shaders looking up the
+// colors (takes effect on restart)
+CVAR(CVarBool, r_indexedtextures, false);
+// Block compression for textures, one of none, bc1, or bc3 (takes effect on
+// restart, and not with r_indexedtextures)
+CVAR(CVarString, r_texcompression, "none");
+// Memory budget, in megabytes, for meshes and textures kept loaded after
+// they're no longer used (see rescache)
+CVAR(CVarInt, r_cachesize, 256, 0, 4096);
+// Decode textures on background threads, showing them blank until they're
+// loaded (takes effect on restart)
+CVAR(CVarBool, r_asynctextures, true);
+// Kilobytes of texture data to upload per frame when loading in the
+// background
+CVAR(CVarInt, r_uploadbudget, 4096, 64, 65536);
+// Weld and reorder model vertices when loading them (takes effect on restart,
+// see meshopt)
+CVAR(CVarBool, r_meshopt, true);
 
 CCMD(qqq)
 {
@@ -160,6 +192,321 @@ CCMD(savecfg)
     CVar::writeAll(ocfg);
 }
 
+CCMD(vfscache)
+{
+    VFS::ByteCache &cache = VFS::Manager::get().getCache();
+    if(params == "reset")
+    {
+        cache.resetStats();
+        Log::get().message("VFS cache statistics reset");
+        return;
+    }
+    if(params == "clear")
+    {
+        cache.clear();
+        Log::get().message("VFS cache cleared");
+        return;
+    }
+    if(!params.empty())
+    {
+        Log::get().stream(Log::Level_Error)<< "Usage: vfscache [reset|clear]";
+        return;
+    }
+
+    VFS::ByteCache::Stats stats = cache.getStats();
+    size_t lookups = stats.mHits + stats.mMisses;
+    Log::get().stream()<< "VFS cache: "<<stats.mEntries<<" entries, "<<(stats.mBytes/1024)<<" of "<<(stats.mLimit/1024)<<" KiB\n"
+                       << "  hits: "<<stats.mHits<<", misses: "<<stats.mMisses<<", evictions: "<<stats.mEvictions<<"\n"
+                       << "  hit rate: "<<(lookups ? stats.mHits*100/lookups : 0)<<"%";
+}
+
+CCMD(rescache)
+{
+    Resource::ResourceCache &cache = Resource::ResourceCache::get();
+    if(params == "reset")
+    {
+        cache.resetStats();
+        Log::get().message("Resource cache statistics reset");
+        return;
+    }
+    if(params == "clear")
+    {
+        cache.clear();
+        Log::get().message("Resource cache cleared");
+        return;
+    }
+    if(!params.empty())
+    {
+        Log::get().stream(Log::Level_Error)<< "Usage: rescache [reset|clear]";
+        return;
+    }
+
+    size_t total = 0;
+    std::stringstream sstr;
+    for(size_t i = 0;i < Resource::ResourceCache::Type_Count;++i)
+    {
+        Resource::ResourceCache::Type type = static_cast<Resource::ResourceCache::Type>(i);
+        Resource::ResourceCache::Stats stats = cache.getStats(type);
+        size_t lookups = stats.mHits + stats.mMisses;
+        sstr<< "\n  "<<Resource::ResourceCache::getTypeName(type)<<": "<<stats.mEntries<<" held, "
+            <<(stats.mBytes/1024)<<" KiB, hits: "<<stats.mHits<<", misses: "<<stats.mMisses
+            <<", evictions: "<<stats.mEvictions<<", hit rate: "<<(lookups ? stats.mHits*100/lookups : 0)<<"%";
+        total += stats.mBytes;
+    }
+    Log::get().stream()<< "Resource cache: "<<(total/1024)<<" of "<<(cache.getLimit()/1024)<<" KiB"
+                       << sstr.str();
+}
+
+CCMD(texdedup)
+{
+    Resource::TextureManager &texmgr = Resource::TextureManager::get();
+    if(params == "reset")
+    {
+        texmgr.resetDedupStats();
+        Log::get().message("Texture dedup statistics reset");
+        return;
+    }
+    if(!params.empty())
+    {
+        Log::get().stream(Log::Level_Error)<< "Usage: texdedup [reset]";
+        return;
+    }
+
+    Resource::TextureManager::DedupStats stats = texmgr.getDedupStats();
+    Log::get().stream()<< "Texture dedup: "<<stats.mIndices<<" textures loaded using "<<stats.mTextures
+                       << " objects, "<<(stats.mSavedBytes/1024)<<" KiB saved"
+                       << "\n  since reset: "<<stats.mHits<<" shared, "<<(stats.mHitBytes/1024)<<" KiB not loaded";
+}
+
+CCMD(meshopt)
+{
+    // Reports what optimizing does to the given model, or each loaded one.
+    std::vector<size_t> ids;
+    if(!params.empty())
+    {
+        size_t id;
+        std::stringstream pstr(params);
+        if(!(pstr>>id) || !pstr.eof())
+        {
+            Log::get().stream(Log::Level_Error)<< "Usage: meshopt [ARCH3D ID]";
+            return;
+        }
+        ids.push_back(id);
+    }
+    else
+        ids = Resource::MeshManager::get().getLoadedModels();
+
+    std::stringstream sstr;
+    sstr<< std::fixed<<std::setprecision(2);
+    auto report = [&sstr](const std::string &label, const DFOSG::MeshOptStats &stats)
+    {
+        sstr<< "\n  "<<label<<": "<<stats.mVertices<<" -> "<<stats.mOptVertices<<" vertices, "
+            <<stats.mIndices<<" -> "<<stats.mOptIndices<<" indices, ACMR "
+            <<stats.mACMR<<" -> "<<stats.mOptACMR;
+    };
+
+    DFOSG::MeshOptStats total{0, 0, 0, 0, 0.0f, 0.0f};
+    float misses = 0.0f, optmisses = 0.0f;
+    size_t count = 0;
+    for(size_t id : ids)
+    {
+        std::vector<DFOSG::MeshGroup> groups;
+        try {
+            std::unique_ptr<DFOSG::Mesh> mesh(DFOSG::MeshLoader::get().load(id));
+            DFOSG::buildMeshGroups(*mesh, groups);
+        }
+        catch(std::exception &e) {
+            Log::get().stream(Log::Level_Error)<< "Failed to load model "<<id<<": "<<e.what();
+            continue;
+        }
+
+        if(ids.size() == 1)
+        {
+            // Show each texture's group of a single model.
+            for(DFOSG::MeshGroup &group : groups)
+            {
+                std::vector<DFOSG::MeshGroup> single(1, group);
+                DFOSG::MeshOptStats stats;
+                DFOSG::optimizeMeshGroups(single, &stats);
+                report("texture "+std::to_string(group.mTextureId)+" ("+
+                       std::to_string(DFOSG::getIndexSize(stats.mOptVertices)*8)+"-bit)", stats);
+            }
+        }
+
+        DFOSG::MeshOptStats stats;
+        DFOSG::optimizeMeshGroups(groups, &stats);
+        report("model "+std::to_string(id), stats);
+
+        total.mVertices += stats.mVertices;
+        total.mIndices += stats.mIndices;
+        total.mOptVertices += stats.mOptVertices;
+        total.mOptIndices += stats.mOptIndices;
+        // Sum the cache misses, to average over all triangles.
+        misses += stats.mACMR * (stats.mIndices/3);
+        optmisses += stats.mOptACMR * (stats.mOptIndices/3);
+        ++count;
+    }
+    if(count > 1)
+    {
+        total.mACMR = total.mIndices ? misses / (total.mIndices/3) : 0.0f;
+        total.mOptACMR = total.mOptIndices ? optmisses / (total.mOptIndices/3) : 0.0f;
+        report("total", total);
+    }
+
+    Log::get().stream()<< "Mesh optimization ("<<count<<" models, "
+                       <<(Resource::MeshManager::get().getOptimize() ? "enabled" : "disabled")<<"):"
+                       << sstr.str();
+}
+
+CCMD(vfsstats)
+{
+    VFS::IoStats &stats = VFS::Manager::get().getIoStats();
+
+    std::string cmd = params.substr(0, params.find(' '));
+    std::string arg = (cmd.length() < params.length()) ? params.substr(cmd.length()+1) : std::string();
+    if(cmd == "reset")
+    {
+        stats.reset();
+        Log::get().message("VFS statistics reset");
+        return;
+    }
+    if(cmd == "on" || cmd == "off")
+    {
+        stats.setEnabled(cmd == "on");
+        Log::get().stream()<< "VFS statistics "<<(stats.isEnabled() ? "enabled" : "disabled");
+        return;
+    }
+    if(cmd == "trace")
+    {
+        if(arg.empty() || arg == "off")
+        {
+            stats.stopTrace();
+            Log::get().message("VFS trace stopped");
+        }
+        else if(stats.startTrace(arg))
+            Log::get().stream()<< "Writing VFS trace to "<<arg;
+        else
+            Log::get().stream(Log::Level_Error)<< "Failed to open "<<arg;
+        return;
+    }
+    if(!params.empty())
+    {
+        Log::get().stream(Log::Level_Error)<< "Usage: vfsstats [on|off|reset|trace <file>|trace off]";
+        return;
+    }
+
+    if(!stats.isEnabled())
+        Log::get().message("VFS statistics are disabled (use \"vfsstats on\")");
+
+    auto print = [](std::ostream &out, const std::string &name, const VFS::IoStats::Counters &c)
+    {
+        out<< "\n  "<<name<<": "<<c.mReads<<" reads ("<<c.mDiskReads<<" from disk), "
+           <<(c.mBytes/1024)<<" KiB, "<<c.mSeeks<<" seeks, "
+           <<std::chrono::duration_cast<std::chrono::microseconds>(c.mTime).count()<<"us";
+    };
+
+    std::stringstream sstr;
+    sstr<< "VFS archives:";
+    for(const auto &archive : stats.getArchiveStats())
+        print(sstr, archive.first, archive.second);
+
+    // Show the files that took the most time.
+    std::map<std::string,VFS::IoStats::Counters> files = stats.getFileStats();
+    std::vector<std::pair<std::string,VFS::IoStats::Counters>> sorted(files.begin(), files.end());
+    std::sort(sorted.begin(), sorted.end(),
+        [](const std::pair<std::string,VFS::IoStats::Counters> &lhs,
+           const std::pair<std::string,VFS::IoStats::Counters> &rhs)
+        { return lhs.second.mTime > rhs.second.mTime; }
+    );
+    if(sorted.size() > 20)
+        sorted.resize(20);
+
+    sstr<< "\nVFS files ("<<files.size()<<" total, slowest "<<sorted.size()<<"):";
+    for(const auto &file : sorted)
+        print(sstr, file.first, file.second);
+    Log::get().message(sstr.str());
+}
+
+CCMD(texbench)
+{
+    // Expands the raw bytes of a TEXTURE file as if they were all palette
+    // indices, comparing the original per-channel loop with each kernel.
+    size_t file = 302;
+    if(!params.empty())
+    {
+        std::stringstream pstr(params);
+        if(!(pstr>>file) || file > 511)
+        {
+            Log::get().stream(Log::Level_Error)<< "Usage: texbench [TEXTURE file number]";
+            return;
+        }
+    }
+
+    std::stringstream name; name.fill('0');
+    name<<"TEXTURE."<<std::setw(3)<<file;
+    VFS::EntryData data = VFS::Manager::get().readAll(name.str());
+    if(!data)
+    {
+        Log::get().stream(Log::Level_Error)<< "Failed to open "<<name.str();
+        return;
+    }
+
+    const Resource::Palette &palette = Resource::TextureManager::get().getCurrentPalette();
+    const uint8_t *src = reinterpret_cast<const uint8_t*>(data.data());
+    const size_t count = data.size();
+    const size_t iterations = std::max<size_t>(1, (64<<20) / count);
+
+    std::vector<unsigned char> reference(count * 4);
+    std::vector<unsigned char> output(count * 4);
+
+    std::stringstream sstr;
+    sstr<< "Expanding "<<name.str()<<" ("<<count<<" bytes) "<<iterations<<" times:";
+    auto report = [&sstr, count, iterations](const char *label, std::chrono::steady_clock::duration time)
+    {
+        auto us = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(time).count());
+        sstr<< "\n  "<<std::setw(10)<<label<<": "<<(us/1000)<<"ms, "
+            <<(uint64_t(count)*iterations/us)<<" Mpixels/s";
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0;i < iterations;++i)
+    {
+        unsigned char *dst = reference.data();
+        for(size_t x = 0;x < count;++x)
+        {
+            const Resource::PaletteEntry &color = palette[src[x]];
+            *(dst++) = color.r;
+            *(dst++) = color.g;
+            *(dst++) = color.b;
+            *(dst++) = (src[x]==0) ? 0 : 255;
+        }
+    }
+    report("original", std::chrono::steady_clock::now() - start);
+
+    DFOSG::PaletteLUT lut;
+    DFOSG::buildPaletteLUT(palette, lut);
+    for(int k = 0;k < DFOSG::Kernel_Count;++k)
+    {
+        DFOSG::PaletteKernel kernel = static_cast<DFOSG::PaletteKernel>(k);
+        if(!DFOSG::isPaletteKernelSupported(kernel))
+        {
+            sstr<< "\n  "<<std::setw(10)<<DFOSG::getPaletteKernelName(kernel)<<": unsupported";
+            continue;
+        }
+
+        std::fill(output.begin(), output.end(), 0);
+        start = std::chrono::steady_clock::now();
+        for(size_t i = 0;i < iterations;++i)
+            DFOSG::expandPalette(kernel, src, count, lut, output.data());
+        report(DFOSG::getPaletteKernelName(kernel), std::chrono::steady_clock::now() - start);
+
+        if(output != reference)
+            sstr<< " (MISMATCH)";
+    }
+    sstr<< "\n  Using "<<DFOSG::getPaletteKernelName(DFOSG::getPaletteKernel());
+    Log::get().message(sstr.str());
+}
+
 
 Engine::Engine(void)
   : mSDLWindow(nullptr)
@@ -366,6 +713,8 @@ bool Engine::go(void)
         }
 
         Log::get().stream()<< "  Setting root path "<<root_path<<"...";
+        VFS::Manager::get().getCache().setLimit(size_t(*vfs_cachesize) * 1024*1024);
+        VFS::Manager::get().getIoStats().setEnabled(*vfs_stats);
         VFS::Manager::get().initialize(root_path.c_str());
 
         Settings::ConfigMultiEntryRange paths = cf.getMultiOptionRange("data");
@@ -386,6 +735,18 @@ bool Engine::go(void)
         }
     }
 
+    if(!vfs_assetpack->empty())
+    {
+        try {
+            if(Resource::AssetPack::get().open(*vfs_assetpack))
+                Log::get().stream()<< "  Using asset pack "<<*vfs_assetpack<<" ("<<
+                                      Resource::AssetPack::get().getEntryCount()<<" entries)...";
+        }
+        catch(std::exception &e) {
+            Log::get().stream(Log::Level_Error)<< "  Ignoring asset pack: "<<e.what();
+        }
+    }
+
     // Configure
     osg::ref_ptr<osgViewer::Viewer> viewer;
     {
@@ -449,9 +810,19 @@ bool Engine::go(void)
     SDL_ShowCursor(0);
 
     Log::get().message("Initializing Texture Manager...");
+    Resource::ResourceCache::get().setLimit(size_t(*r_cachesize) * 1024*1024);
+    Resource::TextureManager::get().setIndexed(*r_indexedtextures);
+    Resource::TextureManager::get().setAsync(*r_asynctextures);
+    if(*r_texcompression == "bc1")
+        Resource::TextureManager::get().setCompression(Resource::TextureManager::Compress_BC1);
+    else if(*r_texcompression == "bc3")
+        Resource::TextureManager::get().setCompression(Resource::TextureManager::Compress_BC3);
+    else if(*r_texcompression != "none")
+        Log::get().stream(Log::Level_Error)<< "Unknown texture compression \""<<*r_texcompression<<"\"";
     Resource::TextureManager::get().initialize();
 
     Log::get().message("Initializing Mesh Manager...");
+    Resource::MeshManager::get().setOptimize(*r_meshopt);
     Resource::MeshManager::get().initialize();
 
     Log::get().message("Initializing Input...");
@@ -524,6 +895,9 @@ bool Engine::go(void)
 
         WorldIface::get().update(timediff);
 
+        Resource::TextureManager::get().setUploadBudget(size_t(*r_uploadbudget) * 1024);
+        Resource::TextureManager::get().update();
+
         viewer->frame(timediff);
     }
     Log::get().message("Main loop shutting down...");
@@ -60,6 +60,26 @@ enum ObjectType {
     ObjectType_Flat = 0x03,
 };
 
+/* An entry in an object list, linking to the object's own data. */
+struct ObjectHeader {
+    int32_t mNext;
+    int32_t mPrev;
+    int32_t mX, mY, mZ;
+    uint8_t mType;
+    uint32_t mObjectOffset;
+
+    typedef Misc::Record<
+        RECORD_FIELD(ObjectHeader, mNext),
+        RECORD_FIELD(ObjectHeader, mPrev),
+        RECORD_FIELD(ObjectHeader, mX),
+        RECORD_FIELD(ObjectHeader, mY),
+        RECORD_FIELD(ObjectHeader, mZ),
+        RECORD_FIELD(ObjectHeader, mType),
+        RECORD_FIELD(ObjectHeader, mObjectOffset)
+    > Schema;
+};
+static_assert(ObjectHeader::Schema::size() == 25, "Unexpected ObjectHeader size");
+
 
 template<typename T>
 void getActionData(const std::array<uint8_t,5> &data, osg::Vec3f &amount, float &duration)
@@ -94,9 +114,19 @@ struct ModelObject : public ObjectBase {
 
     std::array<char,8> mModelData;
 
+    typedef Misc::Record<
+        RECORD_FIELD(ModelObject, mXRot),
+        RECORD_FIELD(ModelObject, mYRot),
+        RECORD_FIELD(ModelObject, mZRot),
+        RECORD_FIELD(ModelObject, mModelIdx),
+        RECORD_FIELD(ModelObject, mActionFlags),
+        RECORD_FIELD(ModelObject, mSoundId),
+        RECORD_FIELD(ModelObject, mActionOffset)
+    > Schema;
+
     ModelObject(size_t id, int x, int y, int z) : ObjectBase(id, ObjectType_Model, x, y, z) { }
 
-    void load(std::istream &stream, const std::array<std::array<char,8>,750> &mdldata,
+    void load(Misc::ByteReader &reader, const std::array<std::array<char,8>,750> &mdldata,
               size_t regnum, size_t locnum, const osg::Vec3 &basepos);
 
     virtual void print(std::ostream &stream) const final;
@@ -111,27 +141,40 @@ struct FlatObject : public ObjectBase {
                       // It's also used on non-monster flats too, though, particularly
                       // those with associated actions.
 
+    typedef Misc::Record<
+        RECORD_FIELD(FlatObject, mTexture),
+        RECORD_FIELD(FlatObject, mGender),
+        RECORD_FIELD(FlatObject, mFactionId),
+        RECORD_FIELD(FlatObject, mActionOffset),
+        RECORD_FIELD(FlatObject, mUnknown)
+    > Schema;
+
     FlatObject(size_t id, int x, int y, int z) : ObjectBase(id, ObjectType_Flat, x, y, z) { }
 
-    void load(std::istream &stream, const osg::Vec3 &basepos);
+    void load(Misc::ByteReader &reader, const osg::Vec3 &basepos);
 
     virtual void print(std::ostream &stream) const final;
 };
 
 
+static_assert(ModelObject::Schema::size() == 23, "Unexpected ModelObject size");
+static_assert(FlatObject::Schema::size() == 11, "Unexpected FlatObject size");
+static_assert(DBlockHeader::Schema::size() == 9036, "Unexpected DBlockHeader size");
+
+
 ObjectBase::~ObjectBase()
 {
     Activator::get().deallocate(mId);
     Animated::get().deallocate(mId);
 }
 
-void ObjectBase::loadAction(std::istream &stream, int32_t actionoffset, uint32_t actionflags, uint8_t soundid, const osg::Vec3 &pos, const osg::Vec3f &rot)
+void ObjectBase::loadAction(Misc::ByteReader &reader, int32_t actionoffset, uint32_t actionflags, uint8_t soundid, const osg::Vec3 &pos, const osg::Vec3f &rot)
 {
     std::array<uint8_t,5> adata;
-    stream.seekg(actionoffset);
-    stream.read(reinterpret_cast<char*>(adata.data()), adata.size());
-    int32_t target = VFS::read_le32(stream);
-    uint8_t type = stream.get();
+    reader.seek(actionoffset);
+    reader.read(adata.data(), adata.size());
+    int32_t target = reader.get<int32_t>();
+    uint8_t type = reader.get<uint8_t>();
 
     size_t link = ~static_cast<size_t>(0);
     if(target > 0)
@@ -175,22 +218,15 @@ void ObjectBase::print(std::ostream &stream) const
 }
 
 
-void ModelObject::load(std::istream &stream, const std::array<std::array<char,8>,750> &mdldata, size_t regnum, size_t locnum, const osg::Vec3 &basepos)
+void ModelObject::load(Misc::ByteReader &reader, const std::array<std::array<char,8>,750> &mdldata, size_t regnum, size_t locnum, const osg::Vec3 &basepos)
 {
-    mXRot = VFS::read_le32(stream);
-    mYRot = VFS::read_le32(stream);
-    mZRot = VFS::read_le32(stream);
-
-    mModelIdx = VFS::read_le16(stream);
-    mActionFlags = VFS::read_le32(stream);
-    mSoundId = stream.get();
-    mActionOffset = VFS::read_le32(stream);
+    reader.read(*this);
 
     mModelData = mdldata.at(mModelIdx);
 
     osg::Vec3 pos = basepos + osg::Vec3(mXPos, mYPos, mZPos);
     if(mActionOffset > 0)
-        loadAction(stream, mActionOffset, mActionFlags, mSoundId, pos, osg::Vec3(mXRot, mYRot, mZRot));
+        loadAction(reader, mActionOffset, mActionFlags, mSoundId, pos, osg::Vec3(mXRot, mYRot, mZRot));
 
     if(mModelData[0] == -1)
         return;
@@ -229,17 +265,13 @@ void ModelObject::print(std::ostream &stream) const
 }
 
 
-void FlatObject::load(std::istream &stream, const osg::Vec3 &basepos)
+void FlatObject::load(Misc::ByteReader &reader, const osg::Vec3 &basepos)
 {
-    mTexture = VFS::read_le16(stream);
-    mGender = VFS::read_le16(stream);
-    mFactionId = VFS::read_le16(stream);
-    mActionOffset = VFS::read_le32(stream);
-    mUnknown = stream.get();
+    reader.read(*this);
 
     osg::Vec3 pos = basepos + osg::Vec3(mXPos, mYPos, mZPos);
     if(mActionOffset > 0)
-        loadAction(stream, mActionOffset, 0x02, 0, pos, osg::Vec3());
+        loadAction(reader, mActionOffset, 0x02, 0, pos, osg::Vec3());
 
     size_t numframes = 0;
     osg::ref_ptr<osg::MatrixTransform> node(new osg::MatrixTransform());
@@ -284,73 +316,54 @@ DBlockHeader::~DBlockHeader()
 }
 
 
-void DBlockHeader::load(std::istream &stream, size_t blockid, float x, float z, size_t regnum, size_t locnum)
+void DBlockHeader::load(Misc::ByteReader &reader, size_t blockid, float x, float z, size_t regnum, size_t locnum)
 {
-    mUnknown1 = VFS::read_le32(stream);
-    mWidth = VFS::read_le32(stream);
-    mHeight = VFS::read_le32(stream);
-    mObjectRootOffset = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    stream.read(mModelData[0].data(), sizeof(mModelData));
-    for(uint32_t &val : mUnknown3)
-        val = VFS::read_le32(stream);
-
-    mUnknownOffset = VFS::read_le32(stream);
-    mUnknown4 = VFS::read_le32(stream);
-    mUnknown5 = VFS::read_le32(stream);
-    mUnknown6 = VFS::read_le32(stream);
+    reader.read(*this);
 
     {
         // Seems to be one entry for each valid ModelData....
         int32_t offset = mUnknownOffset;
-        while(stream.good() && offset > 0)
+        while(offset > 0 && size_t(offset)+4 <= reader.size())
         {
-            stream.seekg(offset);
-            offset = VFS::read_le32(stream);
+            reader.seek(offset);
+            offset = reader.get<int32_t>();
             mUnknownList.push_back(offset);
         }
     }
 
-    stream.clear();
-    stream.seekg(mObjectRootOffset);
+    reader.seek(mObjectRootOffset);
 
     std::vector<int32_t> rootoffsets(mWidth*mHeight);
     for(int32_t &val : rootoffsets)
-        val = VFS::read_le32(stream);
+        val = reader.get<int32_t>();
 
     osg::Vec3 basepos(x, 0.0f, z);
     for(int32_t offset : rootoffsets)
     {
         while(offset > 0)
         {
-            stream.seekg(offset);
-            int32_t next = VFS::read_le32(stream);
-            /*int32_t prev =*/ VFS::read_le32(stream);
-
-            int32_t x = VFS::read_le32(stream);
-            int32_t y = VFS::read_le32(stream);
-            int32_t z = VFS::read_le32(stream);
-            uint8_t type = stream.get();
-            uint32_t objoffset = VFS::read_le32(stream);
+            ObjectHeader objhdr;
+            reader.seek(offset);
+            reader.read(objhdr);
 
-            if(type == ObjectType_Model)
+            if(objhdr.mType == ObjectType_Model)
             {
-                stream.seekg(objoffset);
+                reader.seek(objhdr.mObjectOffset);
                 ModelObject *model = mModels.insert(blockid|offset,
-                    std::unique_ptr<ModelObject>(new ModelObject(blockid|offset, x, y, z))
+                    std::unique_ptr<ModelObject>(new ModelObject(blockid|offset, objhdr.mX, objhdr.mY, objhdr.mZ))
                 ).first->get();
-                model->load(stream, mModelData, regnum, locnum, basepos);
+                model->load(reader, mModelData, regnum, locnum, basepos);
             }
-            else if(type == ObjectType_Flat)
+            else if(objhdr.mType == ObjectType_Flat)
             {
-                stream.seekg(objoffset);
+                reader.seek(objhdr.mObjectOffset);
                 FlatObject *flat = mFlats.insert(blockid|offset,
-                    std::unique_ptr<FlatObject>(new FlatObject(blockid|offset, x, y, z))
+                    std::unique_ptr<FlatObject>(new FlatObject(blockid|offset, objhdr.mX, objhdr.mY, objhdr.mZ))
                 ).first->get();
-                flat->load(stream, basepos);
+                flat->load(reader, basepos);
             }
 
-            offset = next;
+            offset = objhdr.mNext;
         }
     }
 }
@@ -7,6 +7,7 @@
 #include <array>
 
 #include "misc/sparsearray.hpp"
+#include "misc/record.hpp"
 #include "referenceable.hpp"
 
 
@@ -30,7 +31,7 @@ struct ObjectBase {
     ObjectBase(size_t id, uint8_t type, int x, int y, int z) : mId(id), mType(type), mXPos(x), mYPos(y), mZPos(z) { }
     virtual ~ObjectBase();
 
-    void loadAction(std::istream &stream, int32_t actionoffset, uint32_t actionflags, uint8_t soundid, const osg::Vec3f &pos, const osg::Vec3f &rot);
+    void loadAction(Misc::ByteReader &reader, int32_t actionoffset, uint32_t actionflags, uint8_t soundid, const osg::Vec3f &pos, const osg::Vec3f &rot);
 
     virtual void print(std::ostream &stream) const;
 };
@@ -62,10 +63,24 @@ struct DBlockHeader {
     Misc::SparseArray<std::unique_ptr<ModelObject>> mModels;
     Misc::SparseArray<std::unique_ptr<FlatObject>> mFlats;
 
+    typedef Misc::Record<
+        RECORD_FIELD(DBlockHeader, mUnknown1),
+        RECORD_FIELD(DBlockHeader, mWidth),
+        RECORD_FIELD(DBlockHeader, mHeight),
+        RECORD_FIELD(DBlockHeader, mObjectRootOffset),
+        RECORD_FIELD(DBlockHeader, mUnknown2),
+        RECORD_FIELD(DBlockHeader, mModelData),
+        RECORD_FIELD(DBlockHeader, mUnknown3),
+        RECORD_FIELD(DBlockHeader, mUnknownOffset),
+        RECORD_FIELD(DBlockHeader, mUnknown4),
+        RECORD_FIELD(DBlockHeader, mUnknown5),
+        RECORD_FIELD(DBlockHeader, mUnknown6)
+    > Schema;
+
     DBlockHeader();
     ~DBlockHeader();
 
-    void load(std::istream &stream, size_t blockid, float x, float z, size_t regnum, size_t locnum);
+    void load(Misc::ByteReader &reader, size_t blockid, float x, float z, size_t regnum, size_t locnum);
 
     ObjectBase *getObject(size_t id);
 
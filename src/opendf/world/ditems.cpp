@@ -11,23 +11,17 @@
 namespace DF
 {
 
-void DungeonInterior::load(std::istream &stream)
+static_assert(DungeonBlock::Schema::size() == 4, "Unexpected DungeonBlock size");
+static_assert(DungeonInterior::Schema::size() == 17, "Unexpected DungeonInterior size");
+
+void DungeonInterior::load(Misc::ByteReader &reader)
 {
-    LocationHeader::load(stream);
+    LocationHeader::load(reader);
 
-    mNullValue = VFS::read_le16(stream);
-    mUnknown1 = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    mBlockCount = VFS::read_le16(stream);
-    stream.read(reinterpret_cast<char*>(mUnknown3), sizeof(mUnknown3));
+    reader.read<Schema>(*this);
 
     mBlocks.resize(mBlockCount);
-    for(DungeonBlock &block : mBlocks)
-    {
-        block.mX = stream.get();
-        block.mZ = stream.get();
-        block.mBlockNumberStartIndex = VFS::read_le16(stream);
-    }
+    reader.readArray(mBlocks.data(), mBlocks.size());
 }
 
 LogStream& operator<<(LogStream &stream, const DungeonInterior &dgn)
@@ -18,6 +18,12 @@ struct DungeonBlock {
             uint16_t mBlockPreIndex : 5;
         };
     };
+
+    typedef Misc::Record<
+        RECORD_FIELD(DungeonBlock, mX),
+        RECORD_FIELD(DungeonBlock, mZ),
+        RECORD_FIELD(DungeonBlock, mBlockNumberStartIndex)
+    > Schema;
 };
 
 struct DungeonInterior : public LocationHeader {
@@ -29,7 +35,16 @@ struct DungeonInterior : public LocationHeader {
 
     std::vector<DungeonBlock> mBlocks;
 
-    void load(std::istream &stream);
+    /* Follows the location header. */
+    typedef Misc::Record<
+        RECORD_FIELD(DungeonInterior, mNullValue),
+        RECORD_FIELD(DungeonInterior, mUnknown1),
+        RECORD_FIELD(DungeonInterior, mUnknown2),
+        RECORD_FIELD(DungeonInterior, mBlockCount),
+        RECORD_FIELD(DungeonInterior, mUnknown3)
+    > Schema;
+
+    void load(Misc::ByteReader &reader);
 };
 LogStream& operator<<(LogStream &stream, const DungeonInterior &dgn);
 
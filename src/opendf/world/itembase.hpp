@@ -5,6 +5,8 @@
 #include <iostream>
 #include <stdint.h>
 
+#include "misc/record.hpp"
+
 
 namespace DF
 {
@@ -17,6 +19,14 @@ struct LocationDoor {
     uint8_t mUnknownMask;
     uint8_t mUnknown1;
     uint8_t mUnknown2;
+
+    typedef Misc::Record<
+        RECORD_FIELD(LocationDoor, mBuildingDataIndex),
+        RECORD_FIELD(LocationDoor, mNullValue),
+        RECORD_FIELD(LocationDoor, mUnknownMask),
+        RECORD_FIELD(LocationDoor, mUnknown1),
+        RECORD_FIELD(LocationDoor, mUnknown2)
+    > Schema;
 };
 
 struct LocationHeader {
@@ -43,7 +53,29 @@ struct LocationHeader {
     char mLocationName[32];
     uint8_t mUnknown3[9];
 
-    void load(std::istream &stream);
+    /* Follows the door list. */
+    typedef Misc::Record<
+        RECORD_FIELD(LocationHeader, mAlwaysOne1),
+        RECORD_FIELD(LocationHeader, mNullValue1),
+        RECORD_FIELD(LocationHeader, mNullValue2),
+        RECORD_FIELD(LocationHeader, mX),
+        RECORD_FIELD(LocationHeader, mNullValue3),
+        RECORD_FIELD(LocationHeader, mY),
+        RECORD_FIELD(LocationHeader, mIsExterior),
+        RECORD_FIELD(LocationHeader, mNullValue4),
+        RECORD_FIELD(LocationHeader, mUnknown1),
+        RECORD_FIELD(LocationHeader, mUnknown2),
+        RECORD_FIELD(LocationHeader, mAlwaysOne2),
+        RECORD_FIELD(LocationHeader, mLocationId),
+        RECORD_FIELD(LocationHeader, mNullValue5),
+        RECORD_FIELD(LocationHeader, mIsInterior),
+        RECORD_FIELD(LocationHeader, mExteriorLocationId),
+        RECORD_FIELD(LocationHeader, mNullValue6),
+        RECORD_FIELD(LocationHeader, mLocationName),
+        RECORD_FIELD(LocationHeader, mUnknown3)
+    > Schema;
+
+    void load(Misc::ByteReader &reader);
 };
 LogStream& operator<<(LogStream &stream, const LocationHeader &loc);
 
@@ -21,11 +21,20 @@
 namespace DF
 {
 
+#define MOBJECT_POSITION                \
+    RECORD_FIELD(MObjectBase, mXPos),   \
+    RECORD_FIELD(MObjectBase, mYPos),   \
+    RECORD_FIELD(MObjectBase, mZPos)
+
 struct MSection3 : public MObjectBase {
     uint16_t mUnknown1;
     uint16_t mUnknown2;
 
-    void load(std::istream &stream);
+    typedef Misc::Record<
+        MOBJECT_POSITION,
+        RECORD_FIELD(MSection3, mUnknown1),
+        RECORD_FIELD(MSection3, mUnknown2)
+    > Schema;
 };
 
 struct MDoor : public MObjectBase {
@@ -34,7 +43,13 @@ struct MDoor : public MObjectBase {
     uint16_t mUnknown2;
     uint8_t mNullValue;
 
-    void load(std::istream &stream);
+    typedef Misc::Record<
+        MOBJECT_POSITION,
+        RECORD_FIELD(MDoor, mUnknown1),
+        RECORD_FIELD(MDoor, mRotation),
+        RECORD_FIELD(MDoor, mUnknown2),
+        RECORD_FIELD(MDoor, mNullValue)
+    > Schema;
 };
 
 struct MFlat : public MObjectBase {
@@ -42,7 +57,13 @@ struct MFlat : public MObjectBase {
     uint16_t mUnknown;
     uint8_t mFlags;
 
-    void load(std::istream &stream);
+    typedef Misc::Record<
+        MOBJECT_POSITION,
+        RECORD_FIELD(MFlat, mTexture),
+        RECORD_FIELD(MFlat, mUnknown),
+        RECORD_FIELD(MFlat, mFlags)
+    > Schema;
+
     void allocate(const osg::Vec3 &pos, const osg::Quat &ori);
 
     virtual void print(std::ostream &stream) const;
@@ -52,7 +73,11 @@ struct MPerson : public MObjectBase {
     uint16_t mTexture;
     uint16_t mFactionId;
 
-    void load(std::istream &stream);
+    typedef Misc::Record<
+        MOBJECT_POSITION,
+        RECORD_FIELD(MPerson, mTexture),
+        RECORD_FIELD(MPerson, mFactionId)
+    > Schema;
 };
 
 struct MModel : public MObjectBase {
@@ -72,7 +97,27 @@ struct MModel : public MObjectBase {
     uint32_t mUnknown8;
     uint16_t mNullValue4;
 
-    void load(std::istream &stream);
+    /* Follows the model index, which is stored as le16*100 + byte. */
+    typedef Misc::Record<
+        RECORD_FIELD(MModel, mUnknown1),
+        RECORD_FIELD(MModel, mUnknown2),
+        RECORD_FIELD(MModel, mUnknown3),
+        RECORD_FIELD(MModel, mUnknown4),
+        RECORD_FIELD(MModel, mNullValue1),
+        RECORD_FIELD(MModel, mNullValue2),
+        RECORD_FIELD(MModel, mUnknownX),
+        RECORD_FIELD(MModel, mUnknownY),
+        RECORD_FIELD(MModel, mUnknownZ),
+        MOBJECT_POSITION,
+        RECORD_FIELD(MModel, mNullValue3),
+        RECORD_FIELD(MModel, mYRotation),
+        RECORD_FIELD(MModel, mUnknown5),
+        RECORD_FIELD(MModel, mUnknown6),
+        RECORD_FIELD(MModel, mUnknown8),
+        RECORD_FIELD(MModel, mNullValue4)
+    > Schema;
+
+    void load(Misc::ByteReader &reader);
     void allocate(const osg::Vec3 &pos, const osg::Quat &ori);
 
     virtual void print(std::ostream &stream) const;
@@ -98,9 +143,23 @@ struct MBlock {
     std::vector<MPerson>   mNpcs;
     std::vector<MDoor>     mDoors;
 
+    typedef Misc::Record<
+        RECORD_FIELD(MBlock, mModelCount),
+        RECORD_FIELD(MBlock, mFlatCount),
+        RECORD_FIELD(MBlock, mSection3Count),
+        RECORD_FIELD(MBlock, mPersonCount),
+        RECORD_FIELD(MBlock, mDoorCount),
+        RECORD_FIELD(MBlock, mUnknown1),
+        RECORD_FIELD(MBlock, mUnknown2),
+        RECORD_FIELD(MBlock, mUnknown3),
+        RECORD_FIELD(MBlock, mUnknown4),
+        RECORD_FIELD(MBlock, mUnknown5),
+        RECORD_FIELD(MBlock, mUnknown6)
+    > Schema;
+
     ~MBlock() { deallocate(); }
 
-    void load(std::istream &stream, size_t blockid);
+    void load(Misc::ByteReader &reader, size_t blockid);
 
     void allocate(const osg::Vec3 &pos, const osg::Quat &ori);
     void deallocate();
@@ -109,43 +168,21 @@ struct MBlock {
 };
 
 
-void MObjectBase::load(std::istream &stream)
-{
-    mXPos = VFS::read_le32(stream);
-    mYPos = VFS::read_le32(stream);
-    mZPos = VFS::read_le32(stream);
-}
+static_assert(MSection3::Schema::size() == 16, "Unexpected MSection3 size");
+static_assert(MDoor::Schema::size() == 19, "Unexpected MDoor size");
+static_assert(MFlat::Schema::size() == 17, "Unexpected MFlat size");
+static_assert(MPerson::Schema::size() == 16, "Unexpected MPerson size");
+static_assert(MModel::Schema::size()+3 == 66, "Unexpected MModel size");
+static_assert(MBlock::Schema::size() == 17, "Unexpected MBlock size");
+static_assert(MBlockPosition::Schema::size() == 20, "Unexpected MBlockPosition size");
+static_assert(MBlockHeader::MapSchema::size() == 5301, "Unexpected MBlockHeader map size");
+
 
 void MObjectBase::print(std::ostream &stream) const
 {
     stream<< "Pos: "<<mXPos<<" "<<mYPos<<" "<<mZPos<<"\n";
 }
 
-void MSection3::load(std::istream &stream)
-{
-    MObjectBase::load(stream);
-    mUnknown1 = VFS::read_le16(stream);
-    mUnknown2 = VFS::read_le16(stream);
-}
-
-void MDoor::load(std::istream &stream)
-{
-    MObjectBase::load(stream);
-    mUnknown1 = VFS::read_le16(stream);
-    mRotation = VFS::read_le16(stream);
-    mUnknown2 = VFS::read_le16(stream);
-    mNullValue = stream.get();
-}
-
-
-void MFlat::load(std::istream &stream)
-{
-    MObjectBase::load(stream);
-    mTexture = VFS::read_le16(stream);
-    mUnknown = VFS::read_le16(stream);
-    mFlags = stream.get();
-}
-
 void MFlat::allocate(const osg::Vec3 &pos, const osg::Quat &ori)
 {
     size_t numframes = 0;
@@ -170,36 +207,11 @@ void MFlat::print(std::ostream &stream) const
 }
 
 
-void MPerson::load(std::istream &stream)
+void MModel::load(Misc::ByteReader &reader)
 {
-    MObjectBase::load(stream);
-    mTexture = VFS::read_le16(stream);
-    mFactionId = VFS::read_le16(stream);
-}
-
-
-void MModel::load(std::istream &stream)
-{
-    mModelIdx  = (int)VFS::read_le16(stream) * 100;
-    mModelIdx += stream.get();
-    mUnknown1 = stream.get();
-    mUnknown2 = VFS::read_le32(stream);
-    mUnknown3 = VFS::read_le32(stream);
-    mUnknown4 = VFS::read_le32(stream);
-    mNullValue1 = VFS::read_le32(stream);
-    mNullValue2 = VFS::read_le32(stream);
-    mUnknownX = VFS::read_le32(stream);
-    mUnknownY = VFS::read_le32(stream);
-    mUnknownZ = VFS::read_le32(stream);
-    mXPos = VFS::read_le32(stream);
-    mYPos = VFS::read_le32(stream);
-    mZPos = VFS::read_le32(stream);
-    mNullValue3 = VFS::read_le32(stream);
-    mYRotation = VFS::read_le16(stream);
-    mUnknown5 = VFS::read_le16(stream);
-    mUnknown6 = VFS::read_le32(stream);
-    mUnknown8 = VFS::read_le32(stream);
-    mNullValue4 = VFS::read_le16(stream);
+    mModelIdx  = (int)reader.get<uint16_t>() * 100;
+    mModelIdx += reader.get<uint8_t>();
+    reader.read(*this);
 }
 
 void MModel::allocate(const osg::Vec3 &pos, const osg::Quat &ori)
@@ -237,43 +249,30 @@ void MModel::print(std::ostream &stream) const
 }
 
 
-void MBlock::load(std::istream &stream, size_t blockid)
+void MBlock::load(Misc::ByteReader &reader, size_t blockid)
 {
-    mModelCount = stream.get();
-    mFlatCount = stream.get();
-    mSection3Count = stream.get();
-    mPersonCount = stream.get();
-    mDoorCount = stream.get();
-    mUnknown1 = VFS::read_le16(stream);
-    mUnknown2 = VFS::read_le16(stream);
-    mUnknown3 = VFS::read_le16(stream);
-    mUnknown4 = VFS::read_le16(stream);
-    mUnknown5 = VFS::read_le16(stream);
-    mUnknown6 = VFS::read_le16(stream);
+    reader.read(*this);
 
     mModels.reserve(mModelCount);
     for(size_t i = 0;i < mModelCount;++i)
     {
         MModel &model = mModels[blockid | i];
         model.mId = blockid | i;
-        model.load(stream);
+        model.load(reader);
     }
     mFlats.reserve(mFlatCount);
     for(size_t i = 0;i < mFlatCount;++i)
     {
         MFlat &flat = mFlats[blockid | (mModelCount+i)];
         flat.mId = blockid | (mModelCount+i);
-        flat.load(stream);
+        reader.read(flat);
     }
     mSection3s.resize(mSection3Count);
-    for(MSection3 &sec3 : mSection3s)
-        sec3.load(stream);
+    reader.readArray(mSection3s.data(), mSection3s.size());
     mNpcs.resize(mPersonCount);
-    for(MPerson &npc : mNpcs)
-        npc.load(stream);
+    reader.readArray(mNpcs.data(), mNpcs.size());
     mDoors.resize(mDoorCount);
-    for(MDoor &door : mDoors)
-        door.load(stream);
+    reader.readArray(mDoors.data(), mDoors.size());
 }
 
 void MBlock::allocate(const osg::Vec3 &pos, const osg::Quat &ori)
@@ -307,16 +306,6 @@ MObjectBase *MBlock::getObject(size_t id)
 }
 
 
-void MBlockPosition::load(std::istream &stream)
-{
-    mUnknown1 = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    mX = VFS::read_le32(stream);
-    mZ = VFS::read_le32(stream);
-    mYRot = VFS::read_le32(stream);
-}
-
-
 MBlockHeader::MBlockHeader() : mTerrainId(~static_cast<size_t>(0)) { }
 MBlockHeader::~MBlockHeader()
 {
@@ -349,7 +338,7 @@ void MBlockHeader::deallocate()
 }
 
 
-void MBlockHeader::load(std::istream &stream, uint8_t climate, size_t blockid, float x, float z)
+void MBlockHeader::load(Misc::ByteReader &reader, uint8_t climate, size_t blockid, float x, float z)
 {
     size_t texfile = 0;
     if(climate == 223) texfile = 502<<7;
@@ -363,47 +352,20 @@ void MBlockHeader::load(std::istream &stream, uint8_t climate, size_t blockid, f
     else if(climate == 231) texfile = 508<<7;
     else if(climate == 232) texfile = 508<<7;
 
-    mBlockCount = stream.get();
-    mModelCount = stream.get();
-    mFlatCount = stream.get();
-
-    for(MBlockPosition &blockpos : mBlockPositions)
-        blockpos.load(stream);
-    for(ExteriorBuilding &building : mBuildings)
-    {
-        building.mNameSeed = VFS::read_le16(stream);
-        building.mNullValue1 = VFS::read_le32(stream);
-        building.mNullValue2 = VFS::read_le32(stream);
-        building.mNullValue3 = VFS::read_le32(stream);
-        building.mNullValue4 = VFS::read_le32(stream);
-        building.mFactionId = VFS::read_le16(stream);
-        building.mSector = VFS::read_le16(stream);
-        building.mLocationId = VFS::read_le16(stream);
-        building.mBuildingType = stream.get();
-        building.mQuality = stream.get();
-    }
-    for(uint32_t &unknown : mUnknown1)
-        unknown = VFS::read_le32(stream);
-    for(uint32_t &size : mBlockSizes)
-        size = VFS::read_le32(stream);
-
-    stream.read(reinterpret_cast<char*>(mUnknown2.data()), mUnknown2.size());
-    stream.read(reinterpret_cast<char*>(mGroundTexture.data()), mGroundTexture.size());
-    stream.read(reinterpret_cast<char*>(mGroundScenery.data()), mGroundScenery.size());
-    stream.read(reinterpret_cast<char*>(mAutomap.data()), mAutomap.size());
-
-    // Unused list? An array of 33 8.3 filenames are here...
-    stream.ignore(429);
+    reader.read(*this);
+    reader.readArray(mBlockPositions.data(), mBlockPositions.size());
+    reader.readArray(mBuildings.data(), mBuildings.size());
+    reader.read<MapSchema>(*this);
 
     mExteriorBlocks.resize(mBlockCount);
     mInteriorBlocks.resize(mBlockCount);
     for(size_t i = 0;i < mBlockCount;++i)
     {
-        size_t pos = stream.tellg();
-        mExteriorBlocks[i].load(stream, blockid | (i<<17) | 0x00000);
+        size_t pos = reader.tell();
+        mExteriorBlocks[i].load(reader, blockid | (i<<17) | 0x00000);
 
-        mInteriorBlocks[i].load(stream, blockid | (i<<17) | 0x10000);
-        stream.seekg(pos + mBlockSizes[i]);
+        mInteriorBlocks[i].load(reader, blockid | (i<<17) | 0x10000);
+        reader.seek(pos + mBlockSizes[i]);
     }
 
     mModels.reserve(mModelCount);
@@ -411,14 +373,14 @@ void MBlockHeader::load(std::istream &stream, uint8_t climate, size_t blockid, f
     {
         MModel &model = mModels[blockid | 0x00ff0000 | i];
         model.mId = blockid | 0x00ff0000 | i;
-        model.load(stream);
+        model.load(reader);
     }
     mFlats.reserve(mFlatCount);
     for(size_t i = 0;i < mFlatCount;++i)
     {
         MFlat &flat = mFlats[blockid | 0x00ff0000 | (mModelCount+i)];
         flat.mId = blockid | 0x00ff0000 | (mModelCount+i);
-        flat.load(stream);
+        reader.read(flat);
     }
     for(size_t i = 0;i < mGroundScenery.size();++i)
     {
@@ -6,6 +6,7 @@
 #include <array>
 
 #include "misc/sparsearray.hpp"
+#include "misc/record.hpp"
 
 #include "pitems.hpp"
 
@@ -18,8 +19,6 @@ struct MObjectBase {
 
     int32_t mXPos, mYPos, mZPos;
 
-    void load(std::istream &stream);
-
     virtual void print(std::ostream &stream) const;
 };
 struct MModel;
@@ -38,7 +37,13 @@ struct MBlockPosition {
     int32_t mZ;
     int32_t mYRot;
 
-    void load(std::istream &stream);
+    typedef Misc::Record<
+        RECORD_FIELD(MBlockPosition, mUnknown1),
+        RECORD_FIELD(MBlockPosition, mUnknown2),
+        RECORD_FIELD(MBlockPosition, mX),
+        RECORD_FIELD(MBlockPosition, mZ),
+        RECORD_FIELD(MBlockPosition, mYRot)
+    > Schema;
 };
 
 struct MBlockHeader {
@@ -72,11 +77,28 @@ struct MBlockHeader {
     Misc::SparseArray<MFlat> mScenery;
     size_t mTerrainId;
 
+    typedef Misc::Record<
+        RECORD_FIELD(MBlockHeader, mBlockCount),
+        RECORD_FIELD(MBlockHeader, mModelCount),
+        RECORD_FIELD(MBlockHeader, mFlatCount)
+    > Schema;
+    /* Follows the block positions and buildings. */
+    typedef Misc::Record<
+        RECORD_FIELD(MBlockHeader, mUnknown1),
+        RECORD_FIELD(MBlockHeader, mBlockSizes),
+        RECORD_FIELD(MBlockHeader, mUnknown2),
+        RECORD_FIELD(MBlockHeader, mGroundTexture),
+        RECORD_FIELD(MBlockHeader, mGroundScenery),
+        RECORD_FIELD(MBlockHeader, mAutomap),
+        // Unused list? An array of 33 8.3 filenames are here...
+        Misc::Skip<429>
+    > MapSchema;
+
     MBlockHeader();
     ~MBlockHeader();
     void deallocate();
 
-    void load(std::istream &stream, uint8_t climate, size_t blockid, float x, float z);
+    void load(Misc::ByteReader &reader, uint8_t climate, size_t blockid, float x, float z);
 
     MObjectBase *getObject(size_t id);
 
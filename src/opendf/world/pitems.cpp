@@ -66,46 +66,19 @@ static const std::array<std::array<char,5>,45> gBuildingLabel{{
 namespace DF
 {
 
-void ExteriorLocation::load(std::istream& stream)
+static_assert(ExteriorBuilding::Schema::size() == 26, "Unexpected ExteriorBuilding size");
+static_assert(ExteriorLocation::MapSchema::size() == 416, "Unexpected ExteriorLocation map size");
+
+void ExteriorLocation::load(Misc::ByteReader &reader)
 {
-    LocationHeader::load(stream);
+    LocationHeader::load(reader);
 
-    uint16_t mBuildingCount = VFS::read_le16(stream);
-    stream.read(reinterpret_cast<char*>(mUnknown1), sizeof(mUnknown1));
+    reader.read<Schema>(*this);
 
     mBuildings.resize(mBuildingCount);
-    for(ExteriorBuilding &building : mBuildings)
-    {
-        building.mNameSeed = VFS::read_le16(stream);
-        building.mNullValue1 = VFS::read_le32(stream);
-        building.mNullValue2 = VFS::read_le32(stream);
-        building.mNullValue3 = VFS::read_le32(stream);
-        building.mNullValue4 = VFS::read_le32(stream);
-        building.mFactionId = VFS::read_le16(stream);
-        building.mSector = VFS::read_le16(stream);
-        building.mLocationId = VFS::read_le16(stream);
-        building.mBuildingType = stream.get();
-        building.mQuality = stream.get();
-    }
+    reader.readArray(mBuildings.data(), mBuildings.size());
 
-    stream.read(mName, sizeof(mName));
-    mMapId = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    mWidth = stream.get();
-    mHeight = stream.get();
-    stream.read(reinterpret_cast<char*>(mUnknown3), sizeof(mUnknown3));
-    stream.read(reinterpret_cast<char*>(mBlockIndex), sizeof(mBlockIndex));
-    stream.read(reinterpret_cast<char*>(mBlockNumber), sizeof(mBlockNumber));
-    stream.read(reinterpret_cast<char*>(mBlockCharacter), sizeof(mBlockCharacter));
-    stream.read(mName2, sizeof(mName2));
-    mUnknown4 = stream.get();
-    mUnknownCount = stream.get();
-    mNullValue1 = VFS::read_le32(stream);
-    mNullValue2 = VFS::read_le32(stream);
-    mNullValue3 = stream.get();
-    for(uint32_t &val : mUnknown5)
-        val = VFS::read_le32(stream);
-    mUnknown6 = VFS::read_le32(stream);
+    reader.read<MapSchema>(*this);
 }
 
 std::string ExteriorLocation::getMapBlockName(size_t idx, size_t regnum) const
@@ -20,6 +20,19 @@ struct ExteriorBuilding {
     uint16_t mLocationId;
     uint8_t  mBuildingType;
     uint8_t  mQuality;
+
+    typedef Misc::Record<
+        RECORD_FIELD(ExteriorBuilding, mNameSeed),
+        RECORD_FIELD(ExteriorBuilding, mNullValue1),
+        RECORD_FIELD(ExteriorBuilding, mNullValue2),
+        RECORD_FIELD(ExteriorBuilding, mNullValue3),
+        RECORD_FIELD(ExteriorBuilding, mNullValue4),
+        RECORD_FIELD(ExteriorBuilding, mFactionId),
+        RECORD_FIELD(ExteriorBuilding, mSector),
+        RECORD_FIELD(ExteriorBuilding, mLocationId),
+        RECORD_FIELD(ExteriorBuilding, mBuildingType),
+        RECORD_FIELD(ExteriorBuilding, mQuality)
+    > Schema;
 };
 
 struct ExteriorLocation : public LocationHeader {
@@ -46,7 +59,33 @@ struct ExteriorLocation : public LocationHeader {
     uint32_t mUnknown5[32];
     uint32_t mUnknown6;
 
-    void load(std::istream &stream);
+    /* Follows the location header. */
+    typedef Misc::Record<
+        RECORD_FIELD(ExteriorLocation, mBuildingCount),
+        RECORD_FIELD(ExteriorLocation, mUnknown1)
+    > Schema;
+    /* Follows the building list. */
+    typedef Misc::Record<
+        RECORD_FIELD(ExteriorLocation, mName),
+        RECORD_FIELD(ExteriorLocation, mMapId),
+        RECORD_FIELD(ExteriorLocation, mUnknown2),
+        RECORD_FIELD(ExteriorLocation, mWidth),
+        RECORD_FIELD(ExteriorLocation, mHeight),
+        RECORD_FIELD(ExteriorLocation, mUnknown3),
+        RECORD_FIELD(ExteriorLocation, mBlockIndex),
+        RECORD_FIELD(ExteriorLocation, mBlockNumber),
+        RECORD_FIELD(ExteriorLocation, mBlockCharacter),
+        RECORD_FIELD(ExteriorLocation, mName2),
+        RECORD_FIELD(ExteriorLocation, mUnknown4),
+        RECORD_FIELD(ExteriorLocation, mUnknownCount),
+        RECORD_FIELD(ExteriorLocation, mNullValue1),
+        RECORD_FIELD(ExteriorLocation, mNullValue2),
+        RECORD_FIELD(ExteriorLocation, mNullValue3),
+        RECORD_FIELD(ExteriorLocation, mUnknown5),
+        RECORD_FIELD(ExteriorLocation, mUnknown6)
+    > MapSchema;
+
+    void load(Misc::ByteReader &reader);
 
     std::string getMapBlockName(size_t idx, size_t regnum) const;
 };
@@ -1,15 +1,21 @@
 
 #include "world.hpp"
 
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
+#include <chrono>
 #include <array>
+#include <cmath>
 
 #include <osgViewer/Viewer>
 #include <osg/Light>
 #include <osg/Quat>
+#include <osg/Vec2>
+#include <osg/Vec3>
 
 #include "components/vfs/manager.hpp"
+#include "components/dfosg/meshloader.hpp"
 
 #include "render/renderer.hpp"
 #include "render/pipeline.hpp"
@@ -41,22 +47,229 @@ struct DungeonHeader {
         uint32_t mOffset;
         uint16_t mIsDungeon;
         uint16_t mExteriorLocationId;
+
+        typedef Misc::Record<
+            RECORD_FIELD(Offset, mOffset),
+            RECORD_FIELD(Offset, mIsDungeon),
+            RECORD_FIELD(Offset, mExteriorLocationId)
+        > Schema;
     };
 
     uint32_t mDungeonCount;
     std::vector<Offset> mOffsets;
 
-    void load(std::istream &stream)
+    void load(Misc::ByteReader &reader)
     {
-        mDungeonCount = VFS::read_le32(stream);
+        mDungeonCount = reader.get<uint32_t>();
 
         mOffsets.resize(mDungeonCount);
-        for(Offset &offset : mOffsets)
+        reader.readArray(mOffsets.data(), mOffsets.size());
+    }
+};
+
+
+/* Loads the exterior locations from a MAPPITEM file. */
+void loadExteriors(Misc::ByteReader &reader, std::vector<DF::ExteriorLocation> &exteriors, size_t count)
+{
+    std::vector<uint32_t> extoffsets(count);
+    for(uint32_t &offset : extoffsets)
+        offset = reader.get<uint32_t>();
+    size_t extbase_offset = reader.tell();
+
+    uint32_t *extoffset = extoffsets.data();
+    exteriors.resize(extoffsets.size());
+    for(DF::ExteriorLocation &extinfo : exteriors)
+    {
+        reader.seek(extbase_offset + *extoffset);
+        extinfo.load(reader);
+        ++extoffset;
+    }
+}
+
+/* Loads the dungeon interiors from a MAPDITEM file. */
+void loadDungeons(Misc::ByteReader &reader, std::vector<DF::DungeonInterior> &dungeons)
+{
+    DungeonHeader dheader;
+    dheader.load(reader);
+    size_t dbase_offset = reader.tell();
+
+    DungeonHeader::Offset *doffset = dheader.mOffsets.data();
+    dungeons.resize(dheader.mDungeonCount);
+    for(DF::DungeonInterior &dinfo : dungeons)
+    {
+        reader.seek(dbase_offset + doffset->mOffset);
+        dinfo.load(reader);
+        if(dinfo.mExteriorLocationId != doffset->mExteriorLocationId)
+            throw std::runtime_error("Dungeon exterior location id mismatch for "+std::string(dinfo.mLocationName)+": "+
+                std::to_string(dinfo.mExteriorLocationId)+" / "+std::to_string(doffset->mExteriorLocationId));
+        ++doffset;
+    }
+}
+
+
+/* Parses each file with the given function, which returns the number of
+ * records parsed, and reports the throughput.
+ */
+template<typename F>
+void benchParse(const char *label, const std::vector<VFS::EntryData> &files, size_t iterations, F parser)
+{
+    size_t bytes = 0;
+    for(const VFS::EntryData &data : files)
+        bytes += data.size();
+
+    size_t records = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0;i < iterations;++i)
+    {
+        for(size_t j = 0;j < files.size();++j)
+        {
+            Misc::ByteReader reader(files[j].data(), files[j].size());
+            records += parser(reader, j);
+        }
+    }
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    double time = std::max(secs.count(), 1e-9);
+
+    DF::Log::get().stream()<< label<<": "<<files.size()<<" files, "<<(records/iterations)<<" records, "
+                           << (bytes*iterations/time/1048576.0)<<" MiB/s, "<<(records/time)<<" records/s";
+}
+
+/* The ARCH3D parser as it was before planes were stored as flat arrays, with
+ * each plane holding its own vector of points. Only kept for meshbench to
+ * compare against, so it doesn't build anything from the result.
+ */
+struct LegacyPlanePoint {
+    uint32_t mIndex;
+    float mU, mV;
+
+    void load(Misc::ByteReader &reader, uint32_t offset_scale)
+    {
+        uint32_t offset = reader.get<uint32_t>();
+        int u = reader.get<int16_t>();
+        int v = reader.get<int16_t>();
+
+        // See fixTexCoord in meshloader.cpp.
+        int threshold = 0x3fff;
+        while(u > threshold)
+            u = 0x4000 - u;
+        while(u < -threshold)
+            u = 0x4000 + u;
+        while(v > threshold)
+            v = 0x4000 - v;
+        while(v < -threshold)
+            v = 0x4000 + v;
+
+        mIndex = offset / offset_scale;
+        mU = u / 16.0f;
+        mV = v / 16.0f;
+    }
+};
+
+struct LegacyPlane {
+    DFOSG::MdlPlaneHeader mHeader;
+    std::vector<LegacyPlanePoint> mPoints;
+    DFOSG::MdlPoint mNormal;
+    DFOSG::MdlPoint mBinormal;
+
+    void load(Misc::ByteReader &reader, uint32_t offset_scale)
+    {
+        reader.read(mHeader);
+        mPoints.resize(mHeader.getPointCount());
+        for(LegacyPlanePoint &pt : mPoints)
+            pt.load(reader, offset_scale);
+    }
+
+    // Same as Mesh::fixUVs.
+    void fixUVs(const std::vector<DFOSG::MdlPoint> &points)
+    {
+        for(size_t i = 1;i < mPoints.size() && i < 3;++i)
         {
-            offset.mOffset = VFS::read_le32(stream);
-            offset.mIsDungeon = VFS::read_le16(stream);
-            offset.mExteriorLocationId = VFS::read_le16(stream);
+            mPoints[i].mU += mPoints[i-1].mU;
+            mPoints[i].mV += mPoints[i-1].mV;
         }
+
+        const DFOSG::MdlPoint &pt0 = points.at(mPoints.at(0).mIndex);
+        const DFOSG::MdlPoint &pt1 = points.at(mPoints.at(1).mIndex);
+        const DFOSG::MdlPoint &pt2 = points.at(mPoints.at(2).mIndex);
+        osg::Vec3 p0(pt0.x(), pt0.y(), pt0.z());
+        osg::Vec3 p1(pt1.x(), pt1.y(), pt1.z());
+        osg::Vec3 p2(pt2.x(), pt2.y(), pt2.z());
+        osg::Vec2 uv0(mPoints[0].mU, mPoints[0].mV);
+        osg::Vec2 uv1(mPoints[1].mU, mPoints[1].mV);
+        osg::Vec2 uv2(mPoints[2].mU, mPoints[2].mV);
+
+        osg::Vec3 P = p1 - p0;
+        osg::Vec3 Q = p2 - p0;
+        float s1 = uv1.x() - uv0.x();
+        float t1 = uv1.y() - uv0.y();
+        float s2 = uv2.x() - uv0.x();
+        float t2 = uv2.y() - uv0.y();
+
+        float scale = 1.0f / (s1*t2 - s2*t1);
+        osg::Vec3 tangent = (P*t2 - Q*t1) * scale;
+        osg::Vec3 binormal = (Q*s1 - P*s2) * scale;
+
+        osg::Vec3 normal(mNormal.x(), mNormal.y(), mNormal.z());
+        normal.normalize();
+        if(tangent.normalize() > binormal.normalize())
+            binormal = normal ^ tangent;
+        else
+            tangent = normal ^ binormal;
+
+        if(mPoints.size() > 3)
+        {
+            float tdp = tangent * P, tdq = tangent * Q;
+            float bdp = binormal * P, bdq = binormal * Q;
+            float uscale = (tdq == 0.0f || (s1 > 0.0f && std::fabs(tdp) > std::fabs(tdq))) ? (s1/tdp) : (s2/tdq);
+            float vscale = (bdq == 0.0f || (t1 > 0.0f && std::fabs(bdp) > std::fabs(bdq))) ? (t1/bdp) : (t2/bdq);
+
+            for(size_t i = 3;i < mPoints.size();++i)
+            {
+                const DFOSG::MdlPoint &pt = points.at(mPoints[i].mIndex);
+                osg::Vec3 p(pt.x() - p0.x(), pt.y() - p0.y(), pt.z() - p0.z());
+                mPoints[i].mU = (tangent*p)*uscale + uv0.x();
+                mPoints[i].mV = (binormal*p)*vscale + uv0.y();
+            }
+        }
+
+        mBinormal.set(int(binormal.x() * 256.0f), int(binormal.y() * 256.0f), int(binormal.z() * 256.0f));
+    }
+};
+
+struct LegacyMesh {
+    DFOSG::MdlHeader mHeader;
+    std::vector<DFOSG::MdlPoint> mPoints;
+    std::vector<LegacyPlane> mPlanes;
+
+    void load(Misc::ByteReader &reader)
+    {
+        const uint32_t VER_2_5 = ('v' | ('2'<<8) | ('.'<<16) | ('5'<<24));
+
+        reader.read(mHeader);
+        mPoints.resize(mHeader.getPointCount());
+        mPlanes.resize(mHeader.getPlaneCount());
+
+        reader.seek(mHeader.getPointListOffset());
+        reader.readArray(mPoints.data(), mPoints.size());
+
+        reader.seek(mHeader.getPlaneListOffset());
+        uint32_t offset_scale = (mHeader.getVersion() != VER_2_5) ? (4*3) : 4;
+        for(LegacyPlane &plane : mPlanes)
+            plane.load(reader, offset_scale);
+
+        reader.seek(mHeader.getNormalListOffset());
+        for(LegacyPlane &plane : mPlanes)
+            reader.read(plane.mNormal);
+
+        for(LegacyPlane &plane : mPlanes)
+            plane.fixUVs(mPoints);
+
+        std::sort(mPlanes.begin(), mPlanes.end(),
+            [](const LegacyPlane &lhs, const LegacyPlane &rhs)
+            {
+                return lhs.mHeader.getTextureId() < rhs.mHeader.getTextureId();
+            }
+        );
     }
 };
 
@@ -65,38 +278,18 @@ struct DungeonHeader {
 namespace DF
 {
 
-void LocationHeader::load(std::istream &stream)
+static_assert(LocationDoor::Schema::size() == 6, "Unexpected LocationDoor size");
+static_assert(LocationHeader::Schema::size() == 112, "Unexpected LocationHeader size");
+static_assert(MapTable::Schema::size() == 17, "Unexpected MapTable size");
+
+void LocationHeader::load(Misc::ByteReader &reader)
 {
-    mDoorCount = VFS::read_le32(stream);
+    mDoorCount = reader.get<uint32_t>();
 
     mDoors.resize(mDoorCount);
-    for(auto &door : mDoors)
-    {
-        door.mBuildingDataIndex = VFS::read_le16(stream);
-        door.mNullValue = stream.get();
-        door.mUnknownMask = stream.get();
-        door.mUnknown1 = stream.get();
-        door.mUnknown2 = stream.get();
-    }
-
-    mAlwaysOne1 = VFS::read_le32(stream);
-    mNullValue1 = VFS::read_le16(stream);
-    mNullValue2 = stream.get();
-    mX = VFS::read_le32(stream);
-    mNullValue3 = VFS::read_le32(stream);
-    mY = VFS::read_le32(stream);
-    mIsExterior = VFS::read_le16(stream);
-    mNullValue4 = VFS::read_le16(stream);
-    mUnknown1 = VFS::read_le32(stream);
-    mUnknown2 = VFS::read_le32(stream);
-    mAlwaysOne2 = VFS::read_le16(stream);
-    mLocationId = VFS::read_le16(stream);
-    mNullValue5 = VFS::read_le32(stream);
-    mIsInterior = VFS::read_le16(stream);
-    mExteriorLocationId = VFS::read_le32(stream);
-    stream.read(reinterpret_cast<char*>(mNullValue6), sizeof(mNullValue6));
-    stream.read(mLocationName, sizeof(mLocationName));
-    stream.read(reinterpret_cast<char*>(mUnknown3), sizeof(mUnknown3));
+    reader.readArray(mDoors.data(), mDoors.size());
+
+    reader.read<LocationHeader::Schema>(*this);
 }
 
 LogStream& operator<<(LogStream &stream, const LocationHeader &loc)
@@ -226,6 +419,174 @@ CCMD(dwarp)
     }
 }
 
+CCMD(parsebench)
+{
+    size_t iterations = 10;
+    if(!params.empty())
+    {
+        char *end = nullptr;
+        iterations = strtoul(params.c_str(), &end, 10);
+        if(!end || *end != '\0' || iterations == 0)
+        {
+            Log::get().stream(Log::Level_Error)<< "Usage: parsebench [iterations]";
+            return;
+        }
+    }
+
+    /* Load everything up front, so only the parsing is timed. */
+    std::vector<size_t> mapcounts;
+    std::vector<VFS::EntryData> tables, exteriors, dungeons, meshes;
+    for(const std::string &name : VFS::Manager::get().list("MAPNAMES.[0-9]*"))
+    {
+        std::string regstr = name.substr(name.rfind('.')+1);
+        VFS::EntryData names = VFS::Manager::get().readAll(name.c_str());
+        VFS::EntryData table = VFS::Manager::get().readAll("MAPTABLE."+regstr);
+        VFS::EntryData pitem = VFS::Manager::get().readAll("MAPPITEM."+regstr);
+        VFS::EntryData ditem = VFS::Manager::get().readAll("MAPDITEM."+regstr);
+        if(!names || !table || !pitem || !ditem)
+            continue;
+
+        Misc::ByteReader reader(names.data(), names.size());
+        mapcounts.push_back(reader.get<uint32_t>());
+        tables.push_back(table);
+        exteriors.push_back(pitem);
+        dungeons.push_back(ditem);
+    }
+    for(size_t id = 0;id < 100000;++id)
+    {
+        VFS::EntryData data = VFS::Manager::get().readArchId(id);
+        if(data) meshes.push_back(data);
+    }
+
+    try {
+        benchParse("MAPTABLE", tables, iterations,
+            [&mapcounts](Misc::ByteReader &reader, size_t idx) -> size_t
+            {
+                std::vector<MapTable> table(mapcounts[idx]);
+                reader.readArray(table.data(), table.size());
+                return table.size();
+            }
+        );
+        benchParse("MAPPITEM", exteriors, iterations,
+            [&mapcounts](Misc::ByteReader &reader, size_t idx) -> size_t
+            {
+                std::vector<ExteriorLocation> locations;
+                loadExteriors(reader, locations, mapcounts[idx]);
+                return locations.size();
+            }
+        );
+        benchParse("MAPDITEM", dungeons, iterations,
+            [](Misc::ByteReader &reader, size_t) -> size_t
+            {
+                std::vector<DungeonInterior> locations;
+                loadDungeons(reader, locations);
+                return locations.size();
+            }
+        );
+        benchParse("ARCH3D", meshes, iterations,
+            [](Misc::ByteReader &reader, size_t) -> size_t
+            {
+                DFOSG::Mesh mesh;
+                mesh.load(reader);
+                return 1;
+            }
+        );
+    }
+    catch(std::exception &e) {
+        Log::get().stream(Log::Level_Error)<< "Exception: "<<e.what();
+    }
+}
+
+CCMD(meshbench)
+{
+    size_t iterations = 1;
+    if(!params.empty())
+    {
+        char *end = nullptr;
+        iterations = strtoul(params.c_str(), &end, 10);
+        if(!end || *end != '\0' || iterations == 0)
+        {
+            Log::get().stream(Log::Level_Error)<< "Usage: meshbench [iterations]";
+            return;
+        }
+    }
+
+    /* Find every ARCH3D ID. Reading them here also gets them cached or paged
+     * in, so every run starts the same.
+     */
+    std::vector<size_t> ids;
+    for(size_t id = 0;id < 100000;++id)
+    {
+        if(VFS::Manager::get().readArchId(id))
+            ids.push_back(id);
+    }
+    if(ids.empty())
+    {
+        Log::get().stream(Log::Level_Error)<< "No ARCH3D meshes found";
+        return;
+    }
+
+    std::stringstream sstr;
+    sstr<< "Loading "<<ids.size()<<" ARCH3D meshes "<<iterations<<" times:";
+    auto report = [&sstr, &ids, iterations](const char *label, std::chrono::steady_clock::duration time, size_t failed)
+    {
+        std::chrono::duration<double> secs = time;
+        sstr<< "\n  "<<std::setw(8)<<label<<": "<<std::fixed<<std::setprecision(1)<<(secs.count()*1000.0)
+            <<"ms, "<<std::setprecision(0)<<(ids.size()*iterations/std::max(secs.count(), 1e-9))<<" meshes/s";
+        if(failed > 0)
+            sstr<< " ("<<failed<<" failed)";
+    };
+
+    // The old parser, one at a time, for the "before" number.
+    size_t failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0;i < iterations;++i)
+    {
+        for(size_t id : ids)
+        {
+            try {
+                VFS::EntryData data = VFS::Manager::get().readArchId(id);
+                Misc::ByteReader reader(data.data(), data.size());
+                LegacyMesh mesh;
+                mesh.load(reader);
+            }
+            catch(std::exception&) {
+                ++failed;
+            }
+        }
+    }
+    report("legacy", std::chrono::steady_clock::now() - start, failed/iterations);
+
+    // One at a time, as MeshManager loads them.
+    failed = 0;
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0;i < iterations;++i)
+    {
+        for(size_t id : ids)
+        {
+            try {
+                std::unique_ptr<DFOSG::Mesh> mesh(DFOSG::MeshLoader::get().load(id));
+            }
+            catch(std::exception&) {
+                ++failed;
+            }
+        }
+    }
+    report("serial", std::chrono::steady_clock::now() - start, failed/iterations);
+
+    failed = 0;
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0;i < iterations;++i)
+    {
+        std::vector<std::unique_ptr<DFOSG::Mesh>> meshes = DFOSG::MeshLoader::get().loadBatch(ids);
+        for(const std::unique_ptr<DFOSG::Mesh> &mesh : meshes)
+            failed += !mesh;
+    }
+    report("batch", std::chrono::steady_clock::now() - start, failed/iterations);
+
+    Log::get().message(sstr.str());
+}
+
 
 CVAR(CVarBool, g_introspect, false);
 
@@ -252,7 +613,6 @@ void World::initialize(osgViewer::Viewer *viewer, osg::Group *sceneroot)
     std::set<std::string> names = VFS::Manager::get().list("MAPNAMES.[0-9]*");
     if(names.empty()) throw std::runtime_error("Failed to find any regions");
 
-    VFS::IStreamPtr stream;
     for(const std::string &name : names)
     {
         size_t pos = name.rfind('.');
@@ -262,10 +622,11 @@ void World::initialize(osgViewer::Viewer *viewer, osg::Group *sceneroot)
         unsigned long regnum = std::stoul(regstr, nullptr, 10);
 
         /* Get names */
-        stream = VFS::Manager::get().open(name.c_str());
-        if(!stream) throw std::runtime_error("Failed to open "+name);
+        VFS::EntryData data = VFS::Manager::get().readAll(name.c_str());
+        if(!data) throw std::runtime_error("Failed to open "+name);
+        Misc::ByteReader reader(data.data(), data.size());
 
-        uint32_t mapcount = VFS::read_le32(*stream);
+        uint32_t mapcount = reader.get<uint32_t>();
         if(mapcount == 0) continue;
 
         MapRegion region;
@@ -273,73 +634,37 @@ void World::initialize(osgViewer::Viewer *viewer, osg::Group *sceneroot)
         for(std::string &mapname : region.mNames)
         {
             char mname[32];
-            if(!stream->read(mname, sizeof(mname)) || stream->gcount() != sizeof(mname))
-                throw std::runtime_error("Failed to read map names from "+name);
+            reader.read(mname, sizeof(mname));
             mapname.assign(mname, sizeof(mname));
             size_t end = mapname.find('\0');
             if(end != std::string::npos)
                 mapname.resize(end);
         }
-        stream = nullptr;
 
         /* Get table data */
         std::string fname = "MAPTABLE."+regstr;
-        stream = VFS::Manager::get().open(fname.c_str());
-        if(!stream) throw std::runtime_error("Failed to open "+fname);
+        data = VFS::Manager::get().readAll(fname.c_str());
+        if(!data) throw std::runtime_error("Failed to open "+fname);
+        reader = Misc::ByteReader(data.data(), data.size());
 
         region.mTable.resize(region.mNames.size());
-        for(MapTable &maptable : region.mTable)
-        {
-            maptable.mMapId = VFS::read_le32(*stream);
-            maptable.mUnknown1 = stream->get();
-            maptable.mLongitudeType = VFS::read_le32(*stream);
-            maptable.mLatitude = VFS::read_le16(*stream);
-            maptable.mUnknown2 = VFS::read_le16(*stream);
-            maptable.mUnknown3 = VFS::read_le32(*stream);
-        }
-        stream = nullptr;
+        reader.readArray(region.mTable.data(), region.mTable.size());
 
         /* Get exterior data */
         fname = "MAPPITEM."+regstr;
-        stream = VFS::Manager::get().open(fname.c_str());
-        if(!stream) throw std::runtime_error("Failed to open "+fname);
+        data = VFS::Manager::get().readAll(fname.c_str());
+        if(!data) throw std::runtime_error("Failed to open "+fname);
+        reader = Misc::ByteReader(data.data(), data.size());
 
-        std::vector<uint32_t> extoffsets(region.mNames.size());
-        for(uint32_t &offset : extoffsets)
-            offset = VFS::read_le32(*stream);
-        std::streamoff extbase_offset = stream->tellg();
-
-        uint32_t *extoffset = extoffsets.data();
-        region.mExteriors.resize(extoffsets.size());
-        for(ExteriorLocation &extinfo : region.mExteriors)
-        {
-            stream->seekg(extbase_offset + *extoffset);
-            extinfo.load(*stream);
-            ++extoffset;
-        }
-        stream = nullptr;
+        loadExteriors(reader, region.mExteriors, region.mNames.size());
 
         /* Get dungeon data */
         fname = "MAPDITEM."+regstr;
-        stream = VFS::Manager::get().open(fname.c_str());
-        if(!stream) throw std::runtime_error("Failed to open "+fname);
-
-        DungeonHeader dheader;
-        dheader.load(*stream);
-        std::streamoff dbase_offset = stream->tellg();
+        data = VFS::Manager::get().readAll(fname.c_str());
+        if(!data) throw std::runtime_error("Failed to open "+fname);
+        reader = Misc::ByteReader(data.data(), data.size());
 
-        DungeonHeader::Offset *doffset = dheader.mOffsets.data();
-        region.mDungeons.resize(dheader.mDungeonCount);
-        for(DungeonInterior &dinfo : region.mDungeons)
-        {
-            stream->seekg(dbase_offset + doffset->mOffset);
-            dinfo.load(*stream);
-            if(dinfo.mExteriorLocationId != doffset->mExteriorLocationId)
-                throw std::runtime_error("Dungeon exterior location id mismatch for "+std::string(dinfo.mLocationName)+": "+
-                    std::to_string(dinfo.mExteriorLocationId)+" / "+std::to_string(doffset->mExteriorLocationId));
-            ++doffset;
-        }
-        stream = nullptr;
+        loadDungeons(reader, region.mDungeons);
 
         if(regnum >= mRegions.size()) mRegions.resize(regnum+1);
         mRegions[regnum] = std::move(region);
@@ -363,14 +688,15 @@ void World::deinitialize()
 
 void World::loadPakList(std::string&& fname, std::vector<PakArray> &paklist)
 {
-    VFS::IStreamPtr stream = VFS::Manager::get().open(fname.c_str());
-    if(!stream) throw std::runtime_error("Failed to open "+fname);
+    VFS::EntryData data = VFS::Manager::get().readAll(fname.c_str());
+    if(!data) throw std::runtime_error("Failed to open "+fname);
+    Misc::ByteReader reader(data.data(), data.size());
 
     size_t rownum = 0;
     std::map<size_t,size_t> offsets_rows;
-    offsets_rows[VFS::read_le32(*stream)] = rownum++;
-    while((size_t)stream->tellg() < offsets_rows.begin()->first)
-        offsets_rows[VFS::read_le32(*stream)] = rownum++;
+    offsets_rows[reader.get<uint32_t>()] = rownum++;
+    while(reader.tell() < offsets_rows.begin()->first)
+        offsets_rows[reader.get<uint32_t>()] = rownum++;
 
     auto iter = offsets_rows.begin();
     while(iter != offsets_rows.end())
@@ -378,11 +704,11 @@ void World::loadPakList(std::string&& fname, std::vector<PakArray> &paklist)
         auto next = std::next(iter);
 
         PakArray pak;
-        while((next != offsets_rows.end() && (size_t)stream->tellg() < next->first) ||
-              (next == offsets_rows.end() && stream->peek() != std::istream::traits_type::eof()))
+        while((next != offsets_rows.end() && reader.tell() < next->first) ||
+              (next == offsets_rows.end() && !reader.eof()))
         {
-            uint16_t count = VFS::read_le16(*stream);
-            uint8_t val = stream->get();
+            uint16_t count = reader.get<uint16_t>();
+            uint8_t val = reader.get<uint8_t>();
             pak.push_back(std::make_pair(count, val));
         }
 
@@ -468,6 +794,15 @@ void World::loadExterior(int regnum, int extid)
     size_t count = extloc.mWidth * extloc.mHeight;
     size_t startobj = InvalidHandle;
 
+    {
+        // Start reading the blocks in the background while they're parsed.
+        std::vector<std::string> names;
+        names.reserve(count);
+        for(size_t i = 0;i < count;++i)
+            names.push_back(extloc.getMapBlockName(i, regnum));
+        VFS::Manager::get().prefetch(names);
+    }
+
     mExterior.reserve(count);
     for(size_t i = 0;i < count;++i)
     {
@@ -476,20 +811,21 @@ void World::loadExterior(int regnum, int extid)
         {
             Log::get().stream()<< name<<" does not exist";
             name.erase(4);
-            name[4] = '*';
+            name += '*';
             std::set<std::string> list = VFS::Manager::get().list(name.c_str());
             if(list.empty()) name.clear();
             else name = *list.begin();
         }
 
-        VFS::IStreamPtr stream = VFS::Manager::get().open(name.c_str());
-        if(!stream) throw std::runtime_error("Failed to open "+name);
+        VFS::EntryData data = VFS::Manager::get().readAll(name.c_str());
+        if(!data) throw std::runtime_error("Failed to open "+name);
+        Misc::ByteReader reader(data.data(), data.size());
 
         int x = i%extloc.mWidth;
         int y = i/extloc.mWidth;
 
         mExterior.push_back(std::unique_ptr<MBlockHeader>(new MBlockHeader()));
-        mExterior.back()->load(*stream, climate, i<<24, x*4096.0f, y*4096.0f);
+        mExterior.back()->load(reader, climate, i<<24, x*4096.0f, y*4096.0f);
 
         if(startobj != InvalidHandle)
             continue;
@@ -534,19 +870,29 @@ void World::loadDungeonByExterior(int regnum, int extid)
         Log::get().stream()<< "Climate "<<(int)climate;
 
         Log::get().stream()<< "Entering "<<dinfo.mLocationName;
-        mDungeon.reserve(dinfo.mBlocks.size());
+        std::vector<std::string> names;
+        names.reserve(dinfo.mBlocks.size());
         for(const DungeonBlock &block : dinfo.mBlocks)
         {
             std::stringstream sstr;
             sstr<< std::setfill('0')<<std::setw(8)<< block.mBlockIdx<<".RDB";
-            std::string name = sstr.str();
-            name.front() = gBlockIndexLabel.at(block.mBlockPreIndex);
+            names.push_back(sstr.str());
+            names.back().front() = gBlockIndexLabel.at(block.mBlockPreIndex);
+        }
+        // Start reading the blocks in the background while they're parsed.
+        VFS::Manager::get().prefetch(names);
+
+        mDungeon.reserve(dinfo.mBlocks.size());
+        for(const DungeonBlock &block : dinfo.mBlocks)
+        {
+            const std::string &name = names[std::distance(dinfo.mBlocks.data(), &block)];
 
-            VFS::IStreamPtr stream = VFS::Manager::get().open(name.c_str());
-            if(!stream) throw std::runtime_error("Failed to open "+name);
+            VFS::EntryData data = VFS::Manager::get().readAll(name.c_str());
+            if(!data) throw std::runtime_error("Failed to open "+name);
+            Misc::ByteReader reader(data.data(), data.size());
 
             mDungeon.push_back(std::unique_ptr<DBlockHeader>(new DBlockHeader()));
-            mDungeon.back()->load(*stream, std::distance(dinfo.mBlocks.data(), &block)<<24,
+            mDungeon.back()->load(reader, std::distance(dinfo.mBlocks.data(), &block)<<24,
                                   block.mX*2048.0f, block.mZ*2048.0f, regnum, extid);
 
             if(block.mStartBlock)
@@ -44,6 +44,15 @@ struct MapTable {
     uint16_t mLatitude;
     uint16_t mUnknown2;
     uint32_t mUnknown3;
+
+    typedef Misc::Record<
+        RECORD_FIELD(MapTable, mMapId),
+        RECORD_FIELD(MapTable, mUnknown1),
+        RECORD_FIELD(MapTable, mLongitudeType),
+        RECORD_FIELD(MapTable, mLatitude),
+        RECORD_FIELD(MapTable, mUnknown2),
+        RECORD_FIELD(MapTable, mUnknown3)
+    > Schema;
 };
 
 struct MapRegion {
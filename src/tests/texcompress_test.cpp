@@ -0,0 +1,104 @@
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+#include "components/dfosg/texcompress.hpp"
+
+
+namespace
+{
+
+struct Color {
+    int r, g, b;
+};
+
+Color unpackColor(const unsigned char *src)
+{
+    int c = src[0] | (src[1]<<8);
+    int r = (c>>11) & 31;
+    int g = (c>>5) & 63;
+    int b = c & 31;
+    return Color{(r<<3) | (r>>2), (g<<2) | (g>>4), (b<<3) | (b>>2)};
+}
+
+/* Decodes the color half of a BC1/BC3 block to 16 colors. */
+void decodeColorBlock(const unsigned char *src, Color (&out)[16])
+{
+    Color palette[4];
+    palette[0] = unpackColor(src);
+    palette[1] = unpackColor(src+2);
+    if((src[0] | (src[1]<<8)) > (src[2] | (src[3]<<8)))
+    {
+        palette[2] = Color{(2*palette[0].r+palette[1].r)/3, (2*palette[0].g+palette[1].g)/3,
+                           (2*palette[0].b+palette[1].b)/3};
+        palette[3] = Color{(palette[0].r+2*palette[1].r)/3, (palette[0].g+2*palette[1].g)/3,
+                           (palette[0].b+2*palette[1].b)/3};
+    }
+    else
+    {
+        palette[2] = Color{(palette[0].r+palette[1].r)/2, (palette[0].g+palette[1].g)/2,
+                           (palette[0].b+palette[1].b)/2};
+        palette[3] = Color{0, 0, 0};
+    }
+
+    uint32_t indices = src[4] | (src[5]<<8) | (src[6]<<16) | (uint32_t(src[7])<<24);
+    for(size_t i = 0;i < 16;++i)
+        out[i] = palette[(indices >> (i*2)) & 3];
+}
+
+bool isClose(const Color &color, const unsigned char *texel)
+{
+    return std::abs(color.r - texel[0]) <= 8 && std::abs(color.g - texel[1]) <= 8 &&
+           std::abs(color.b - texel[2]) <= 8;
+}
+
+/* Compresses a 4x4 checker of the two colors, and checks every texel comes
+ * back as its own color.
+ */
+bool testChecker(DFOSG::BlockFormat format, const unsigned char (&a)[4], const unsigned char (&b)[4],
+                 const char *name)
+{
+    unsigned char texels[16][4];
+    for(size_t i = 0;i < 16;++i)
+        memcpy(texels[i], (((i&3) ^ (i>>2)) & 1) ? b : a, 4);
+
+    std::vector<unsigned char> block(DFOSG::getCompressedSize(format, 4, 4));
+    DFOSG::compressImage(format, &texels[0][0], 4, 4, block.data());
+
+    Color decoded[16];
+    decodeColorBlock(block.data() + ((format == DFOSG::Block_BC3) ? 8 : 0), decoded);
+    for(size_t i = 0;i < 16;++i)
+    {
+        if(!isClose(decoded[i], texels[i]))
+        {
+            std::cerr<< (format == DFOSG::Block_BC3 ? "BC3 " : "BC1 ")<<name<<" checker: texel "<<i
+                     <<" decoded as "<<decoded[i].r<<","<<decoded[i].g<<","<<decoded[i].b
+                     <<", expected "<<int(texels[i][0])<<","<<int(texels[i][1])<<","<<int(texels[i][2])
+                     <<std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+int main()
+{
+    const unsigned char red[4] = { 255, 0, 0, 255 };
+    const unsigned char green[4] = { 0, 255, 0, 255 };
+    const unsigned char blue[4] = { 0, 0, 255, 255 };
+    const unsigned char grey[4] = { 128, 128, 128, 255 };
+
+    bool ok = true;
+    for(DFOSG::BlockFormat format : { DFOSG::Block_BC1, DFOSG::Block_BC3 })
+    {
+        ok &= testChecker(format, red, green, "red/green");
+        ok &= testChecker(format, red, blue, "red/blue");
+        ok &= testChecker(format, grey, grey, "solid grey");
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}